@@ -0,0 +1,120 @@
+// Acknowledgment format shared by server and client.
+// One ACK carries a cumulative acknowledgment plus up to SACK_BLOCKS ranges of
+// frames received past a gap, so the server can skip frames that already
+// arrived and a single ACK can cover many frames. With FEC on it also reports
+// running totals of frames lost per block, which the server turns into a
+// loss estimate (totals survive lost ACKs).
+// Multicast receivers send NACKs instead: ranges of frames they are missing.
+// Both are sent big-endian with fixed field widths (see wire.h); the structs
+// below are the host copies.
+#ifndef ACK_H
+#define ACK_H
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include "wire.h"
+
+#define ACK_MAGIC 0x41434b31 // "ACK1", tells ACKs apart from requests
+#define SACK_BLOCKS 4 // Max received ranges reported above cumulative ACK
+
+// Acknowledgment packet (only first n_blocks SACK ranges are sent)
+struct ack_packet {
+    int magic; // ACK_MAGIC
+    int n_blocks; // SACK ranges that follow
+    long int cum_ack; // Every frame up to and including this one has arrived
+    long int trigger; // Frame whose arrival caused this ACK (used for RTT samples)
+    unsigned int fec_shares; // FEC: data and parity frames of blocks client finished so far (0 = FEC off)
+    unsigned int fec_lost; // FEC: how many of those did not arrive in time
+    long int sack[SACK_BLOCKS][2]; // Received ranges [start, end] above cum_ack
+};
+
+#define ACK_SIZE(n) (32 + (size_t)(n) * 16) // Bytes on wire for n SACK ranges
+
+// Function to write an ACK into `buf` (at least ACK_SIZE(SACK_BLOCKS) bytes), returns bytes to send
+static inline size_t ack_encode(const struct ack_packet* ack, unsigned char* buf) {
+    wire_put32(buf, ACK_MAGIC);
+    wire_put32(buf + 4, (uint32_t)ack->n_blocks);
+    wire_put64(buf + 8, (uint64_t)ack->cum_ack);
+    wire_put64(buf + 16, (uint64_t)ack->trigger);
+    wire_put32(buf + 24, ack->fec_shares);
+    wire_put32(buf + 28, ack->fec_lost);
+    for (int i = 0; i < ack->n_blocks; i++) {
+        wire_put64(buf + 32 + 16 * i, (uint64_t)ack->sack[i][0]);
+        wire_put64(buf + 40 + 16 * i, (uint64_t)ack->sack[i][1]);
+    }
+    return ACK_SIZE(ack->n_blocks);
+}
+
+// Function to check a datagram is a well-formed ACK and read it out
+static inline int ack_parse(const void* data, ssize_t len, struct ack_packet* ack) {
+    const unsigned char* buf = data;
+    if (len < (ssize_t)ACK_SIZE(0) || wire_get32(buf) != ACK_MAGIC) {
+        return 0;
+    }
+    ack->magic = ACK_MAGIC;
+    ack->n_blocks = (int)wire_get32(buf + 4);
+    if (ack->n_blocks < 0 || ack->n_blocks > SACK_BLOCKS || len != (ssize_t)ACK_SIZE(ack->n_blocks)) {
+        return 0;
+    }
+    ack->cum_ack = (long int)wire_get64(buf + 8);
+    ack->trigger = (long int)wire_get64(buf + 16);
+    ack->fec_shares = wire_get32(buf + 24);
+    ack->fec_lost = wire_get32(buf + 28);
+    for (int i = 0; i < ack->n_blocks; i++) {
+        ack->sack[i][0] = (long int)wire_get64(buf + 32 + 16 * i);
+        ack->sack[i][1] = (long int)wire_get64(buf + 40 + 16 * i);
+    }
+    return 1;
+}
+
+#define NACK_MAGIC 0x4e414b31 // "NAK1", tells NACKs apart from ACKs and requests
+#define NACK_RANGES 16 // Max missing ranges in one NACK
+#define NACK_JOIN 1 // NACK flag: receiver is (still) waiting to join a multicast transfer
+#define NACK_DONE 2 // NACK flag: receiver has every frame and is leaving
+
+// Negative acknowledgment from a multicast receiver (only first n_ranges ranges are sent)
+struct nack_packet {
+    int magic; // NACK_MAGIC
+    int n_ranges; // Missing ranges that follow
+    int flags; // NACK_JOIN, NACK_DONE
+    long int have; // Frames receiver has so far
+    long int range[NACK_RANGES][2]; // Missing ranges [start, end]
+};
+
+#define NACK_SIZE(n) (16 + (size_t)(n) * 16) // Bytes on wire for n ranges
+
+// Function to write a NACK into `buf` (at least NACK_SIZE(NACK_RANGES) bytes), returns bytes to send
+static inline size_t nack_encode(const struct nack_packet* nack, unsigned char* buf) {
+    wire_put32(buf, NACK_MAGIC);
+    wire_put16(buf + 4, (uint16_t)nack->n_ranges);
+    wire_put16(buf + 6, (uint16_t)nack->flags);
+    wire_put64(buf + 8, (uint64_t)nack->have);
+    for (int i = 0; i < nack->n_ranges; i++) {
+        wire_put64(buf + 16 + 16 * i, (uint64_t)nack->range[i][0]);
+        wire_put64(buf + 24 + 16 * i, (uint64_t)nack->range[i][1]);
+    }
+    return NACK_SIZE(nack->n_ranges);
+}
+
+// Function to check a datagram is a well-formed NACK and read it out
+static inline int nack_parse(const void* data, ssize_t len, struct nack_packet* nack) {
+    const unsigned char* buf = data;
+    if (len < (ssize_t)NACK_SIZE(0) || wire_get32(buf) != NACK_MAGIC) {
+        return 0;
+    }
+    nack->magic = NACK_MAGIC;
+    nack->n_ranges = wire_get16(buf + 4);
+    if (nack->n_ranges > NACK_RANGES || len != (ssize_t)NACK_SIZE(nack->n_ranges)) {
+        return 0;
+    }
+    nack->flags = wire_get16(buf + 6);
+    nack->have = (long int)wire_get64(buf + 8);
+    for (int i = 0; i < nack->n_ranges; i++) {
+        nack->range[i][0] = (long int)wire_get64(buf + 16 + 16 * i);
+        nack->range[i][1] = (long int)wire_get64(buf + 24 + 16 * i);
+    }
+    return 1;
+}
+
+#endif
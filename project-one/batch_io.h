@@ -0,0 +1,674 @@
+// Batched datagram I/O shared by server and client.
+// Outgoing datagrams are queued and sent together with one sendmmsg(), and
+// incoming datagrams are drained with one recvmmsg() and handed out one at a
+// time. A batch size of 1 keeps the classic one sendto()/recvfrom() per
+// datagram path so both can be compared at runtime. A datagram can also be
+// gathered from a header plus a payload pointer that is sent without copying.
+// With segmentation offload on, consecutive datagrams of one size to one peer
+// leave as a single UDP GSO train (one message the kernel or NIC cuts back into
+// datagrams), and a receive buffer the kernel coalesced with UDP GRO is handed
+// out again one datagram at a time. A kernel that cannot segment a train gets
+// its datagrams one by one instead. A batch can also go through an io_uring of
+// its own (see uring.h): queued messages become one SENDMSG each on the
+// registered socket, submitted and reaped with a single io_uring_enter(), and
+// receives come from one multishot RECVMSG that stays armed, so a receive only
+// makes a syscall when nothing has arrived yet.
+// Including file must define _GNU_SOURCE before its first system header.
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uring.h"
+
+#define BATCH_MAX 64 // Default datagrams per sendmmsg/recvmmsg call
+#define BATCH_GSO_SEGMENTS 64 // Most datagrams in one GSO train (kernel's UDP_MAX_SEGMENTS is at least 64)
+#define BATCH_GSO_BYTES (65535 - 20 - 8) // Most bytes in one GSO train: one IPv4 datagram's worth
+#define BATCH_GRO_BYTES 65535 // Receive slot size needed to hold a GRO-coalesced buffer whole
+#define BATCH_CTRL_SIZE CMSG_SPACE(sizeof(int)) // Control buffer per message (UDP_SEGMENT or UDP_GRO)
+
+// Queue of datagrams for one direction (tx or rx) on a socket
+struct batch_io {
+    int size; // Datagrams per syscall (1 = classic sendto/recvfrom)
+    int slot_size; // Bytes reserved per datagram
+    int count; // tx: messages queued, rx: messages received by last call
+    int queued; // tx: datagrams queued (slots used; a GSO train holds several)
+    int next; // rx: next message to hand out from
+    size_t offset; // rx: bytes of that message already handed out
+    int gso; // 1 = queue equal-sized datagrams to one peer as GSO trains
+    int gro; // 1 = socket may coalesce received datagrams (UDP_GRO)
+    char* bufs; // size * slot_size bytes of datagram storage
+    struct mmsghdr* msgs; // Message headers for sendmmsg/recvmmsg
+    struct iovec* iovs; // Two iovecs per slot (header/slot, external payload); a train's slots are consecutive
+    struct sockaddr_in* addrs; // Peer address per slot
+    int* seg; // Per message: tx GSO segment size, rx GRO segment size (0 = one datagram)
+    size_t* bytes; // tx: bytes queued per message
+    char* ctrl; // BATCH_CTRL_SIZE bytes of control data per message
+    struct uring* ring; // io_uring messages go through, NULL = sendmmsg/recvmmsg
+    int ring_sock; // Socket ring was set up for
+    int ring_file; // Its registered file slot, -1 = passed as plain descriptor
+    int ring_wait; // rx: socket is blocking, so a receive waits for first datagram
+    int ring_want; // rx: receives to post next time: doubles while they all fill, else one more than last filled
+    int multishot; // rx: 1 = receive with a multishot RECVMSG, 0 = kernel lacks it, post chained RECVMSGs
+    int armed; // rx: 1 while multishot receive is armed
+    struct uring_bufs* pbufs; // rx: provided buffers multishot receive fills, NULL until first receive
+    unsigned short* bids; // rx: provided buffer each received message is in, handed back on next refill
+    struct msghdr ring_msg; // rx: name and control sizes multishot receive lays out in each buffer
+    int* res; // Result of each message's io_uring operation
+    long long timeout; // rx: longest a blocking io_uring receive waits (us, 0 = forever), as SO_RCVTIMEO does for recvmmsg
+    struct __kernel_timespec wait_ts; // Linked timeout of a blocking io_uring receive
+    long long calls; // Datagram syscalls made
+    long long datagrams; // Datagrams moved
+    long long offloaded; // Of them, datagrams sent in a GSO train or received coalesced by GRO
+};
+
+// Function to allocate a batch of `size` slots of `slot_size` bytes each
+static inline void batch_init(struct batch_io* b, int size, int slot_size) {
+    memset(b, 0, sizeof(*b));
+    b->size = size < 1 ? 1 : size;
+    b->slot_size = slot_size;
+    b->bufs = malloc((size_t)b->size * slot_size);
+    b->msgs = calloc(b->size, sizeof(struct mmsghdr));
+    b->iovs = calloc(2 * (size_t)b->size, sizeof(struct iovec));
+    b->addrs = calloc(b->size, sizeof(struct sockaddr_in));
+    b->seg = calloc(b->size, sizeof(int));
+    b->bytes = calloc(b->size, sizeof(size_t));
+    b->ctrl = calloc(b->size, BATCH_CTRL_SIZE);
+    if (!b->bufs || !b->msgs || !b->iovs || !b->addrs || !b->seg || !b->bytes || !b->ctrl) {
+        perror("Memory allocation failed for batch I/O");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to release batch storage
+static inline void batch_free(struct batch_io* b) {
+    free(b->bufs);
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->seg);
+    free(b->bytes);
+    free(b->ctrl);
+    free(b->res);
+    free(b->bids);
+    if (b->ring) {
+        uring_free(b->ring);
+        free(b->ring);
+    }
+    if (b->pbufs) {
+        uring_bufs_free(b->pbufs);
+        free(b->pbufs);
+    }
+}
+
+// Function to move a batch's sends or receives on socket `s` to an io_uring of its own, with `s` registered in it.
+// Returns 1 on success, 0 if kernel has no io_uring (never with batch size 1), leaving sendmmsg/recvmmsg in use.
+static inline int batch_enable_uring(int s, struct batch_io* b) {
+    if (b->size == 1 || b->ring) {
+        return b->ring != NULL;
+    }
+    struct uring* r = malloc(sizeof(*r));
+    b->res = calloc(b->size, sizeof(int));
+    if (!r || !b->res || uring_init(r, (unsigned)b->size + 1) == -1) { // A slot per message, plus a receive's timeout
+        free(r);
+        free(b->res);
+        b->res = NULL;
+        return 0;
+    }
+    int flags = fcntl(s, F_GETFL);
+    b->ring = r;
+    b->ring_sock = s;
+    b->ring_file = uring_register_file(r, s);
+    b->ring_wait = flags != -1 && !(flags & O_NONBLOCK);
+    b->ring_want = 1;
+    b->multishot = 1;
+    return 1;
+}
+
+// Function to get descriptor an io_uring operation on `s` names, setting `fixed` when it is a registered slot
+static inline int batch_ring_fd(const struct batch_io* b, int s, int* fixed) {
+    *fixed = b->ring_file >= 0 && s == b->ring_sock;
+    return *fixed ? b->ring_file : s;
+}
+
+// Function to let a send batch queue runs of equal-sized datagrams to one peer as GSO trains.
+// Returns 1 if kernel supports UDP segmentation offload (never with batch size 1).
+static inline int batch_enable_gso(int s, struct batch_io* b) {
+    int seg = 0;
+    socklen_t len = sizeof(seg);
+    b->gso = b->size > 1 && getsockopt(s, SOL_UDP, UDP_SEGMENT, &seg, &len) == 0;
+    return b->gso;
+}
+
+// Function to let socket `s` coalesce received datagrams (UDP_GRO) that receive batch `b` splits up again.
+// Slots grow to hold a coalesced buffer whole. Returns 1 if kernel supports it (never with batch size 1, since
+// recvfrom() cannot tell where coalesced datagrams end).
+static inline int batch_enable_gro(int s, struct batch_io* b) {
+    int on = 1;
+    if (b->size == 1 || setsockopt(s, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1) {
+        return 0;
+    }
+    if (b->slot_size < BATCH_GRO_BYTES) {
+        char* bufs = realloc(b->bufs, (size_t)b->size * BATCH_GRO_BYTES);
+        if (!bufs) {
+            on = 0;
+            setsockopt(s, SOL_UDP, UDP_GRO, &on, sizeof(on));
+            return 0;
+        }
+        b->bufs = bufs;
+        b->slot_size = BATCH_GRO_BYTES;
+    }
+    b->gro = 1;
+    return 1;
+}
+
+// Function to point message `m` at `iovlen` iovecs and address of slot `slot`, with no control data
+static inline void batch_msg(struct batch_io* b, int m, int slot, int iovlen) {
+    memset(&b->msgs[m], 0, sizeof(b->msgs[m]));
+    b->msgs[m].msg_hdr.msg_name = &b->addrs[slot];
+    b->msgs[m].msg_hdr.msg_namelen = sizeof(b->addrs[slot]);
+    b->msgs[m].msg_hdr.msg_iov = &b->iovs[2 * slot];
+    b->msgs[m].msg_hdr.msg_iovlen = iovlen;
+}
+
+// Function to turn message `m` into a GSO train of `seg` byte datagrams
+static inline void batch_set_segment(struct batch_io* b, int m, int seg) {
+    struct msghdr* h = &b->msgs[m].msg_hdr;
+    uint16_t size = (uint16_t)seg;
+    h->msg_control = b->ctrl + (size_t)m * BATCH_CTRL_SIZE;
+    h->msg_controllen = CMSG_SPACE(sizeof(size));
+    struct cmsghdr* c = CMSG_FIRSTHDR(h);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(size));
+    memcpy(CMSG_DATA(c), &size, sizeof(size));
+    b->seg[m] = seg;
+}
+
+// Function to requeue messages from `m` on as one message per datagram (kernel refused to segment message `m`)
+static inline void batch_split(struct batch_io* b, int m) {
+    int first = (int)(b->msgs[m].msg_hdr.msg_iov - b->iovs) / 2; // Slots are consecutive from message m's first
+    b->count = m;
+    for (int slot = first; slot < b->queued; slot++) {
+        batch_msg(b, b->count, slot, 2);
+        b->seg[b->count] = 0;
+        b->bytes[b->count] = b->iovs[2 * slot].iov_len + b->iovs[2 * slot + 1].iov_len;
+        b->count++;
+    }
+}
+
+// Function to send GSO train `m` the kernel refused to segment one datagram at a time, returns datagrams sent
+static inline int batch_send_singles(int s, struct batch_io* b, int m) {
+    struct msghdr h = b->msgs[m].msg_hdr;
+    int sent = 0;
+    h.msg_control = NULL;
+    h.msg_controllen = 0;
+    h.msg_iovlen = 2;
+    for (int k = 0; k < (int)b->msgs[m].msg_hdr.msg_iovlen / 2; k++) {
+        h.msg_iov = b->msgs[m].msg_hdr.msg_iov + 2 * k;
+        b->calls++;
+        sent += sendmsg(s, &h, 0) != -1;
+    }
+    return sent;
+}
+
+// Function to send every queued message through batch's io_uring: one SENDMSG each, submitted and waited for
+// with one io_uring_enter(), returns datagrams sent
+static inline int batch_flush_uring(int s, struct batch_io* b) {
+    int fixed, fd = batch_ring_fd(b, s, &fixed);
+    int datagrams = 0, failed = 0, err = 0;
+    for (int first = 0; first < b->count;) {
+        struct io_uring_sqe* sqe;
+        int n = 0;
+        while (first + n < b->count && (sqe = uring_sqe(b->ring))) {
+            uring_prep(sqe, IORING_OP_SENDMSG, fd, fixed, &b->msgs[first + n].msg_hdr, 1, 0, first + n);
+            n++;
+        }
+        b->calls++;
+        if (uring_submit(b->ring, n) == -1) {
+            perror("io_uring_enter");
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            struct io_uring_cqe* cqe = uring_cqe(b->ring);
+            int m = (int)cqe->user_data, res = cqe->res;
+            int count = (int)b->msgs[m].msg_hdr.msg_iovlen / 2;
+            uring_cqe_seen(b->ring);
+            if (res >= 0) {
+                datagrams += count;
+                b->offloaded += count > 1 ? count : 0;
+            } else if (b->seg[m] && (res == -EINVAL || res == -EIO || res == -EOPNOTSUPP || res == -ENOPROTOOPT)) {
+                // Train could not be segmented, as in batch_flush()
+                if (res != -EINVAL) {
+                    b->gso = 0;
+                }
+                datagrams += batch_send_singles(s, b, m);
+            } else {
+                failed++;
+                err = -res;
+            }
+        }
+        first += n;
+    }
+    if (failed) {
+        errno = err;
+        perror("sendmsg"); // Socket buffer full counts as a loss, ARQ recovers it
+    }
+    b->datagrams += datagrams;
+    b->count = 0;
+    b->queued = 0;
+    return datagrams;
+}
+
+// Function to send every queued datagram, returns number the kernel accepted
+static inline int batch_flush(int s, struct batch_io* b) {
+    if (b->ring) {
+        return batch_flush_uring(s, b);
+    }
+    int sent = 0, datagrams = 0;
+    while (sent < b->count) {
+        int r = sendmmsg(s, b->msgs + sent, b->count - sent, 0);
+        b->calls++;
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (b->seg[sent] && (errno == EINVAL || errno == EIO || errno == EOPNOTSUPP || errno == ENOPROTOOPT)) {
+                // Train could not be segmented: datagram bigger than path MTU allows (this train only), or no offload
+                if (errno != EINVAL) {
+                    b->gso = 0;
+                }
+                batch_split(b, sent);
+                continue;
+            }
+            perror("sendmmsg"); // Socket buffer full counts as a loss, ARQ recovers it
+            break;
+        }
+        for (int m = sent; m < sent + r; m++) {
+            int n = (int)b->msgs[m].msg_hdr.msg_iovlen / 2;
+            datagrams += n;
+            b->offloaded += n > 1 ? n : 0;
+        }
+        sent += r;
+    }
+    b->datagrams += datagrams;
+    b->count = 0;
+    b->queued = 0;
+    return datagrams;
+}
+
+// Function to check whether a `len` byte datagram to `to` can ride at end of GSO train `m`: same peer, train not
+// ended by a short datagram, and within kernel's limits
+static inline int batch_joins(struct batch_io* b, int m, size_t len, const struct sockaddr_in* to) {
+    const struct sockaddr_in* peer = (const struct sockaddr_in*)b->msgs[m].msg_hdr.msg_name;
+    size_t seg = b->seg[m] ? (size_t)b->seg[m] : b->bytes[m];
+    return peer->sin_addr.s_addr == to->sin_addr.s_addr && peer->sin_port == to->sin_port && seg > 0 && len <= seg
+        && b->bytes[m] % seg == 0 && b->bytes[m] + len <= BATCH_GSO_BYTES
+        && b->msgs[m].msg_hdr.msg_iovlen / 2 < BATCH_GSO_SEGMENTS;
+}
+
+// Function to queue a datagram made of `hdr` (copied) followed by `payload` (referenced, must stay
+// valid until next flush). Sent immediately with sendmsg() when batch size is 1.
+static inline ssize_t batch_send_gather(int s, struct batch_io* b, const void* hdr, size_t hdr_len,
+    const void* payload, size_t payload_len, const struct sockaddr_in* to) {
+    if (b->size == 1) {
+        struct iovec iov[2] = { { (void*)hdr, hdr_len }, { (void*)payload, payload_len } };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = (void*)to;
+        msg.msg_namelen = sizeof(*to);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = payload_len ? 2 : 1;
+        b->calls++;
+        ssize_t r = sendmsg(s, &msg, 0);
+        if (r != -1) {
+            b->datagrams++;
+        }
+        return r;
+    }
+    if (hdr_len > (size_t)b->slot_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    int i = b->queued;
+    char* slot = b->bufs + (size_t)i * b->slot_size;
+    size_t len = hdr_len + payload_len;
+    memcpy(slot, hdr, hdr_len);
+    b->addrs[i] = *to;
+    b->iovs[2 * i].iov_base = slot;
+    b->iovs[2 * i].iov_len = hdr_len;
+    b->iovs[2 * i + 1].iov_base = (void*)payload;
+    b->iovs[2 * i + 1].iov_len = payload_len; // Empty iovec when nothing is gathered, so a train's slots line up
+    int m = b->count - 1;
+    if (b->gso && m >= 0 && batch_joins(b, m, len, to)) {
+        if (!b->seg[m]) {
+            batch_set_segment(b, m, (int)b->bytes[m]); // First datagram's size is train's segment size
+        }
+        b->msgs[m].msg_hdr.msg_iovlen += 2;
+        b->bytes[m] += len;
+    } else {
+        m = b->count++;
+        batch_msg(b, m, i, 2);
+        b->seg[m] = 0;
+        b->bytes[m] = len;
+    }
+    if (++b->queued == b->size) {
+        batch_flush(s, b);
+    }
+    return (ssize_t)(hdr_len + payload_len);
+}
+
+// Function to queue one datagram (sent immediately when batch size is 1), flushing when batch is full
+static inline ssize_t batch_send(int s, struct batch_io* b, const void* data, size_t len, const struct sockaddr_in* to) {
+    if (b->size == 1) {
+        b->calls++;
+        ssize_t r = sendto(s, data, len, 0, (const struct sockaddr*)to, sizeof(*to));
+        if (r != -1) {
+            b->datagrams++;
+        }
+        return r;
+    }
+    return batch_send_gather(s, b, data, len, NULL, 0, to);
+}
+
+// Function to check whether datagrams from last receive call are still waiting to be handed out
+static inline int batch_pending(const struct batch_io* b) {
+    return b->next < b->count;
+}
+
+// Function to fill receive batch through its io_uring, returns messages received or -1. Slots get a chain of
+// RECVMSGs with MSG_DONTWAIT, so the first that finds socket empty cancels the rest as recvmmsg() would stop there.
+// Every posted receive costs a completion even when cancelled, so only about as many as recently arrived at once
+// are posted. On a blocking socket the first one waits instead, linked to a timeout of b->timeout, so one
+// io_uring_enter() sleeps for the first datagram like MSG_WAITFORONE and drains what else is queued.
+static inline int batch_recv_chain(int s, struct batch_io* b) {
+    int fixed, fd = batch_ring_fd(b, s, &fixed);
+    int want = b->ring_want;
+    unsigned ops = 0;
+    for (int i = 0; i < want; i++) {
+        struct io_uring_sqe* sqe = uring_sqe(b->ring);
+        uring_prep(sqe, IORING_OP_RECVMSG, fd, fixed, &b->msgs[i].msg_hdr, 1, 0, i);
+        sqe->msg_flags = i == 0 && b->ring_wait ? 0 : MSG_DONTWAIT;
+        sqe->flags |= i + 1 < want ? IOSQE_IO_LINK : 0;
+        b->res[i] = -EAGAIN;
+        ops++;
+        if (i == 0 && b->ring_wait && b->timeout > 0) {
+            sqe->flags |= IOSQE_IO_LINK; // Timeout cancels wait
+            b->wait_ts.tv_sec = b->timeout / 1000000;
+            b->wait_ts.tv_nsec = b->timeout % 1000000 * 1000;
+            sqe = uring_sqe(b->ring);
+            uring_prep(sqe, IORING_OP_LINK_TIMEOUT, -1, 0, &b->wait_ts, 1, 0, URING_TIMEOUT_DATA);
+            sqe->flags |= want > 1 ? IOSQE_IO_LINK : 0;
+            ops++;
+        }
+    }
+    b->calls++;
+    if (uring_submit(b->ring, ops) == -1) {
+        return -1;
+    }
+    for (unsigned k = 0; k < ops; k++) {
+        struct io_uring_cqe* cqe = uring_cqe(b->ring);
+        if (cqe->user_data != URING_TIMEOUT_DATA) {
+            b->res[cqe->user_data] = cqe->res;
+        }
+        uring_cqe_seen(b->ring);
+    }
+
+    int count = 0, err = EAGAIN; // A wait cut short by its timeout (ECANCELED) reads as SO_RCVTIMEO's EAGAIN
+    for (int i = 0; i < want; i++) {
+        if (b->res[i] >= 0) {
+            struct mmsghdr t = b->msgs[count];
+            b->msgs[count] = b->msgs[i];
+            b->msgs[i] = t;
+            b->msgs[count++].msg_len = (unsigned)b->res[i];
+        } else if (b->res[i] != -EAGAIN && b->res[i] != -ECANCELED) {
+            err = -b->res[i];
+        }
+    }
+    b->ring_want = count == want ? (want * 2 < b->size ? want * 2 : b->size) : count + 1;
+    if (count == 0) {
+        errno = err;
+        return -1;
+    }
+    return count;
+}
+
+// Function to arm batch's multishot receive on `s` (queued, submitted with next io_uring_enter()), setting up its
+// provided buffers the first time. Returns 0 if kernel has no buffer rings, which turns multishot receive off.
+static inline int batch_arm(int s, struct batch_io* b) {
+    if (!b->pbufs) {
+        unsigned entries = 1;
+        while (entries < 2 * (unsigned)b->size) {
+            entries *= 2; // Kernel can fill a batch's worth while caller still works through last one
+        }
+        memset(&b->ring_msg, 0, sizeof(b->ring_msg));
+        b->ring_msg.msg_namelen = sizeof(struct sockaddr_in);
+        b->ring_msg.msg_controllen = b->gro ? BATCH_CTRL_SIZE : 0;
+        b->pbufs = malloc(sizeof(*b->pbufs));
+        b->bids = calloc(b->size, sizeof(unsigned short));
+        if (!b->pbufs || !b->bids || uring_bufs_init(b->ring, b->pbufs, entries, sizeof(struct io_uring_recvmsg_out)
+                + b->ring_msg.msg_namelen + b->ring_msg.msg_controllen + b->slot_size) == -1) {
+            free(b->pbufs);
+            b->pbufs = NULL;
+            b->multishot = 0;
+            return 0;
+        }
+    }
+    int fixed, fd = batch_ring_fd(b, s, &fixed);
+    struct io_uring_sqe* sqe = uring_sqe(b->ring);
+    uring_prep(sqe, IORING_OP_RECVMSG, fd, fixed, &b->ring_msg, 1, 0, 0);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    b->armed = 1;
+    return 1;
+}
+
+// Function to get descriptor an event loop should wait on for batch's datagrams: its ring, once a multishot
+// receive is armed there (it takes datagrams off the socket as they arrive, so the socket itself never looks
+// readable for long), else socket `s`
+static inline int batch_poll_fd(int s, struct batch_io* b) {
+    if (!b->ring || !b->multishot || (!b->armed && !batch_arm(s, b))) {
+        return s;
+    }
+    b->calls++;
+    uring_submit(b->ring, 0);
+    return b->ring->fd;
+}
+
+// Function to take up to a batch of received datagrams off multishot receive's completions, returns how many
+static inline int batch_reap(struct batch_io* b) {
+    int count = 0;
+    struct io_uring_cqe* cqe;
+    while (count < b->size && (cqe = uring_cqe(b->ring))) {
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_cqe_seen(b->ring);
+        if (!(flags & IORING_CQE_F_MORE)) {
+            b->armed = 0; // Receive ended (e.g. out of buffers until this batch hands its back): rearm
+        }
+        if (res == -EINVAL || res == -EOPNOTSUPP) {
+            b->multishot = 0; // Kernel has buffer rings but not multishot receive
+        }
+        if (res < 0 || !(flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        // Buffer holds a header, then name and control data at the sizes asked for, then the datagram
+        unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+        char* buf = b->pbufs->data + (size_t)bid * b->pbufs->size;
+        struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+        char* name = buf + sizeof(*out);
+        char* ctrl = name + b->ring_msg.msg_namelen;
+        char* payload = ctrl + b->ring_msg.msg_controllen;
+        size_t room = (size_t)res - (size_t)(payload - buf);
+        struct msghdr* h = &b->msgs[count].msg_hdr;
+        memset(&b->msgs[count], 0, sizeof(b->msgs[count]));
+        b->iovs[2 * count].iov_base = payload;
+        b->iovs[2 * count].iov_len = out->payloadlen < room ? out->payloadlen : room;
+        h->msg_iov = &b->iovs[2 * count];
+        h->msg_iovlen = 1;
+        h->msg_name = name;
+        h->msg_namelen = out->namelen;
+        h->msg_control = out->controllen ? ctrl : NULL;
+        h->msg_controllen = out->controllen;
+        b->msgs[count].msg_len = (unsigned)b->iovs[2 * count].iov_len;
+        b->bids[count++] = bid;
+    }
+    return count;
+}
+
+// Function to fill receive batch through its io_uring, returns messages received or -1. Completions already
+// waiting are taken with no syscall; otherwise receive is (re)armed and, on a blocking socket, one
+// io_uring_enter() waits up to b->timeout for first datagram.
+static inline int batch_recv_uring(int s, struct batch_io* b) {
+    if (b->pbufs) {
+        for (int k = 0; k < b->count; k++) {
+            uring_bufs_put(b->pbufs, b->bids[k]); // Last batch is handed out: its buffers go back to kernel
+        }
+        uring_bufs_publish(b->pbufs);
+    }
+    b->count = 0;
+    if (!b->multishot || (!b->pbufs && !batch_arm(s, b))) {
+        return batch_recv_chain(s, b);
+    }
+    for (;;) {
+        int count = batch_reap(b);
+        if (count > 0) {
+            return count;
+        }
+        if (!b->multishot) {
+            return batch_recv_chain(s, b);
+        }
+        if (!b->armed) {
+            batch_arm(s, b);
+        }
+        b->calls++;
+        if (!b->ring_wait) {
+            // Non-blocking socket: submit any rearm, which may complete at once, and report what is there
+            uring_submit(b->ring, 0);
+            if ((count = batch_reap(b)) > 0) {
+                return count;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        if (uring_wait(b->ring, b->timeout) == -1) {
+            if (errno == ETIME) {
+                errno = EAGAIN; // Timed out, as SO_RCVTIMEO reports it
+            }
+            return -1;
+        }
+    }
+}
+
+// Function to receive next datagram into `data` like recvfrom(), refilling batch with one recvmmsg() (or one
+// io_uring_enter()) when empty. Blocks (subject to SO_RCVTIMEO, or b->timeout with io_uring) unless socket is
+// non-blocking.
+static inline ssize_t batch_recv(int s, struct batch_io* b, void* data, size_t len, struct sockaddr_in* from, socklen_t* from_len) {
+    if (b->size == 1) {
+        b->calls++;
+        ssize_t r = recvfrom(s, data, len, 0, (struct sockaddr*)from, from_len);
+        if (r != -1) {
+            b->datagrams++;
+        }
+        return r;
+    }
+
+    if (!batch_pending(b)) {
+        for (int i = 0; i < b->size; i++) {
+            b->iovs[2 * i].iov_base = b->bufs + (size_t)i * b->slot_size;
+            b->iovs[2 * i].iov_len = b->slot_size;
+            batch_msg(b, i, i, 1);
+            if (b->gro) {
+                b->msgs[i].msg_hdr.msg_control = b->ctrl + (size_t)i * BATCH_CTRL_SIZE;
+                b->msgs[i].msg_hdr.msg_controllen = BATCH_CTRL_SIZE;
+            }
+        }
+        b->next = 0;
+        b->offset = 0;
+        int r;
+        if (b->ring) {
+            r = batch_recv_uring(s, b);
+        } else {
+            b->count = 0;
+            b->calls++;
+            r = recvmmsg(s, b->msgs, b->size, MSG_WAITFORONE, NULL); // Wait for first, then take whatever else is queued
+        }
+        if (r == -1) {
+            return -1;
+        }
+        b->count = r;
+        for (int i = 0; i < r; i++) {
+            // A coalesced buffer says its datagrams' size; all but its last datagram are that long
+            b->seg[i] = 0;
+            for (struct cmsghdr* c = b->gro ? CMSG_FIRSTHDR(&b->msgs[i].msg_hdr) : NULL; c; c = CMSG_NXTHDR(&b->msgs[i].msg_hdr, c)) {
+                if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+                    memcpy(&b->seg[i], CMSG_DATA(c), sizeof(int));
+                }
+            }
+            size_t n = b->msgs[i].msg_len;
+            if (b->seg[i] > 0 && n > (size_t)b->seg[i]) {
+                long long parts = (long long)((n + b->seg[i] - 1) / b->seg[i]);
+                b->datagrams += parts;
+                b->offloaded += parts;
+            } else {
+                b->seg[i] = 0;
+                b->datagrams++;
+            }
+        }
+    }
+
+    // Hand out next datagram: a whole message, or next segment of a coalesced one
+    int i = b->next;
+    size_t n = b->msgs[i].msg_len - b->offset;
+    if (b->seg[i] && n > (size_t)b->seg[i]) {
+        n = b->seg[i];
+    }
+    const char* src = (const char*)b->msgs[i].msg_hdr.msg_iov->iov_base + b->offset; // Slot may have moved (io_uring)
+    b->offset += n;
+    if (b->offset >= b->msgs[i].msg_len) {
+        b->next++;
+        b->offset = 0;
+    }
+    if (n > len) {
+        n = len; // Truncate like recvfrom()
+    }
+    memcpy(data, src, n);
+    if (from) {
+        *from = *(const struct sockaddr_in*)b->msgs[i].msg_hdr.msg_name;
+        *from_len = sizeof(*from);
+    }
+    return (ssize_t)n;
+}
+
+// Function to throw away every datagram already received or queued on socket without waiting (e.g. late frames and
+// replies left over from an earlier request). Returns datagrams thrown away.
+static inline int batch_drain(int s, struct batch_io* b) {
+    char scratch[1];
+    int dropped = 0;
+    int wait = b->ring_wait;
+    b->ring_wait = 0; // An io_uring receive reports an empty socket instead of waiting
+    for (;;) {
+        if (b->size > 1 && (batch_pending(b) || b->ring)) {
+            if (batch_recv(s, b, scratch, sizeof(scratch), NULL, NULL) == -1) {
+                break;
+            }
+        } else if (recv(s, NULL, 0, MSG_DONTWAIT | MSG_TRUNC) == -1) {
+            break;
+        }
+        dropped++;
+    }
+    b->ring_wait = wait;
+    return dropped;
+}
+
+#endif
@@ -0,0 +1,498 @@
+// Bundles: many files sent as one transfer, shared by server and client.
+// A request naming a directory, or a comma-separated list of files and directories, is answered with one bundle:
+// a manifest (every file's name, size and offset) followed by the files' bytes back to back. The server only
+// lists the files and builds the manifest up front; a frame's bytes are read from the files' own mappings by
+// offset when it is sent, so nothing is copied and the first frame goes out at once. The files share one sequence
+// space, one handshake and one window: frames of the next file go out while the previous one's last frames are still
+// being acknowledged, and thousands of small files cost no round trip each. The client receives the bundle into its usual
+// output file (so checksums, FEC, parallel streams and resuming all apply), then extracts the files from it.
+// Manifest: 16-byte header (magic, file count, manifest size), then per file its offset and size (8 bytes each),
+// name length (2 bytes) and name, all big-endian. Directories are walked in name order, so a bundle of unchanged
+// files is the same bytes every time and its tag lets an interrupted bundle resume.
+// Including file must define _GNU_SOURCE before its first system header.
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wire.h"
+
+#define BUNDLE_MAGIC 0x42444c31 // "BDL1" at start of a bundle
+#define BUNDLE_HEADER_SIZE 16 // Bytes of manifest before its first entry
+#define BUNDLE_ENTRY_SIZE(name_len) (18 + (size_t)(name_len)) // Bytes of a manifest entry naming a file of name_len bytes
+#define BUNDLE_MAX_NAME 1024 // Longest name of a file in a bundle
+#define BUNDLE_MAX_DEPTH 16 // Deepest directory walked
+#define BUNDLE_MAX_FILES 10000 // Most files in one bundle (a request for more is refused)
+#define BUNDLE_MAX_BYTES (16LL << 30) // Most bytes of files in one bundle (a request for more is refused)
+#define BUNDLE_SEP ',' // Separates paths in a request for a list of files
+#define BUNDLE_COPY_CHUNK (1 << 20) // Bytes copied per call when extracting
+
+// One file in a bundle
+struct bundle_member {
+    char* name; // Name in manifest: path under client's output directory
+    char* path; // Path on server (NULL on client)
+    long long offset; // Where its bytes start in bundle
+    long long size; // Bytes
+    char* map; // Server: file mapped read-only once a frame needs it (first map_len bytes; the rest read as zeros)
+    long long map_len;
+    atomic_int mapped; // Server: 1 once map and map_len are set
+};
+
+// Files of a bundle, in bundle order
+struct bundle {
+    struct bundle_member* members;
+    int count; // Files
+    int cap; // Room in members
+    long long manifest_size; // Bytes of manifest (data starts here)
+    unsigned char* manifest; // Server: manifest as sent
+    long long size; // Bytes of manifest and data
+    unsigned int tag; // Identifies this version of every file (names, inodes, sizes, modification times), never 0
+};
+
+// Function to tell whether a request names a bundle: a directory, or a list of paths that is not itself a file
+static inline int bundle_requested(const char* spec) {
+    struct stat st;
+    if (stat(spec, &st) == 0) {
+        return S_ISDIR(st.st_mode);
+    }
+    return strchr(spec, BUNDLE_SEP) != NULL;
+}
+
+// Serializes mapping a bundle's file for the first time (parallel streams read one bundle)
+static pthread_mutex_t bundle_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function to free a bundle's file list, manifest and mappings
+static inline void bundle_free(struct bundle* b) {
+    for (int i = 0; i < b->count; i++) {
+        if (b->members[i].map_len > 0) {
+            munmap(b->members[i].map, b->members[i].map_len);
+        }
+        free(b->members[i].name);
+        free(b->members[i].path);
+    }
+    free(b->members);
+    free(b->manifest);
+    memset(b, 0, sizeof(*b));
+}
+
+// Function to append a file to a bundle's list. Returns -1 if out of memory.
+static inline int bundle_add(struct bundle* b, const char* name, const char* path, long long size) {
+    if (b->count == b->cap) {
+        int cap = b->cap ? 2 * b->cap : 64;
+        struct bundle_member* m = realloc(b->members, cap * sizeof(*m));
+        if (!m) {
+            return -1;
+        }
+        b->members = m;
+        b->cap = cap;
+    }
+    struct bundle_member* m = &b->members[b->count];
+    m->name = strdup(name);
+    m->path = path ? strdup(path) : NULL;
+    m->size = size;
+    m->offset = 0;
+    m->map = NULL;
+    m->map_len = 0;
+    atomic_init(&m->mapped, 0);
+    if (!m->name || (path && !m->path)) {
+        free(m->name);
+        free(m->path);
+        return -1;
+    }
+    b->count++;
+    return 0;
+}
+
+// Function to order directory entries by name
+static inline int bundle_name_cmp(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Function to add file or directory `path` to a bundle as `name` (directories as name/...). A path the request names
+// may be a symbolic link; links found inside directories are skipped, so a walk never loops or leaves the tree.
+// Returns -1 (errno set) if it or anything under it cannot be read, or E2BIG/EFBIG once the bundle would hold more
+// than BUNDLE_MAX_FILES files or BUNDLE_MAX_BYTES bytes.
+static inline int bundle_add_path(struct bundle* b, const char* path, const char* name, int depth) {
+    struct stat st;
+    if ((depth == 0 ? stat(path, &st) : lstat(path, &st)) == -1) {
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (b->count >= BUNDLE_MAX_FILES || st.st_size > BUNDLE_MAX_BYTES - b->size) {
+            errno = b->count >= BUNDLE_MAX_FILES ? E2BIG : EFBIG;
+            return -1;
+        }
+        b->size += st.st_size; // Bytes of files so far; bundle_collect() adds manifest once every file is listed
+        long long id[5] = { (long long)st.st_dev, (long long)st.st_ino, (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+            (long long)st.st_mtim.tv_nsec };
+        b->tag = crc32c(crc32c(b->tag, id, sizeof(id)), name, strlen(name));
+        return bundle_add(b, name, path, st.st_size);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return 0; // Links, devices, sockets and pipes have no size to send
+    }
+    if (depth >= BUNDLE_MAX_DEPTH) {
+        errno = ELOOP;
+        return -1;
+    }
+
+    // Read whole directory first so entries can be sorted and it is not held open while recursing
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    char** names = NULL;
+    int n = 0, cap = 0, ret = 0;
+    struct dirent* d;
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            char** grown = realloc(names, cap * sizeof(*names));
+            if (!grown) {
+                ret = -1;
+                break;
+            }
+            names = grown;
+        }
+        if (!(names[n] = strdup(d->d_name))) {
+            ret = -1;
+            break;
+        }
+        n++;
+    }
+    closedir(dir);
+    qsort(names, n, sizeof(*names), bundle_name_cmp);
+
+    char child_path[PATH_MAX], child_name[BUNDLE_MAX_NAME + 1];
+    for (int i = 0; i < n && ret == 0; i++) {
+        if (snprintf(child_path, sizeof(child_path), "%s/%s", path, names[i]) >= (int)sizeof(child_path)
+            || snprintf(child_name, sizeof(child_name), "%s%s%s", name, name[0] ? "/" : "", names[i]) >= (int)sizeof(child_name)) {
+            errno = ENAMETOOLONG;
+            ret = -1;
+        } else {
+            ret = bundle_add_path(b, child_path, child_name, depth + 1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+// Function to list every file a request names: each path in `spec` (separated by BUNDLE_SEP) is added under its last
+// component. Lays out offsets, builds manifest and sets tag and size. Returns -1 (errno set) if a path cannot be read
+// or the bundle would be too big (E2BIG, EFBIG).
+static inline int bundle_collect(struct bundle* b, const char* spec) {
+    char list[MAX_FILE_NAME + 1];
+    char* save;
+    memset(b, 0, sizeof(*b));
+    snprintf(list, sizeof(list), "%s", spec);
+    for (char* path = strtok_r(list, ",", &save); path; path = strtok_r(NULL, ",", &save)) {
+        // Name a path by its last component ("data/logs/" is "logs"); "." and "/" add their files with no prefix
+        size_t len = strlen(path);
+        while (len > 1 && path[len - 1] == '/') {
+            path[--len] = '\0';
+        }
+        const char* base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        if (strcmp(base, ".") == 0 || strcmp(base, "..") == 0 || base[0] == '\0') {
+            base = "";
+        }
+        if (bundle_add_path(b, path, base, 0) == -1) {
+            int err = errno;
+            bundle_free(b);
+            errno = err;
+            return -1;
+        }
+    }
+    b->manifest_size = BUNDLE_HEADER_SIZE;
+    for (int i = 0; i < b->count; i++) {
+        b->manifest_size += BUNDLE_ENTRY_SIZE(strlen(b->members[i].name));
+    }
+    b->size = b->manifest_size;
+    for (int i = 0; i < b->count; i++) {
+        b->members[i].offset = b->size;
+        b->size += b->members[i].size;
+    }
+    b->tag = crc32c(b->tag, &b->size, sizeof(b->size));
+    if (b->tag == 0) {
+        b->tag = 1;
+    }
+
+    unsigned char* p = b->manifest = malloc(b->manifest_size);
+    if (!p) {
+        bundle_free(b);
+        errno = ENOMEM;
+        return -1;
+    }
+    wire_put32(p, BUNDLE_MAGIC);
+    wire_put32(p + 4, (uint32_t)b->count);
+    wire_put64(p + 8, (uint64_t)b->manifest_size);
+    p += BUNDLE_HEADER_SIZE;
+    for (int i = 0; i < b->count; i++) {
+        size_t len = strlen(b->members[i].name);
+        wire_put64(p, (uint64_t)b->members[i].offset);
+        wire_put64(p + 8, (uint64_t)b->members[i].size);
+        wire_put16(p + 16, (uint16_t)len);
+        memcpy(p + 18, b->members[i].name, len);
+        p += BUNDLE_ENTRY_SIZE(len);
+    }
+    return 0;
+}
+
+// Function to map a bundle's file the first time a frame needs it. A file that can no longer be read, or shrank
+// since it was listed, is sent as zeros where its bytes are missing.
+static inline void bundle_map(struct bundle_member* m) {
+    if (atomic_load_explicit(&m->mapped, memory_order_acquire)) {
+        return;
+    }
+    pthread_mutex_lock(&bundle_map_lock);
+    if (!atomic_load_explicit(&m->mapped, memory_order_relaxed)) {
+        struct stat st;
+        int fd = open(m->path, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+        if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            long long len = st.st_size < m->size ? st.st_size : m->size;
+            char* map = len > 0 ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+            if (map != MAP_FAILED) {
+                m->map = map;
+                m->map_len = len;
+                if (map) {
+                    madvise(map, len, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        if (m->map_len < m->size) {
+            fprintf(stderr, "Server: Bundle file %s shrank or cannot be read, sending zeros in its place\n", m->path);
+        }
+        if (fd != -1) {
+            close(fd); // Mapping stays valid after file is closed
+        }
+        atomic_store_explicit(&m->mapped, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&bundle_map_lock);
+}
+
+// Function to read `len` bytes of a collected bundle at `offset` into `buf`: from its manifest, then from each file's
+// own mapping. Returns bytes read, short at end of bundle.
+static inline size_t bundle_read(struct bundle* b, char* buf, size_t len, long long offset) {
+    if (offset >= b->size) {
+        return 0;
+    }
+    if ((long long)len > b->size - offset) {
+        len = (size_t)(b->size - offset);
+    }
+    size_t done = 0;
+    if (offset < b->manifest_size) {
+        done = (long long)len < b->manifest_size - offset ? len : (size_t)(b->manifest_size - offset);
+        memcpy(buf, b->manifest + offset, done);
+    }
+    if (done == len) {
+        return done;
+    }
+
+    // Last file starting at or before first byte wanted holds it (an empty file never does, the next one starts there too)
+    int lo = 0, hi = b->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (b->members[mid].offset <= offset + (long long)done) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    for (int i = lo; i < b->count && done < len; i++) {
+        struct bundle_member* m = &b->members[i];
+        long long pos = offset + (long long)done - m->offset; // Where in file
+        size_t n = (long long)(len - done) < m->size - pos ? len - done : (size_t)(m->size - pos);
+        if (n == 0) {
+            continue;
+        }
+        bundle_map(m);
+        size_t have = pos >= m->map_len ? 0 : (long long)n < m->map_len - pos ? n : (size_t)(m->map_len - pos);
+        memcpy(buf + done, m->map + pos, have);
+        memset(buf + done + have, 0, n - have);
+        done += n;
+    }
+    return done;
+}
+
+// Function to copy `len` bytes from `in` at `in_pos` to `out` at `out_pos`, in kernel when it can. Returns bytes
+// copied, short if input ends first, or -1 on error.
+static inline long long bundle_copy(int in, off_t in_pos, int out, off_t out_pos, long long len) {
+    long long done = 0;
+    char* buf = NULL;
+    while (done < len) {
+        size_t want = len - done < BUNDLE_COPY_CHUNK ? (size_t)(len - done) : BUNDLE_COPY_CHUNK;
+        ssize_t n = buf ? -1 : copy_file_range(in, &in_pos, out, &out_pos, want, 0);
+        if (n == -1 && (buf || errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            // File systems (or kernels) that cannot copy between these files: read and write through a buffer
+            if (!buf && !(buf = malloc(BUNDLE_COPY_CHUNK))) {
+                return -1;
+            }
+            n = pread(in, buf, want, in_pos);
+            if (n > 0 && pwrite(out, buf, n, out_pos) != n) {
+                n = -1;
+            }
+            if (n > 0) {
+                in_pos += n;
+                out_pos += n;
+            }
+        }
+        if (n == -1) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0) {
+            break; // Input ended early
+        }
+        done += n;
+    }
+    free(buf);
+    return done;
+}
+
+// Function to check that a name from a manifest stays inside the output directory: relative, with no "." or ".."
+// component and no empty one
+static inline int bundle_name_ok(const char* name) {
+    if (name[0] == '\0' || name[0] == '/') {
+        return 0;
+    }
+    for (const char* c = name; *c;) {
+        size_t len = strcspn(c, "/");
+        if (len == 0 || (len == 1 && c[0] == '.') || (len == 2 && c[0] == '.' && c[1] == '.')) {
+            return 0;
+        }
+        c += len;
+        if (*c == '/') {
+            c++;
+            if (*c == '\0') {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Function to read and check the manifest of a received bundle of `size` bytes. Returns -1 if it is malformed.
+static inline int bundle_read_manifest(int fd, long long size, struct bundle* b) {
+    unsigned char head[BUNDLE_HEADER_SIZE];
+    memset(b, 0, sizeof(*b));
+    if (pread(fd, head, sizeof(head), 0) != (ssize_t)sizeof(head) || wire_get32(head) != BUNDLE_MAGIC) {
+        return -1;
+    }
+    size_t count = wire_get32(head + 4);
+    long long manifest_size = (long long)wire_get64(head + 8);
+    if (manifest_size < BUNDLE_HEADER_SIZE || manifest_size > size || count > (size_t)(manifest_size - BUNDLE_HEADER_SIZE) / BUNDLE_ENTRY_SIZE(1)) {
+        return -1;
+    }
+    unsigned char* manifest = malloc(manifest_size);
+    if (!manifest || pread(fd, manifest, manifest_size, 0) != manifest_size) {
+        free(manifest);
+        return -1;
+    }
+
+    // Files must follow manifest in order, without overlapping, and end within bundle
+    const unsigned char* p = manifest + BUNDLE_HEADER_SIZE;
+    const unsigned char* end = manifest + manifest_size;
+    long long next = manifest_size;
+    char name[BUNDLE_MAX_NAME + 1];
+    int ok = 1;
+    for (size_t i = 0; i < count && ok; i++) {
+        size_t len = end - p >= (ptrdiff_t)BUNDLE_ENTRY_SIZE(0) ? wire_get16(p + 16) : (size_t)-1;
+        ok = len <= BUNDLE_MAX_NAME && end - p >= (ptrdiff_t)BUNDLE_ENTRY_SIZE(len);
+        if (ok) {
+            long long offset = (long long)wire_get64(p);
+            long long bytes = (long long)wire_get64(p + 8);
+            memcpy(name, p + 18, len);
+            name[len] = '\0';
+            ok = offset == next && bytes >= 0 && bytes <= size - offset && strlen(name) == len && bundle_name_ok(name)
+                && bundle_add(b, name, NULL, bytes) == 0;
+            if (ok) {
+                b->members[b->count - 1].offset = offset;
+                next = offset + bytes;
+                p += BUNDLE_ENTRY_SIZE(len);
+            }
+        }
+    }
+    free(manifest);
+    if (!ok || p != end) {
+        bundle_free(b);
+        return -1;
+    }
+    b->manifest_size = manifest_size;
+    b->size = next;
+    return 0;
+}
+
+// Function to create every missing directory on the way to `path` (a file under the output directory)
+static inline int bundle_make_dirs(char* path) {
+    for (char* c = strchr(path + 1, '/'); c; c = strchr(c + 1, '/')) {
+        *c = '\0';
+        int ret = mkdir(path, 0755);
+        *c = '/';
+        if (ret == -1 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to extract every file of the bundle received in `spool` into directory `dir`, then remove spool.
+// Returns files extracted, or -1 if bundle is malformed or a file cannot be written (spool is kept).
+static inline int bundle_extract(const char* spool, const char* dir) {
+    struct stat st;
+    struct bundle b;
+    int fd = open(spool, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || bundle_read_manifest(fd, st.st_size, &b) == -1) {
+        fprintf(stderr, "Client: %s is not a complete bundle\n", spool);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char path[PATH_MAX];
+    int done = 0;
+    for (int i = 0; i < b.count; i++) {
+        int out = -1;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, b.members[i].name) >= (int)sizeof(path) || bundle_make_dirs(path) == -1
+            || (out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1
+            || bundle_copy(fd, b.members[i].offset, out, 0, b.members[i].size) != b.members[i].size) {
+            perror("Client: Extract bundle");
+            fprintf(stderr, "Client: Could not write %s\n", path);
+            if (out != -1) {
+                close(out);
+            }
+            break;
+        }
+        close(out);
+        done++;
+    }
+    long long data = b.size - b.manifest_size;
+    int count = b.count;
+    bundle_free(&b);
+    close(fd);
+    if (done < count) {
+        return -1;
+    }
+    unlink(spool);
+    printf("Bundle: %d files (%lld bytes) extracted into %s/\n", count, data, dir);
+    return count;
+}
+
+#endif
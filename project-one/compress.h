@@ -0,0 +1,350 @@
+// Per-frame compression shared by the server and client.
+// Each frame is packed on its own, so any frame can be unpacked without the ones around it and loss,
+// reordering, retransmission and FEC work as before. A frame that does not get smaller is sent as it is.
+// The built-in codec is a small LZ77 coder (the LZ4 block layout: a token with literal and match lengths,
+// literals, a 2 byte offset). zstd and lz4 are added when the program is built with -DUSE_ZSTD ... -lzstd
+// and/or -DUSE_LZ4 ... -llz4.
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+#define CODEC_NONE 0 // Frames sent as they are
+#define CODEC_LZ 1 // Built-in LZ77 coder
+#define CODEC_LZ4 2 // liblz4
+#define CODEC_ZSTD 3 // libzstd
+#define CODEC_COUNT 4
+#define CODEC_ZSTD_LEVEL 1 // Fastest zstd level; frames are small, so higher levels gain little
+#define CODEC_LZ_HASH_BITS 12 // Entries in LZ match finder's hash table (log2)
+#define CODEC_LZ_MIN_MATCH 4 // Shortest match worth a token and an offset
+#define CODEC_LZ_TAIL 5 // Frame's last bytes are always literals
+
+static const char* const codec_names[CODEC_COUNT] = { "none", "lz", "lz4", "zstd" };
+
+// One side's compression state for one session or stream (not shared between threads)
+struct codec_state {
+    int codec; // CODEC_*
+    uint16_t* lz_table; // LZ match finder: last position seen for each hash of 4 bytes
+    unsigned char* buf; // Packed frame (server) or unpacked frame (client)
+    long int buf_size; // Bytes in buf
+    void* zstd; // ZSTD_CCtx (server) or ZSTD_DCtx (client)
+    long long frames; // Frames offered to codec_pack() or given to codec_unpack()
+    long long packed; // Of them, frames that went over the wire packed
+    long long raw_bytes; // Their bytes before packing
+    long long wire_bytes; // Their bytes on the wire
+};
+
+// Function to check whether a codec can be used by this build
+static inline int codec_available(int codec) {
+    switch (codec) {
+    case CODEC_NONE:
+    case CODEC_LZ:
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Function to get a bit mask (bit n = codec n) of codecs this build can use
+static inline int codec_mask(void) {
+    int mask = 0;
+    for (int c = CODEC_LZ; c < CODEC_COUNT; c++) {
+        if (codec_available(c)) {
+            mask |= 1 << c;
+        }
+    }
+    return mask;
+}
+
+// Function to look up a codec by name, returns -1 if there is no such codec
+static inline int codec_by_name(const char* name) {
+    for (int c = 0; c < CODEC_COUNT; c++) {
+        if (strcmp(name, codec_names[c]) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Function to pick codec for a transfer from a peer's mask: best ratio first (zstd, then lz4, then built-in LZ)
+static inline int codec_choose(int mask) {
+    static const int order[] = { CODEC_ZSTD, CODEC_LZ4, CODEC_LZ };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if ((mask >> order[i]) & 1 && codec_available(order[i])) {
+            return order[i];
+        }
+    }
+    return CODEC_NONE;
+}
+
+// Function to set up state for `codec` with frames of up to `max_frame` bytes; `packing` = 1 on sending side. Returns -1 on failure.
+static inline int codec_init(struct codec_state* c, int codec, long int max_frame, int packing) {
+    memset(c, 0, sizeof(*c));
+    c->codec = codec;
+    if (codec == CODEC_NONE) {
+        return 0;
+    }
+    c->buf_size = max_frame;
+    c->buf = malloc(max_frame);
+    if (codec == CODEC_LZ && packing) {
+        c->lz_table = malloc(sizeof(uint16_t) << CODEC_LZ_HASH_BITS);
+    }
+#ifdef USE_ZSTD
+    if (codec == CODEC_ZSTD) {
+        c->zstd = packing ? (void*)ZSTD_createCCtx() : (void*)ZSTD_createDCtx();
+    }
+#endif
+    if (!c->buf || (codec == CODEC_LZ && packing && !c->lz_table) || (codec == CODEC_ZSTD && !c->zstd)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to release a codec state
+static inline void codec_free(struct codec_state* c, int packing) {
+#ifdef USE_ZSTD
+    if (c->zstd) {
+        if (packing) {
+            ZSTD_freeCCtx((ZSTD_CCtx*)c->zstd);
+        } else {
+            ZSTD_freeDCtx((ZSTD_DCtx*)c->zstd);
+        }
+    }
+#else
+    (void)packing;
+#endif
+    free(c->lz_table);
+    free(c->buf);
+    c->lz_table = NULL;
+    c->buf = NULL;
+    c->zstd = NULL;
+}
+
+// Function to write a length's extension bytes (255 per step, then the rest) after a nibble of 15
+static inline long int codec_lz_length(unsigned char* dst, long int op, long int cap, long int n) {
+    for (; n >= 255; n -= 255) {
+        if (op >= cap) {
+            return -1;
+        }
+        dst[op++] = 255;
+    }
+    if (op >= cap) {
+        return -1;
+    }
+    dst[op++] = (unsigned char)n;
+    return op;
+}
+
+// Function to emit one sequence: `lit` literals from `src`, then a match of `match` bytes `offset` back (match = 0: last sequence).
+// Returns new output position, -1 if it does not fit in `cap`.
+static inline long int codec_lz_sequence(unsigned char* dst, long int op, long int cap, const unsigned char* src, long int lit,
+    long int offset, long int match) {
+    long int ml = match ? match - CODEC_LZ_MIN_MATCH : 0;
+    if (op >= cap) {
+        return -1;
+    }
+    long int token = op++;
+    dst[token] = (unsigned char)((lit < 15 ? lit : 15) << 4 | (ml < 15 ? ml : 15));
+    if (lit >= 15 && (op = codec_lz_length(dst, op, cap, lit - 15)) == -1) {
+        return -1;
+    }
+    if (lit > cap - op) {
+        return -1;
+    }
+    memcpy(dst + op, src, lit);
+    op += lit;
+    if (!match) {
+        return op;
+    }
+    if (cap - op < 2) {
+        return -1;
+    }
+    dst[op++] = (unsigned char)offset;
+    dst[op++] = (unsigned char)(offset >> 8);
+    if (ml >= 15 && (op = codec_lz_length(dst, op, cap, ml - 15)) == -1) {
+        return -1;
+    }
+    return op;
+}
+
+// Function to pack `len` bytes with built-in LZ coder into at most `cap` bytes, returns packed length or 0 if it does not fit
+static inline long int codec_lz_pack(uint16_t* table, unsigned char* dst, long int cap, const unsigned char* src, long int len) {
+    long int i = 0, anchor = 0, op = 0;
+    long int limit = len - CODEC_LZ_TAIL;
+    memset(table, 0, sizeof(uint16_t) << CODEC_LZ_HASH_BITS);
+    while (i < limit) {
+        uint32_t seq;
+        memcpy(&seq, src + i, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - CODEC_LZ_HASH_BITS);
+        long int ref = table[h];
+        table[h] = (uint16_t)i;
+        uint32_t prev;
+        memcpy(&prev, src + ref, 4);
+        if (ref >= i || i - ref > 0xffff || prev != seq) {
+            i += 1 + ((i - anchor) >> 6); // Step faster through data that does not repeat
+            continue;
+        }
+        long int match = CODEC_LZ_MIN_MATCH;
+        while (i + match < limit && src[ref + match] == src[i + match]) {
+            match++;
+        }
+        op = codec_lz_sequence(dst, op, cap, src + anchor, i - anchor, i - ref, match);
+        if (op == -1) {
+            return 0;
+        }
+        i += match;
+        anchor = i;
+    }
+    op = codec_lz_sequence(dst, op, cap, src + anchor, len - anchor, 0, 0);
+    return op == -1 ? 0 : op;
+}
+
+// Function to read a length's extension bytes, returns -1 if they run past end of input
+static inline long int codec_lz_read_length(const unsigned char* src, long int* ip, long int len) {
+    long int n = 0;
+    unsigned char b;
+    do {
+        if (*ip >= len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        n += b;
+    } while (b == 255);
+    return n;
+}
+
+// Function to unpack built-in LZ data into at most `cap` bytes, returns unpacked length or -1 if input is malformed
+static inline long int codec_lz_unpack(unsigned char* dst, long int cap, const unsigned char* src, long int len) {
+    long int ip = 0, op = 0;
+    while (ip < len) {
+        unsigned char token = src[ip++];
+        long int lit = token >> 4;
+        if (lit == 15) {
+            long int more = codec_lz_read_length(src, &ip, len);
+            if (more == -1) {
+                return -1;
+            }
+            lit += more;
+        }
+        if (lit > len - ip || lit > cap - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == len) {
+            break; // Last sequence has no match
+        }
+        if (len - ip < 2) {
+            return -1;
+        }
+        long int offset = src[ip] | src[ip + 1] << 8;
+        ip += 2;
+        long int match = token & 15;
+        if (match == 15) {
+            long int more = codec_lz_read_length(src, &ip, len);
+            if (more == -1) {
+                return -1;
+            }
+            match += more;
+        }
+        match += CODEC_LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || match > cap - op) {
+            return -1;
+        }
+        if (offset >= match) {
+            memcpy(dst + op, dst + op - offset, match);
+        } else {
+            for (long int j = 0; j < match; j++) {
+                dst[op + j] = dst[op - offset + j]; // Overlapping copy repeats last `offset` bytes
+            }
+        }
+        op += match;
+    }
+    return op;
+}
+
+// Function to pack one frame's `len` bytes into c->buf, returns packed length, or 0 if frame is to be sent as it is
+static inline long int codec_pack(struct codec_state* c, const void* src, long int len) {
+    long int n = 0;
+    long int cap = len - 1 < c->buf_size ? len - 1 : c->buf_size; // Must come out smaller than frame
+    c->frames++;
+    c->raw_bytes += len;
+    if (cap > 0) {
+        switch (c->codec) {
+        case CODEC_LZ:
+            n = codec_lz_pack(c->lz_table, c->buf, cap, (const unsigned char*)src, len);
+            break;
+#ifdef USE_LZ4
+        case CODEC_LZ4:
+            n = LZ4_compress_default((const char*)src, (char*)c->buf, (int)len, (int)cap);
+            break;
+#endif
+#ifdef USE_ZSTD
+        case CODEC_ZSTD: {
+            size_t z = ZSTD_compressCCtx((ZSTD_CCtx*)c->zstd, c->buf, cap, src, len, CODEC_ZSTD_LEVEL);
+            n = ZSTD_isError(z) ? 0 : (long int)z;
+            break;
+        }
+#endif
+        default:
+            break;
+        }
+    }
+    if (n <= 0 || n >= len) {
+        c->wire_bytes += len;
+        return 0;
+    }
+    c->packed++;
+    c->wire_bytes += n;
+    return n;
+}
+
+// Function to unpack a frame's `len` bytes into c->buf, returns unpacked length or -1 if they are not valid packed data
+static inline long int codec_unpack(struct codec_state* c, const void* src, long int len) {
+    long int n = -1;
+    switch (c->codec) {
+    case CODEC_LZ:
+        n = codec_lz_unpack(c->buf, c->buf_size, (const unsigned char*)src, len);
+        break;
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        n = LZ4_decompress_safe((const char*)src, (char*)c->buf, (int)len, (int)c->buf_size);
+        break;
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD: {
+        size_t z = ZSTD_decompressDCtx((ZSTD_DCtx*)c->zstd, c->buf, c->buf_size, src, len);
+        n = ZSTD_isError(z) ? -1 : (long int)z;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    if (n < 0) {
+        return -1;
+    }
+    c->frames++;
+    c->packed++;
+    c->raw_bytes += n;
+    c->wire_bytes += len;
+    return n;
+}
+
+#endif
@@ -0,0 +1,268 @@
+// CRC32C (Castagnoli) checksums shared by server and client.
+// Frames carry a CRC32C of their header fields and data. The server also
+// keeps a running CRC32C of the data it sends, built from each frame's own
+// CRC by shifting the total so far past the new frame (crc32c_shift), so the
+// digest costs no second pass over the data. On x86-64 CPUs with
+// SSE4.2 the crc32 instruction runs on three independent parts of the
+// buffer at once (it has a 3 cycle latency but starts one per cycle), and
+// the three CRCs are joined with precomputed shift tables. CPUs with AVX-512
+// carry-less multiply instead fold 256 bytes per step into four 512-bit
+// remainders, which runs several times faster on data already in cache, and
+// finish with the crc32 instruction. Elsewhere a slicing-by-8 table does 8
+// bytes per step with eight table lookups.
+// Call crc32c_init() once before any thread uses crc32c().
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // Castagnoli polynomial, bit-reversed
+#define CRC32C_LONG 8192 // Bytes per part when three parts are run at once (power of two)
+#define CRC32C_SHORT 256 // Same, for what is left after long parts (power of two)
+#define CRC32C_POLY_NORMAL 0x1edc6f41 // Castagnoli polynomial, most significant bit first (x^32 implied)
+#define CRC32C_FOLD 256 // Bytes folded per step by carry-less multiply kernel
+
+static uint32_t crc32c_table[8][256]; // Slicing-by-8 tables (table[k] advances a byte k more positions)
+static uint32_t crc32c_long[4][256]; // Shifts a CRC past CRC32C_LONG zero bytes
+static uint32_t crc32c_short[4][256]; // Shifts a CRC past CRC32C_SHORT zero bytes
+static uint64_t crc32c_fold_k[10]; // Folding constants for 2048, 512, 384, 256 and 128 bits (low, high half pairs)
+static int crc32c_hw; // 0 = tables, 1 = SSE4.2 crc32 instruction, 2 = also AVX-512 carry-less multiply
+
+// Function to multiply a vector by a 32x32 matrix over GF(2)
+static inline uint32_t crc32c_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+    }
+    return sum;
+}
+
+// Function to multiply two 32x32 matrices over GF(2) (`a` applied after `b`)
+static inline void crc32c_multiply(uint32_t* prod, const uint32_t* a, const uint32_t* b) {
+    for (int n = 0; n < 32; n++) {
+        prod[n] = crc32c_times(a, b[n]);
+    }
+}
+
+// Function to build tables that shift a CRC past `len` zero bytes
+static inline void crc32c_zeros(uint32_t zeros[4][256], size_t len) {
+    uint32_t op[32], sum[32], other[32];
+    uint32_t row = 1;
+
+    // Operator for one zero bit, squared up to one zero byte
+    other[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        other[n] = row;
+        row <<= 1;
+    }
+    crc32c_multiply(op, other, other); // 2 bits
+    crc32c_multiply(other, op, op); // 4 bits
+    crc32c_multiply(op, other, other); // 1 byte
+
+    // Raise it to len by squaring, starting from identity
+    for (int n = 0; n < 32; n++) {
+        sum[n] = 1u << n;
+    }
+    for (; len; len >>= 1) {
+        if (len & 1) {
+            crc32c_multiply(other, op, sum);
+            memcpy(sum, other, sizeof(sum));
+        }
+        crc32c_multiply(other, op, op);
+        memcpy(op, other, sizeof(op));
+    }
+    for (int n = 0; n < 256; n++) {
+        zeros[0][n] = crc32c_times(sum, n);
+        zeros[1][n] = crc32c_times(sum, n << 8);
+        zeros[2][n] = crc32c_times(sum, n << 16);
+        zeros[3][n] = crc32c_times(sum, (uint32_t)n << 24);
+    }
+}
+
+// Function to shift a CRC past a run of zero bytes using tables from crc32c_zeros(). Since CRC32C of A followed
+// by B is A's CRC shifted past len(B) zero bytes xor B's CRC, this also appends a block whose CRC is known.
+static inline uint32_t crc32c_shift(uint32_t zeros[4][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+// Function to get x^n mod P, bit-reflected into 64 bits (x^d at bit 63 - d) as carry-less multiply operand
+static inline uint64_t crc32c_xpow(int n) {
+    uint32_t r = 1;
+    uint64_t out = 0;
+    for (int i = 0; i < n; i++) {
+        r = r & 0x80000000u ? (r << 1) ^ CRC32C_POLY_NORMAL : r << 1;
+    }
+    for (int d = 0; d < 32; d++) {
+        if ((r >> d) & 1) {
+            out |= 1ULL << (63 - d);
+        }
+    }
+    return out;
+}
+
+// Function to build lookup tables and pick hardware or table kernel
+static inline void crc32c_init(void) {
+    for (int n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32c_table[0][n] = c;
+    }
+    for (int n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t c = crc32c_table[k - 1][n];
+            crc32c_table[k][n] = (c >> 8) ^ crc32c_table[0][c & 0xff];
+        }
+    }
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+    // Moving a 128-bit remainder forward by D bits multiplies its low half by x^(D+63) and high half by x^(D-1) mod P
+    static const int fold_bits[5] = { 2048, 512, 384, 256, 128 };
+    for (int i = 0; i < 5; i++) {
+        crc32c_fold_k[2 * i] = crc32c_xpow(fold_bits[i] + 63);
+        crc32c_fold_k[2 * i + 1] = crc32c_xpow(fold_bits[i] - 1);
+    }
+#if defined(__x86_64__)
+    crc32c_hw = __builtin_cpu_supports("sse4.2") != 0;
+    if (crc32c_hw && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("vpclmulqdq")) {
+        crc32c_hw = 2;
+    }
+#endif
+}
+
+// Function to advance a raw (not inverted) CRC over a buffer with slicing-by-8 tables
+static inline uint32_t crc32c_sw(uint32_t crc, const unsigned char* p, size_t len) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff] ^ crc32c_table[5][(v >> 16) & 0xff]
+            ^ crc32c_table[4][(v >> 24) & 0xff] ^ crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff]
+            ^ crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Function to advance a raw CRC over a buffer with SSE4.2 crc32 instruction
+__attribute__((target("sse4.2"))) static inline uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t len) {
+    uint64_t c = crc;
+
+    // Three parts at a time, joined by shifting each CRC past the parts after it
+    for (size_t part = CRC32C_LONG; part >= CRC32C_SHORT; part = part == CRC32C_LONG ? CRC32C_SHORT : 0) {
+        uint32_t (*zeros)[256] = part == CRC32C_LONG ? crc32c_long : crc32c_short;
+        while (len >= 3 * part) {
+            uint64_t c1 = 0, c2 = 0;
+            for (const unsigned char* end = p + part; p < end; p += 8) {
+                uint64_t v0, v1, v2;
+                memcpy(&v0, p, 8);
+                memcpy(&v1, p + part, 8);
+                memcpy(&v2, p + 2 * part, 8);
+                c = _mm_crc32_u64(c, v0);
+                c1 = _mm_crc32_u64(c1, v1);
+                c2 = _mm_crc32_u64(c2, v2);
+            }
+            c = crc32c_shift(zeros, (uint32_t)c) ^ c1;
+            c = crc32c_shift(zeros, (uint32_t)c) ^ c2;
+            p += 2 * part;
+            len -= 3 * part;
+        }
+    }
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    }
+    return (uint32_t)c;
+}
+
+#define CRC32C_AVX512 "avx512f,avx512vl,vpclmulqdq,pclmul,sse4.2" // Target of carry-less multiply kernel
+
+// Function to move a 128-bit remainder forward by the distance constants `k` were made for
+__attribute__((target(CRC32C_AVX512))) static inline __m128i crc32c_fold128(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+// Function to advance a raw CRC over a buffer by folding 256 bytes per step with AVX-512 carry-less multiply
+__attribute__((target(CRC32C_AVX512))) static inline uint32_t crc32c_avx512(uint32_t crc, const unsigned char* p, size_t len) {
+    if (len >= CRC32C_FOLD) {
+        const uint64_t* k = crc32c_fold_k;
+        __m512i k2048 = _mm512_broadcast_i32x4(_mm_set_epi64x(k[1], k[0]));
+        __m512i k512 = _mm512_broadcast_i32x4(_mm_set_epi64x(k[3], k[2]));
+
+        // Four 512-bit remainders (sixteen 128-bit lanes); CRC so far is folded in by xor with first bytes
+        __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(p), _mm512_zextsi128_si512(_mm_cvtsi32_si128(crc)));
+        __m512i x1 = _mm512_loadu_si512(p + 64);
+        __m512i x2 = _mm512_loadu_si512(p + 128);
+        __m512i x3 = _mm512_loadu_si512(p + 192);
+        for (p += CRC32C_FOLD, len -= CRC32C_FOLD; len >= CRC32C_FOLD; p += CRC32C_FOLD, len -= CRC32C_FOLD) {
+            // Each lane moves 2048 bits forward and takes in next data (0x96 = three-way xor)
+            x0 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k2048, 0x00), _mm512_clmulepi64_epi128(x0, k2048, 0x11),
+                _mm512_loadu_si512(p), 0x96);
+            x1 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x1, k2048, 0x00), _mm512_clmulepi64_epi128(x1, k2048, 0x11),
+                _mm512_loadu_si512(p + 64), 0x96);
+            x2 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x2, k2048, 0x00), _mm512_clmulepi64_epi128(x2, k2048, 0x11),
+                _mm512_loadu_si512(p + 128), 0x96);
+            x3 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x3, k2048, 0x00), _mm512_clmulepi64_epi128(x3, k2048, 0x11),
+                _mm512_loadu_si512(p + 192), 0x96);
+        }
+
+        // Fold four remainders into x3, then its four lanes into one 128-bit remainder
+        x1 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k512, 0x00), _mm512_clmulepi64_epi128(x0, k512, 0x11), x1, 0x96);
+        x2 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x1, k512, 0x00), _mm512_clmulepi64_epi128(x1, k512, 0x11), x2, 0x96);
+        x3 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x2, k512, 0x00), _mm512_clmulepi64_epi128(x2, k512, 0x11), x3, 0x96);
+        __m128i k128 = _mm_set_epi64x(k[9], k[8]);
+        __m128i r = _mm512_extracti32x4_epi32(x3, 3);
+        r = _mm_xor_si128(r, crc32c_fold128(_mm512_extracti32x4_epi32(x3, 0), _mm_set_epi64x(k[5], k[4])));
+        r = _mm_xor_si128(r, crc32c_fold128(_mm512_extracti32x4_epi32(x3, 1), _mm_set_epi64x(k[7], k[6])));
+        r = _mm_xor_si128(r, crc32c_fold128(_mm512_extracti32x4_epi32(x3, 2), k128));
+        for (; len >= 16; p += 16, len -= 16) {
+            r = _mm_xor_si128(crc32c_fold128(r, k128), _mm_loadu_si128((const __m128i*)p));
+        }
+
+        // Remainder has same CRC as everything folded into it
+        uint64_t c = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(r));
+        crc = (uint32_t)_mm_crc32_u64(c, (uint64_t)_mm_extract_epi64(r, 1));
+    }
+    return crc32c_sse42(crc, p, len);
+}
+#endif
+
+// Function to extend CRC32C `crc` (0 to start) over `len` more bytes
+static inline uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_hw == 2) {
+        return ~crc32c_avx512(crc, buf, len);
+    }
+    if (crc32c_hw) {
+        return ~crc32c_sse42(crc, buf, len);
+    }
+#endif
+    return ~crc32c_sw(crc, buf, len);
+}
+
+#endif
@@ -0,0 +1,274 @@
+// Asynchronous positional file writer used by the client.
+// The receive loop hands each frame to a bounded single-producer,
+// single-consumer ring and goes straight back to the socket. A writer thread
+// drains the ring and writes every frame with pwrite() at its own offset, so
+// frames that arrive out of order are written at once and a slow disk never
+// delays ACKs. When the ring is full the frame is refused rather than waited
+// for; the sender retransmits it like any lost frame. Several writers can
+// share one file (one per receiving stream), each writing its own frames.
+// Frames that reach the file are recorded in an optional resume map.
+// With io_uring the writer takes every frame waiting in the ring at once and
+// writes them from its registered storage to the registered file with one
+// io_uring_enter(), instead of one pwrite() per frame.
+// Including file must define _GNU_SOURCE before its first system header.
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resume.h"
+#include "uring.h"
+
+#define WRITE_QUEUE 256 // Frames the writer ring holds (power of two)
+
+// Frame waiting to be written
+struct write_slot {
+    off_t offset; // Position in file
+    size_t len; // Bytes in data
+    char* data; // Frame payload (payload_size bytes reserved)
+    ssize_t written; // Bytes that reached file (-1 = write failed)
+};
+
+// Writer thread and its ring of pending frames
+struct disk_writer {
+    int fd; // Output file
+    int owns_fd; // 1 = close() trims and closes fd, 0 = fd is shared and caller finishes it
+    long int payload_size; // Bytes per frame (frame n starts at (n - 1) * payload_size)
+    struct resume_map* map; // Records frames on disk, NULL = none
+    struct write_slot ring[WRITE_QUEUE]; // Pending frames
+    char* storage; // WRITE_QUEUE * payload_size bytes behind ring slots
+    atomic_ulong head; // Frames submitted (producer)
+    atomic_ulong tail; // Frames written (consumer)
+    atomic_int waiting; // 1 while writer thread sleeps on `wake`
+    atomic_int closing; // 1 once producer is done
+    pthread_mutex_t lock; // Protects sleeping on `wake`
+    pthread_cond_t wake; // Signaled when frames arrive or writer is closed
+    pthread_t thread; // Writer thread
+    off_t size; // End of furthest frame written (final file size)
+    long long errors; // Failed writes
+    long long calls; // Write syscalls made: pwrite() or io_uring_enter()
+    long long frames; // Frames written
+    struct uring uring; // Frames are written through it when uring.fd != -1
+    int uring_file; // Output file's registered slot, -1 = plain descriptor
+};
+
+// Function to write rest of `slot` past what already reached file with pwrite()
+static inline void disk_write_slot(struct disk_writer* w, struct write_slot* slot) {
+    size_t done = slot->written > 0 ? (size_t)slot->written : 0;
+    while (done < slot->len) {
+        w->calls++;
+        ssize_t n = pwrite(w->fd, slot->data + done, slot->len - done, slot->offset + done);
+        if (n <= 0) {
+            perror("Client: pwrite");
+            slot->written = -1;
+            return;
+        }
+        done += n;
+    }
+    slot->written = (ssize_t)done;
+}
+
+// Function to write `n` slots from `tail` on with one io_uring_enter(), from registered storage when it is
+// registered. A short write is finished with pwrite().
+static inline void disk_write_uring(struct disk_writer* w, unsigned long tail, unsigned long n) {
+    int fixed = w->uring_file >= 0;
+    int fd = fixed ? w->uring_file : w->fd;
+    for (unsigned long j = 0; j < n; j++) {
+        struct write_slot* slot = &w->ring[(tail + j) % WRITE_QUEUE];
+        struct io_uring_sqe* sqe = uring_sqe(&w->uring);
+        uring_prep(sqe, w->uring.buffers_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, fixed, slot->data,
+            (unsigned)slot->len, slot->offset, (tail + j) % WRITE_QUEUE);
+        sqe->buf_index = 0; // Storage is registered as one buffer
+        slot->written = 0;
+    }
+    w->calls++;
+    if (uring_submit(&w->uring, (unsigned)n) == -1) {
+        perror("Client: io_uring_enter");
+        return; // Every slot falls back to pwrite() below
+    }
+    for (unsigned long j = 0; j < n; j++) {
+        struct io_uring_cqe* cqe = uring_cqe(&w->uring);
+        struct write_slot* slot = &w->ring[cqe->user_data];
+        if (cqe->res < 0) {
+            errno = -cqe->res;
+            perror("Client: io_uring write");
+            slot->written = -1;
+        } else {
+            slot->written = cqe->res;
+        }
+        uring_cqe_seen(&w->uring);
+    }
+    for (unsigned long j = 0; j < n; j++) {
+        struct write_slot* slot = &w->ring[(tail + j) % WRITE_QUEUE];
+        if (slot->written >= 0 && (size_t)slot->written < slot->len) {
+            disk_write_slot(w, slot);
+        }
+    }
+}
+
+// Function to write frames from ring until it is empty and writer is closed
+static void* disk_writer_run(void* arg) {
+    struct disk_writer* w = arg;
+    long int lo = 0, hi = 0; // Frames marked in resume map since it was last saved
+    int marked = 0;
+    for (;;) {
+        unsigned long tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+        if (w->map && marked && (marked >= RESUME_FLUSH_FRAMES || tail == atomic_load(&w->head))) {
+            resume_flush(w->map, lo, hi); // Save map before going idle, and every so often while busy
+            marked = 0;
+        }
+        if (tail == atomic_load_explicit(&w->head, memory_order_acquire)) {
+            // Ring empty: sleep until producer publishes more or closes
+            pthread_mutex_lock(&w->lock);
+            atomic_store(&w->waiting, 1);
+            while (tail == atomic_load(&w->head) && !atomic_load(&w->closing)) {
+                pthread_cond_wait(&w->wake, &w->lock);
+            }
+            atomic_store(&w->waiting, 0);
+            pthread_mutex_unlock(&w->lock);
+            if (tail == atomic_load(&w->head)) {
+                return NULL; // Closed and drained
+            }
+        }
+
+        // Write next frame, or with io_uring every frame published so far
+        unsigned long n = 1;
+        if (w->uring.fd != -1) {
+            n = atomic_load_explicit(&w->head, memory_order_acquire) - tail;
+            disk_write_uring(w, tail, n);
+        } else {
+            w->ring[tail % WRITE_QUEUE].written = 0;
+            disk_write_slot(w, &w->ring[tail % WRITE_QUEUE]);
+        }
+        for (unsigned long j = 0; j < n; j++) {
+            struct write_slot* slot = &w->ring[(tail + j) % WRITE_QUEUE];
+            long int id = slot->offset / w->payload_size + 1;
+            if (slot->written != (ssize_t)slot->len) {
+                w->errors++;
+                continue;
+            }
+            w->frames++;
+            if (slot->offset + (off_t)slot->len > w->size) {
+                w->size = slot->offset + slot->len;
+            }
+            if (w->map) {
+                resume_mark(w->map, id, slot->offset + slot->len);
+                lo = marked && lo < id ? lo : id;
+                hi = marked && hi > id ? hi : id;
+                marked++;
+            }
+        }
+        atomic_store_explicit(&w->tail, tail + n, memory_order_release); // Hand slots back to producer
+    }
+}
+
+// Function to create output file and preallocate room for `total_frame` frames, returns fd or -1
+static inline int disk_file_create(const char* path, long int total_frame, long int payload_size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+        // Reserve blocks up front so writes past end never wait on allocation (best effort: some file systems lack it)
+        fallocate(fd, 0, 0, (off_t)total_frame * payload_size);
+    }
+    return fd;
+}
+
+// Function to trim preallocated space past `size` and close output file
+static inline void disk_file_finish(int fd, off_t size) {
+    if (ftruncate(fd, size) == -1) {
+        perror("Client: ftruncate");
+    }
+    close(fd);
+}
+
+// Function to start a writer thread on an open file (shared with other writers unless `owns_fd`). With `uring` it
+// writes through an io_uring of its own, with file and storage registered, if kernel has one.
+static inline int disk_writer_attach(struct disk_writer* w, int fd, long int payload_size, int owns_fd, int uring) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->owns_fd = owns_fd;
+    w->payload_size = payload_size;
+    w->uring.fd = -1;
+    w->uring_file = -1;
+    w->storage = malloc((size_t)WRITE_QUEUE * payload_size);
+    if (!w->storage) {
+        return -1;
+    }
+    for (int i = 0; i < WRITE_QUEUE; i++) {
+        w->ring[i].data = w->storage + (size_t)i * payload_size;
+    }
+    if (uring && uring_init(&w->uring, WRITE_QUEUE) == 0) {
+        struct iovec storage = { w->storage, (size_t)WRITE_QUEUE * payload_size };
+        w->uring_file = uring_register_file(&w->uring, fd);
+        uring_register_buffers(&w->uring, &storage, 1); // Plain writes if it cannot be pinned
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    if (pthread_create(&w->thread, NULL, disk_writer_run, w) != 0) {
+        uring_free(&w->uring);
+        free(w->storage);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to create output file, preallocate room for `total_frame` frames and start its own writer thread
+static inline int disk_writer_open(struct disk_writer* w, const char* path, long int total_frame, long int payload_size, int uring) {
+    int fd = disk_file_create(path, total_frame, payload_size);
+    if (fd == -1) {
+        return -1;
+    }
+    if (disk_writer_attach(w, fd, payload_size, 1, uring) == -1) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to queue frame `id` without blocking, returns 0 if ring is full
+static inline int disk_writer_submit(struct disk_writer* w, long int id, const char* data, size_t len) {
+    unsigned long head = atomic_load_explicit(&w->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&w->tail, memory_order_acquire) >= WRITE_QUEUE || len > (size_t)w->payload_size) {
+        return 0;
+    }
+    struct write_slot* slot = &w->ring[head % WRITE_QUEUE];
+    slot->offset = (off_t)(id - 1) * w->payload_size;
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    atomic_store(&w->head, head + 1); // Publish slot (sequentially consistent, pairs with `waiting` check)
+
+    // Only pay for a wakeup when writer is actually asleep
+    if (atomic_load(&w->waiting)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return 1;
+}
+
+// Function to wait for queued frames to reach file, trim preallocated space and close it if writer owns it.
+// Returns end of furthest frame this writer wrote.
+static inline off_t disk_writer_close(struct disk_writer* w) {
+    pthread_mutex_lock(&w->lock);
+    atomic_store(&w->closing, 1);
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    uring_free(&w->uring);
+    if (w->owns_fd) {
+        disk_file_finish(w->fd, w->size);
+    }
+    free(w->storage);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->wake);
+    return w->size;
+}
+
+#endif
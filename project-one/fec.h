@@ -0,0 +1,419 @@
+// Forward error correction shared by server and client.
+// Frames of a stream are grouped into blocks of k data frames. After a
+// block's last data frame is first sent, the server sends m parity frames
+// computed with a systematic Reed-Solomon erasure code over GF(2^8): parity
+// row j is the sum of coef[j][i] * data frame i. The coefficients come from a
+// Cauchy matrix scaled so row 0 is all ones (plain XOR parity), and every
+// square part of a Cauchy matrix can be inverted, so any k of the k + m
+// frames rebuild the block. The client keeps the data and parity of recent
+// blocks and rebuilds up to m lost frames of a block without asking for them
+// again. Multiplying a buffer by a constant uses two 16-entry nibble tables;
+// CPUs with AVX2 look up 32 bytes per pshufb, others one byte per step.
+// Call fec_init() once before any thread encodes or decodes.
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define FEC_MAX_DATA 64 // Most data frames per block
+#define FEC_MAX_PARITY 8 // Most parity frames per block
+#define FEC_GF_POLY 0x11d // x^8 + x^4 + x^3 + x^2 + 1, generator of GF(2^8)
+#define FEC_TARGET_FAIL 0.01 // Adaptive parity aims to leave at most 1% of blocks to retransmission
+#define FEC_LOSS_GAIN 0.125 // Weight of each loss report in smoothed loss estimate
+
+// FEC settings of one transfer (k = 0: FEC off)
+struct fec_config {
+    int k; // Data frames per block
+    int m; // Parity frames per block to start with
+    int adapt; // 1 = server follows loss reported by client, 0 = m stays fixed
+};
+
+static unsigned char fec_exp[512]; // fec_exp[i] = generator^i, doubled so products need no modulo
+static unsigned char fec_log[256]; // Inverse of fec_exp (fec_log[0] unused)
+static unsigned char fec_nib[256][2][16]; // Product of c with low nibble x, and with high nibble x << 4
+static unsigned char fec_coef[FEC_MAX_PARITY][FEC_MAX_DATA]; // Parity row j, data column i
+static int fec_avx2; // 1 = use AVX2 nibble lookups
+
+// Function to multiply two elements of GF(2^8)
+static inline unsigned char fec_mul(unsigned char a, unsigned char b) {
+    return a && b ? fec_exp[fec_log[a] + fec_log[b]] : 0;
+}
+
+// Function to invert a nonzero element of GF(2^8)
+static inline unsigned char fec_inv(unsigned char a) {
+    return fec_exp[255 - fec_log[a]];
+}
+
+// Function to build field tables and coding coefficients
+static inline void fec_init(void) {
+    unsigned int x = 1;
+    for (int i = 0; i < 255; i++) {
+        fec_exp[i] = fec_exp[i + 255] = (unsigned char)x;
+        fec_log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= FEC_GF_POLY;
+        }
+    }
+    fec_exp[510] = fec_exp[511] = fec_exp[0];
+    for (int c = 0; c < 256; c++) {
+        for (int n = 0; n < 16; n++) {
+            fec_nib[c][0][n] = fec_mul((unsigned char)c, (unsigned char)n);
+            fec_nib[c][1][n] = fec_mul((unsigned char)c, (unsigned char)(n << 4));
+        }
+    }
+
+    // Cauchy matrix 1 / (x_j + y_i) with x_j = j and y_i = FEC_MAX_PARITY + i, each column scaled so row 0 is 1
+    for (int i = 0; i < FEC_MAX_DATA; i++) {
+        unsigned char scale = (unsigned char)(FEC_MAX_PARITY + i); // Row 0 holds 1 / (0 + y_i) before scaling
+        for (int j = 0; j < FEC_MAX_PARITY; j++) {
+            fec_coef[j][i] = fec_mul(fec_inv((unsigned char)(j ^ (FEC_MAX_PARITY + i))), scale);
+        }
+    }
+#if defined(__x86_64__)
+    fec_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#if defined(__x86_64__)
+// Function to add c * src to dst with 32 byte nibble lookups
+__attribute__((target("avx2"))) static inline size_t fec_mul_add_avx2(unsigned char* dst, const unsigned char* src, unsigned char c, size_t len) {
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)fec_nib[c][0]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)fec_nib[c][1]));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(dst + i)), p));
+    }
+    return i;
+}
+#endif
+
+// Function to add c * src to dst, `len` bytes (addition in GF(2^8) is XOR)
+static inline void fec_mul_add(unsigned char* dst, const unsigned char* src, unsigned char c, size_t len) {
+    size_t i = 0;
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t a, b;
+            memcpy(&a, dst + i, 8);
+            memcpy(&b, src + i, 8);
+            a ^= b;
+            memcpy(dst + i, &a, 8);
+        }
+    }
+#if defined(__x86_64__)
+    else if (fec_avx2) {
+        i = fec_mul_add_avx2(dst, src, c, len);
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] ^= fec_nib[c][0][src[i] & 15] ^ fec_nib[c][1][src[i] >> 4];
+    }
+}
+
+// Function to compute parity row `j` of a block into `out` (`plen` bytes); data frame i has len[i] bytes, zero padded
+static inline void fec_encode(unsigned char* out, int j, const unsigned char* const* data, const long int* len, int n, long int plen) {
+    memset(out, 0, plen);
+    for (int i = 0; i < n; i++) {
+        fec_mul_add(out, data[i], fec_coef[j][i], len[i]);
+    }
+}
+
+// Function to compute P(more than m of n frames lost) when each is lost with probability p
+static inline double fec_fail_chance(int n, int m, double p) {
+    double term = 1; // P(0 lost)
+    double below = 0;
+    for (int i = 0; i < n; i++) {
+        term *= 1 - p;
+    }
+    for (int i = 0; i <= m && i <= n; i++) {
+        below += term;
+        term *= (double)(n - i) / (i + 1) * p / (1 - p);
+    }
+    return 1 - below;
+}
+
+// Function to pick fewest parity frames (at least 1) that leave a block of k unrecoverable less than FEC_TARGET_FAIL of the time
+static inline int fec_parity_for(int k, double loss) {
+    int m = 1;
+    if (loss <= 0) {
+        return m;
+    }
+    if (loss >= 1) {
+        return FEC_MAX_PARITY;
+    }
+    while (m < FEC_MAX_PARITY && fec_fail_chance(k + m, m, loss) > FEC_TARGET_FAIL) {
+        m++;
+    }
+    return m;
+}
+
+// One block the client is collecting
+struct fec_block {
+    long int first; // First data frame of block, 0 = slot unused
+    int n; // Data frames in block (k, fewer for a stream's last block)
+    int m; // Parity frames server sends for block, 0 until one arrives
+    int have; // Data frames present
+    int parity; // Parity frames present
+    int got; // Frames that arrived before frames two blocks later (loss accounting; later ones are retransmissions)
+    long int plen; // Length of parity frames
+    unsigned char present[FEC_MAX_DATA + FEC_MAX_PARITY]; // Data frames, then parity frames, that are present
+    unsigned char* buf; // (k + FEC_MAX_PARITY) frames of payload_size bytes
+};
+
+// Client-side FEC state of one stream
+struct fec_decoder {
+    int k; // Data frames per block
+    long int first; // First frame of stream
+    long int last; // Last frame of stream
+    long int total_frame; // Frames in file (its last frame may be short)
+    long int payload_size; // Bytes per frame
+    long long file_size; // File size, gives length of file's last frame
+    long int highest; // Highest data frame received
+    int n_slots; // Blocks kept at once (block b uses slot b % n_slots)
+    struct fec_block* slots; // Blocks being collected
+    unsigned char* storage; // Frame buffers behind slots
+    unsigned int shares; // Frames (data and parity) of finished blocks, reported in ACKs
+    unsigned int lost; // Frames of finished blocks that did not arrive in time, reported in ACKs
+    int last_m; // Parity per block in most recent parity frame
+};
+
+// Function to get bytes in data frame `id`
+static inline long int fec_frame_len(const struct fec_decoder* d, long int id) {
+    return id == d->total_frame ? (long int)(d->file_size - (long long)(id - 1) * d->payload_size) : d->payload_size;
+}
+
+// Function to set up decoding for frames [first, last] of a file with a receive window of `window` frames
+static inline int fec_decoder_init(struct fec_decoder* d, int k, long int first, long int last, long int total_frame,
+    long int payload_size, long long file_size, int window) {
+    memset(d, 0, sizeof(*d));
+    d->k = k;
+    d->first = first;
+    d->last = last;
+    d->total_frame = total_frame;
+    d->payload_size = payload_size;
+    d->file_size = file_size;
+    d->highest = first - 1;
+    d->n_slots = window / k + 2; // Every block that overlaps receive window
+    d->slots = calloc(d->n_slots, sizeof(struct fec_block));
+    d->storage = malloc((size_t)d->n_slots * (k + FEC_MAX_PARITY) * payload_size);
+    if (!d->slots || !d->storage) {
+        free(d->slots);
+        free(d->storage);
+        return -1;
+    }
+    for (int i = 0; i < d->n_slots; i++) {
+        d->slots[i].buf = d->storage + (size_t)i * (k + FEC_MAX_PARITY) * payload_size;
+    }
+    return 0;
+}
+
+// Function to release decoder storage
+static inline void fec_decoder_free(struct fec_decoder* d) {
+    free(d->slots);
+    free(d->storage);
+}
+
+// Function to add a finished block's frames to loss report
+static inline void fec_retire(struct fec_decoder* d, struct fec_block* b) {
+    int m = b->m ? b->m : d->last_m;
+    if (b->first) {
+        d->shares += b->n + m;
+        d->lost += b->got < b->n + m ? b->n + m - b->got : 0;
+    }
+    b->first = 0;
+}
+
+// Function to find slot of block holding frame `id`, starting it if needed; NULL if slot holds a later block
+static inline struct fec_block* fec_block_of(struct fec_decoder* d, long int id) {
+    long int index = (id - d->first) / d->k;
+    struct fec_block* b = &d->slots[index % d->n_slots];
+    long int first = d->first + index * d->k;
+    if (b->first == first) {
+        return b;
+    }
+    if (b->first > first) {
+        return NULL; // Frame of a long finished block
+    }
+    fec_retire(d, b);
+    memset(b->present, 0, sizeof(b->present));
+    b->first = first;
+    b->n = d->last - first + 1 < d->k ? (int)(d->last - first + 1) : d->k;
+    b->m = b->have = b->parity = b->got = 0;
+    b->plen = 0;
+    return b;
+}
+
+// Function to get buffer of data frame i (i < k) or parity frame k + j of a block
+static inline unsigned char* fec_slot_buf(const struct fec_decoder* d, const struct fec_block* b, int i) {
+    return b->buf + (size_t)i * d->payload_size;
+}
+
+// Function to check whether a block lacks data frames it has enough parity to rebuild
+static inline int fec_can_rebuild(const struct fec_block* b) {
+    return b->have < b->n && b->m && b->have + b->parity >= b->n;
+}
+
+// Function to keep a newly received data frame, returns its block if it can now be rebuilt
+static inline struct fec_block* fec_add_data(struct fec_decoder* d, long int id, const char* data, long int len) {
+    struct fec_block* b = fec_block_of(d, id);
+    int i;
+    if (id > d->highest) {
+        d->highest = id;
+    }
+    if (!b || b->present[i = (int)(id - b->first)]) {
+        return NULL;
+    }
+    memcpy(fec_slot_buf(d, b, i), data, len);
+    b->present[i] = 1;
+    b->have++;
+    if (d->highest < b->first + b->n + d->k) {
+        b->got++; // Arrived before frames of the block after next, so not a retransmission
+    }
+    return fec_can_rebuild(b) ? b : NULL;
+}
+
+// Function to keep a parity frame (index j of m) of block starting at `first`, returns its block if it can now be rebuilt
+static inline struct fec_block* fec_add_parity(struct fec_decoder* d, long int first, int j, int m, const char* data, long int len) {
+    if (first < d->first || first > d->last || (first - d->first) % d->k != 0 || j < 0 || j >= m || m > FEC_MAX_PARITY
+        || len > d->payload_size) {
+        return NULL;
+    }
+    struct fec_block* b = fec_block_of(d, first);
+    d->last_m = m;
+    if (!b || b->present[d->k + j]) {
+        return NULL;
+    }
+    if (b->parity && (b->m != m || b->plen != len)) {
+        return NULL; // Does not match block's other parity frames
+    }
+    memcpy(fec_slot_buf(d, b, d->k + j), data, len);
+    b->present[d->k + j] = 1;
+    b->parity++;
+    b->got++;
+    b->m = m;
+    b->plen = len;
+    return fec_can_rebuild(b) ? b : NULL;
+}
+
+// Function to invert an e x e matrix over GF(2^8) in place (Gauss-Jordan), returns -1 if it is singular
+static inline int fec_invert(unsigned char a[FEC_MAX_PARITY][FEC_MAX_PARITY], int e) {
+    unsigned char inv[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    memset(inv, 0, sizeof(inv));
+    for (int r = 0; r < e; r++) {
+        inv[r][r] = 1;
+    }
+    for (int c = 0; c < e; c++) {
+        int p = c;
+        while (p < e && a[p][c] == 0) {
+            p++;
+        }
+        if (p == e) {
+            return -1;
+        }
+        for (int x = 0; x < e; x++) {
+            unsigned char t = a[c][x];
+            a[c][x] = a[p][x];
+            a[p][x] = t;
+            t = inv[c][x];
+            inv[c][x] = inv[p][x];
+            inv[p][x] = t;
+        }
+        unsigned char scale = fec_inv(a[c][c]);
+        for (int x = 0; x < e; x++) {
+            a[c][x] = fec_mul(a[c][x], scale);
+            inv[c][x] = fec_mul(inv[c][x], scale);
+        }
+        for (int r = 0; r < e; r++) {
+            unsigned char f = a[r][c];
+            if (r == c || f == 0) {
+                continue;
+            }
+            for (int x = 0; x < e; x++) {
+                a[r][x] ^= fec_mul(f, a[c][x]);
+                inv[r][x] ^= fec_mul(f, inv[c][x]);
+            }
+        }
+    }
+    memcpy(a, inv, sizeof(inv));
+    return 0;
+}
+
+// Function to rebuild a block's missing data frames; their indexes go to `rebuilt`, returns how many (0 on failure)
+static inline int fec_rebuild(struct fec_decoder* d, struct fec_block* b, int* rebuilt) {
+    int rows[FEC_MAX_PARITY];
+    unsigned char a[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    int e = 0;
+
+    // Missing data frames, and as many parity rows as there are frames missing
+    for (int i = 0; i < b->n; i++) {
+        if (!b->present[i]) {
+            rebuilt[e++] = i;
+        }
+    }
+    for (int j = 0, r = 0; j < b->m && r < e; j++) {
+        if (b->present[d->k + j]) {
+            rows[r++] = j;
+        }
+    }
+
+    // Take present data frames out of each parity row, leaving sum of coef * missing frame
+    for (int r = 0; r < e; r++) {
+        unsigned char* syndrome = fec_slot_buf(d, b, d->k + rows[r]);
+        for (int i = 0; i < b->n; i++) {
+            if (b->present[i]) {
+                long int len = fec_frame_len(d, b->first + i);
+                fec_mul_add(syndrome, fec_slot_buf(d, b, i), fec_coef[rows[r]][i], len < b->plen ? len : b->plen);
+            }
+        }
+        for (int c = 0; c < e; c++) {
+            a[r][c] = fec_coef[rows[r]][rebuilt[c]];
+        }
+    }
+    if (fec_invert(a, e) == -1) {
+        return 0;
+    }
+
+    // Each missing frame is a combination of the syndromes
+    for (int c = 0; c < e; c++) {
+        unsigned char* out = fec_slot_buf(d, b, rebuilt[c]);
+        memset(out, 0, b->plen);
+        for (int r = 0; r < e; r++) {
+            fec_mul_add(out, fec_slot_buf(d, b, d->k + rows[r]), a[c][r], b->plen);
+        }
+        b->present[rebuilt[c]] = 1;
+    }
+    for (int j = 0; j < b->m; j++) {
+        b->present[d->k + j] = 0; // Parity buffers now hold syndromes
+    }
+    b->have = b->n;
+    b->parity = 0;
+    return e;
+}
+
+// Function to check whether frame `base` is missing but its block's parity may still arrive and rebuild it:
+// no parity for the block yet and no data frame past the block
+static inline int fec_pending(struct fec_decoder* d, long int base) {
+    if (base > d->last || d->highest <= base) {
+        return 0;
+    }
+    long int index = (base - d->first) / d->k;
+    long int end = d->first + (index + 1) * d->k - 1;
+    struct fec_block* b = &d->slots[index % d->n_slots];
+    return d->highest <= end && (b->first != d->first + index * d->k || b->parity == 0);
+}
+
+#endif
@@ -0,0 +1,292 @@
+// Cache of mapped files used by the server's event loop and stream workers.
+// A request looks its file up with one stat(); if path, inode, size and modification time still match a cached
+// entry, the existing mapping is shared and no file is opened or read. A changed file gets a new entry and the old
+// one is dropped from the cache (sessions still sending it keep their mapping until they end). Entries are
+// reference counted and evicted least recently used first once the cache holds more than its byte or entry cap.
+// Each entry can also keep every frame's data CRC32C for one payload size, filled in as frames are first sent,
+// so checksummed frames of a hot file are sealed without reading their data again.
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_CACHE_ENTRIES 64 // Most files kept mapped at once
+#define FILE_CACHE_DEFAULT_MB 512 // Default cap on bytes of cached files (and their CRC tables)
+#define FILE_CRC_KNOWN (1ULL << 32) // Set in a frame_crc slot once its CRC is filled in
+
+// One mapped file, shared by every session sending it
+struct file_entry {
+    char path[256]; // Path it was opened with (cache key)
+    dev_t dev; // Device and inode, size and modification time when mapped: a change means a new entry
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char* map; // Whole file mapped read-only, NULL for an empty file or a source
+    void* source; // Bytes served from something other than one file (a bundle's files), NULL otherwise
+    void (*source_free)(void* source); // Lets go of source once entry's last user is done
+    long int crc_payload; // Payload size frame_crc was built for, 0 = no table yet
+    atomic_ullong* frame_crc; // Per frame (ID - 1): CRC32C of its data | FILE_CRC_KNOWN, 0 until first sent
+    long int crc_frames; // Entries in frame_crc
+    int refs; // Sessions and stream jobs using entry, plus 1 while it is in cache
+    int cached; // 1 while entry is in cache
+    unsigned long long last_used; // Cache tick of last lookup (LRU order)
+};
+
+// Cache of file entries, guarded by one mutex (lookups happen once per request, never per frame)
+struct file_cache {
+    pthread_mutex_t lock;
+    struct file_entry* entries[FILE_CACHE_ENTRIES]; // Cached entries, NULL = free slot
+    long long max_bytes; // Cap on bytes held (0 = cache off, every request maps its file)
+    long long bytes; // Bytes held: file sizes plus CRC tables of cached entries
+    unsigned long long tick; // Bumped on every lookup
+    long long hits; // Lookups served by a cached entry
+    long long misses; // Lookups that had to open and map the file
+    long long invalidated; // Cached entries dropped because their file changed
+    long long evicted; // Cached entries dropped to stay under a cap
+};
+
+// Function to set up an empty cache holding at most `max_bytes` (0 = off)
+static inline void file_cache_init(struct file_cache* c, long long max_bytes) {
+    memset(c, 0, sizeof(*c));
+    pthread_mutex_init(&c->lock, NULL);
+    c->max_bytes = max_bytes;
+}
+
+// Function to get bytes an entry counts against cap
+static inline long long file_entry_bytes(struct file_entry* e) {
+    return (long long)e->size + e->crc_frames * (long long)sizeof(*e->frame_crc);
+}
+
+// Function to drop one reference, unmapping file once nobody uses it (call with lock held)
+static inline void file_entry_put(struct file_entry* e) {
+    if (--e->refs > 0) {
+        return;
+    }
+    if (e->map) {
+        munmap(e->map, e->size);
+    }
+    if (e->source_free) {
+        e->source_free(e->source);
+    }
+    free(e->frame_crc);
+    free(e);
+}
+
+// Function to take entry in slot `i` out of cache (call with lock held)
+static inline void file_cache_drop(struct file_cache* c, int i) {
+    struct file_entry* e = c->entries[i];
+    c->entries[i] = NULL;
+    c->bytes -= file_entry_bytes(e);
+    e->cached = 0;
+    file_entry_put(e);
+}
+
+// Function to evict least recently used entries until `need` more bytes (and `slots` more entries) fit (call with lock held)
+static inline void file_cache_make_room(struct file_cache* c, long long need, int slots) {
+    for (;;) {
+        int used = 0, lru = -1;
+        for (int i = 0; i < FILE_CACHE_ENTRIES; i++) {
+            if (c->entries[i]) {
+                used++;
+                if (lru == -1 || c->entries[i]->last_used < c->entries[lru]->last_used) {
+                    lru = i;
+                }
+            }
+        }
+        if (lru == -1 || (used + slots <= FILE_CACHE_ENTRIES && c->bytes + need <= c->max_bytes)) {
+            return;
+        }
+        file_cache_drop(c, lru);
+        c->evicted++;
+    }
+}
+
+// Function to map open file `fd` read-only into an entry named `path`, not in any cache. Closes `fd`; returns entry
+// with one reference, or NULL (errno set).
+static inline struct file_entry* file_entry_map(int fd, const char* path) {
+    struct stat st;
+    struct file_entry* e = calloc(1, sizeof(*e));
+    if (!e || fstat(fd, &st) == -1) {
+        int err = errno;
+        free(e);
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->refs = 1;
+    if (e->size > 0) {
+        e->map = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (e->map == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            free(e);
+            errno = err;
+            return NULL;
+        }
+    }
+    close(fd); // Mapping stays valid after file is closed
+    return e;
+}
+
+// Function to make an entry named `path` for `size` bytes read from `source` rather than a mapping, not in any cache,
+// so it is shared and released like a file. Returns entry with one reference, or NULL (errno set).
+static inline struct file_entry* file_entry_source(const char* path, off_t size, void* source, void (*source_free)(void*)) {
+    struct file_entry* e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->size = size;
+    e->source = source;
+    e->source_free = source_free;
+    e->refs = 1;
+    return e;
+}
+
+// Function to open a file mapped read-only, from cache when it has not changed. `*hit` is set to 1 when no file was
+// opened. Returns entry with a reference the caller must release, or NULL (errno set) if file cannot be opened or mapped.
+static inline struct file_entry* file_cache_open(struct file_cache* c, const char* path, int* hit) {
+    struct stat st;
+    *hit = 0;
+    if (stat(path, &st) == -1) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->tick++;
+    for (int i = 0; i < FILE_CACHE_ENTRIES; i++) {
+        struct file_entry* e = c->entries[i];
+        if (!e || strcmp(e->path, path) != 0) {
+            continue;
+        }
+        if (e->dev == st.st_dev && e->ino == st.st_ino && e->size == st.st_size && e->mtime.tv_sec == st.st_mtim.tv_sec
+            && e->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            e->refs++;
+            e->last_used = c->tick;
+            c->hits++;
+            *hit = 1;
+            pthread_mutex_unlock(&c->lock);
+            return e;
+        }
+        file_cache_drop(c, i); // File changed since it was mapped
+        c->invalidated++;
+    }
+    c->misses++;
+    pthread_mutex_unlock(&c->lock);
+
+    // Key entry on what was actually opened, in case file changed since stat()
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct file_entry* e = file_entry_map(fd, path);
+    if (!e) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    int cached = 0;
+    if (e->size <= c->max_bytes) {
+        file_cache_make_room(c, e->size, 1);
+        for (int i = 0; i < FILE_CACHE_ENTRIES; i++) {
+            if (!c->entries[i]) {
+                c->entries[i] = e;
+                e->refs++;
+                e->cached = 1;
+                e->last_used = c->tick;
+                c->bytes += e->size;
+                cached = 1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (e->map) {
+        // A cached file is worth reading in once and keeping; one that is not is read front to back and let go
+        madvise(e->map, e->size, cached ? MADV_WILLNEED : MADV_SEQUENTIAL);
+    }
+    return e;
+}
+
+// Function to take another reference to an entry (e.g. for a stream worker)
+static inline void file_cache_ref(struct file_cache* c, struct file_entry* e) {
+    pthread_mutex_lock(&c->lock);
+    e->refs++;
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Function to release a reference taken by file_cache_open() or file_cache_ref()
+static inline void file_cache_release(struct file_cache* c, struct file_entry* e) {
+    pthread_mutex_lock(&c->lock);
+    file_entry_put(e);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Function to get entry's per-frame CRC table for frames of `payload_size` bytes, NULL if it has one for another
+// payload size or cannot get one. The table lives as long as the entry.
+static inline atomic_ullong* file_cache_crcs(struct file_cache* c, struct file_entry* e, long int payload_size) {
+    atomic_ullong* table = NULL;
+    pthread_mutex_lock(&c->lock);
+    if (e->crc_payload == payload_size) {
+        table = e->frame_crc;
+    } else if (e->crc_payload == 0) {
+        long int frames = (long int)((e->size + payload_size - 1) / payload_size);
+        long long bytes = frames * (long long)sizeof(*e->frame_crc);
+        if (e->cached) {
+            file_cache_make_room(c, bytes, 0); // May evict entry itself, which then keeps table until its last user ends
+        }
+        if (!e->cached || c->bytes + bytes <= c->max_bytes) {
+            e->frame_crc = calloc(frames, sizeof(*e->frame_crc));
+        }
+        if (e->frame_crc) {
+            e->crc_payload = payload_size;
+            e->crc_frames = frames;
+            if (e->cached) {
+                c->bytes += bytes;
+            }
+            table = e->frame_crc;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return table;
+}
+
+// Function to print cache counters
+static inline void file_cache_print(FILE* out, struct file_cache* c) {
+    int files = 0;
+    pthread_mutex_lock(&c->lock);
+    for (int i = 0; i < FILE_CACHE_ENTRIES; i++) {
+        files += c->entries[i] != NULL;
+    }
+    fprintf(out, "File cache: %lld hits, %lld misses, %lld invalidated, %lld evicted, %d files (%lld of %lld bytes) cached\n",
+        c->hits, c->misses, c->invalidated, c->evicted, files, c->bytes, c->max_bytes);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Function to drop every cached entry (entries still in use stay mapped until released)
+static inline void file_cache_free(struct file_cache* c) {
+    pthread_mutex_lock(&c->lock);
+    for (int i = 0; i < FILE_CACHE_ENTRIES; i++) {
+        if (c->entries[i]) {
+            file_cache_drop(c, i);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+#endif
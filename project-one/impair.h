@@ -0,0 +1,240 @@
+// Network impairment simulator used by the server (and by multicast receivers to drop their own frames).
+// Every datagram gets one O(1) decision from a seeded PRNG: drop it (uniform
+// loss, or Gilbert-Elliott burst loss), send an extra copy, flip one bit of a
+// copy, and hold each copy back for a fixed delay plus random jitter, with
+// some copies held longer so they arrive out of order. Held datagrams wait in
+// a delay line ordered by release time. The same seed and the same sequence
+// of datagrams always gives the same decisions, so runs can be repeated
+// exactly.
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMPAIR_MAX_COPIES 2 // Original plus one duplicate
+#define IMPAIR_DEFAULT_SEED 1 // Seed used unless one is given
+
+// Impairment settings for one direction
+struct impair_model {
+    double loss; // Drop probability (good state when burst loss is on)
+    double ge_p; // Gilbert-Elliott: good -> bad transition probability (0 = burst loss off)
+    double ge_r; // Gilbert-Elliott: bad -> good transition probability
+    double ge_loss; // Gilbert-Elliott: drop probability in bad state
+    long long delay; // Added one-way delay (us)
+    long long jitter; // Extra delay drawn uniformly from [0, jitter] (us)
+    double reorder; // Probability a datagram is held back past later ones
+    long long reorder_delay; // Extra delay for reordered datagrams (us)
+    double duplicate; // Probability a datagram is sent twice
+    double corrupt; // Probability a copy has one bit flipped
+};
+
+// Impairment state for one direction of one session
+struct impair {
+    struct impair_model m; // Settings
+    unsigned long long rng; // xorshift64* state (never 0)
+    int bad; // 1 while Gilbert-Elliott chain is in bad state
+    long long dropped; // Datagrams dropped
+    long long duplicated; // Extra copies sent
+    long long delayed; // Copies put in delay line
+    long long reordered; // Copies held back past later ones
+    long long corrupted; // Copies with a flipped bit
+};
+
+// What to do with one datagram
+struct impair_verdict {
+    int copies; // 0 = drop, 1 = send, 2 = send twice
+    long long delay[IMPAIR_MAX_COPIES]; // Hold time for each copy (us, 0 = send now)
+    long long corrupt_bit[IMPAIR_MAX_COPIES]; // Bit to flip in each copy, scaled to [0, 2^32) of datagram length (-1 = none)
+};
+
+// Function to seed a direction's PRNG from a run seed and a stream number (splitmix64)
+static inline void impair_init(struct impair* im, const struct impair_model* m, unsigned long long seed, unsigned long long stream) {
+    unsigned long long z = seed + (stream + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    memset(im, 0, sizeof(*im));
+    im->m = *m;
+    im->rng = z ? z : 0x9e3779b97f4a7c15ULL;
+}
+
+// Function to draw a uniform double in [0, 1) (xorshift64*)
+static inline double impair_uniform(struct impair* im) {
+    im->rng ^= im->rng >> 12;
+    im->rng ^= im->rng << 25;
+    im->rng ^= im->rng >> 27;
+    return (double)((im->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Function to check whether a model changes anything (lets callers skip the simulator entirely)
+static inline int impair_active(const struct impair_model* m) {
+    return m->loss > 0 || m->ge_p > 0 || m->delay > 0 || m->jitter > 0 || m->reorder > 0 || m->duplicate > 0 || m->corrupt > 0;
+}
+
+// Function to decide fate of next datagram
+static inline struct impair_verdict impair_decide(struct impair* im) {
+    struct impair_verdict v = { 0, { 0, 0 }, { -1, -1 } };
+    double loss = im->m.loss;
+
+    // Burst loss: step two-state Markov chain once per datagram
+    if (im->m.ge_p > 0) {
+        if (im->bad) {
+            im->bad = impair_uniform(im) >= im->m.ge_r;
+        } else {
+            im->bad = impair_uniform(im) < im->m.ge_p;
+        }
+        if (im->bad) {
+            loss = im->m.ge_loss;
+        }
+    }
+    if (loss > 0 && impair_uniform(im) < loss) {
+        im->dropped++;
+        return v;
+    }
+
+    v.copies = 1;
+    if (im->m.duplicate > 0 && impair_uniform(im) < im->m.duplicate) {
+        v.copies = 2;
+        im->duplicated++;
+    }
+    for (int c = 0; c < v.copies; c++) {
+        v.delay[c] = im->m.delay;
+        if (im->m.jitter > 0) {
+            v.delay[c] += (long long)(impair_uniform(im) * (im->m.jitter + 1));
+        }
+        if (im->m.reorder > 0 && impair_uniform(im) < im->m.reorder) {
+            v.delay[c] += im->m.reorder_delay;
+            im->reordered++;
+        }
+        if (v.delay[c] > 0) {
+            im->delayed++;
+        }
+        if (im->m.corrupt > 0 && impair_uniform(im) < im->m.corrupt) {
+            v.corrupt_bit[c] = (long long)(impair_uniform(im) * 4294967296.0);
+            im->corrupted++;
+        }
+    }
+    return v;
+}
+
+// Datagram waiting in a delay line
+struct delayed_datagram {
+    long long due; // Release time (us)
+    unsigned long long order; // Insertion order, breaks ties so equal delays keep FIFO order
+    struct sockaddr_in addr; // Destination (frames) or source (ACKs)
+    size_t len; // Bytes in data
+    char* data; // Copy of datagram
+};
+
+// Datagrams held back by simulator, kept as a binary min-heap on release time
+struct delay_line {
+    struct delayed_datagram* heap; // Heap storage
+    int count; // Datagrams waiting
+    int cap; // Allocated entries
+    unsigned long long order; // Next insertion order
+};
+
+// Function to compare two held datagrams by release time, then insertion order
+static inline int delay_before(const struct delayed_datagram* a, const struct delayed_datagram* b) {
+    return a->due < b->due || (a->due == b->due && a->order < b->order);
+}
+
+// Function to restore heap order downward from entry i
+static inline void delay_sift_down(struct delay_line* d, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < d->count && delay_before(&d->heap[l], &d->heap[m])) {
+            m = l;
+        }
+        if (r < d->count && delay_before(&d->heap[r], &d->heap[m])) {
+            m = r;
+        }
+        if (m == i) {
+            return;
+        }
+        struct delayed_datagram tmp = d->heap[i];
+        d->heap[i] = d->heap[m];
+        d->heap[m] = tmp;
+        i = m;
+    }
+}
+
+// Function to hold a copy of a datagram until `due`
+static inline void delay_push(struct delay_line* d, long long due, const struct sockaddr_in* addr, const void* data, size_t len) {
+    if (d->count == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 64;
+        d->heap = realloc(d->heap, (size_t)d->cap * sizeof(*d->heap));
+        if (!d->heap) {
+            perror("Memory allocation failed for delay line");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct delayed_datagram e;
+    e.due = due;
+    e.order = d->order++;
+    e.addr = *addr;
+    e.len = len;
+    e.data = malloc(len);
+    if (!e.data) {
+        perror("Memory allocation failed for delayed datagram");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(e.data, data, len);
+
+    // Sift up
+    int i = d->count++;
+    while (i > 0 && delay_before(&e, &d->heap[(i - 1) / 2])) {
+        d->heap[i] = d->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    d->heap[i] = e;
+}
+
+// Function to get release time of earliest held datagram, 0 if none
+static inline long long delay_next_due(const struct delay_line* d) {
+    return d->count ? d->heap[0].due : 0;
+}
+
+// Function to take earliest held datagram if it is due by `now` (caller frees data), returns 0 if none
+static inline int delay_pop(struct delay_line* d, long long now, struct delayed_datagram* out) {
+    if (d->count == 0 || d->heap[0].due > now) {
+        return 0;
+    }
+    *out = d->heap[0];
+    d->heap[0] = d->heap[--d->count];
+    delay_sift_down(d, 0);
+    return 1;
+}
+
+// Function to discard every held datagram for an address (its session ended)
+static inline void delay_purge(struct delay_line* d, const struct sockaddr_in* addr) {
+    int kept = 0;
+    for (int i = 0; i < d->count; i++) {
+        if (d->heap[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && d->heap[i].addr.sin_port == addr->sin_port) {
+            free(d->heap[i].data);
+        } else {
+            d->heap[kept++] = d->heap[i];
+        }
+    }
+    if (kept != d->count) {
+        d->count = kept;
+        for (int i = kept / 2 - 1; i >= 0; i--) {
+            delay_sift_down(d, i); // Rebuild heap
+        }
+    }
+}
+
+// Function to release a delay line and every datagram still held
+static inline void delay_free(struct delay_line* d) {
+    for (int i = 0; i < d->count; i++) {
+        free(d->heap[i].data);
+    }
+    free(d->heap);
+    memset(d, 0, sizeof(*d));
+}
+
+#endif
@@ -0,0 +1,251 @@
+// Low-overhead metrics and tracing shared by server and client.
+// Counters are atomics that any thread can bump with a relaxed add.
+// Histograms keep power-of-two buckets, so recording a sample is a few
+// instructions. Frame-level events go into a fixed-size binary ring buffer
+// instead of being formatted as text; it is written to a file on demand
+// (SIGUSR1) and at exit. Per-frame text output is opt-in through VLOG().
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HIST_BUCKETS 40 // Bucket b holds values in [2^(b-1), 2^b), enough for hours in us
+#define TRACE_MAGIC 0x43525455 // "UTRC" at start of a trace dump
+#define TRACE_VERSION 1 // Trace dump format version
+#define TRACE_DEFAULT_ENTRIES (1 << 16) // Trace ring size (power of two)
+
+static int log_verbose; // 1 = print a line per frame event (-v)
+
+// Print only when verbose logging is on
+#define VLOG(...) do { if (log_verbose) printf(__VA_ARGS__); } while (0)
+
+// Latency histogram (values in us)
+struct histogram {
+    atomic_llong count; // Samples recorded
+    atomic_llong sum; // Sum of samples
+    atomic_llong max; // Largest sample
+    atomic_llong bucket[HIST_BUCKETS]; // Samples per power-of-two bucket
+};
+
+// Process-wide counters
+struct metrics {
+    atomic_llong frames_sent; // Data frames handed to socket (including retransmissions)
+    atomic_llong bytes_sent; // Payload bytes handed to socket
+    atomic_llong frames_received; // Data frames received (including duplicates)
+    atomic_llong bytes_received; // Payload bytes received
+    atomic_llong retransmits; // Frames sent again
+    atomic_llong timeouts; // Retransmission (server) or receive (client) timer expiries
+    atomic_llong acks_sent; // ACKs sent
+    atomic_llong acks_received; // ACKs received
+    atomic_llong duplicates; // Frames received that were already written
+    atomic_llong corrupt; // Frames dropped because their checksum did not match
+    atomic_llong parity; // FEC parity frames sent (server) or received (client)
+    atomic_llong rebuilt; // Lost frames rebuilt from parity
+    atomic_llong packed; // Frames sent or received packed by a codec
+    atomic_llong write_queue_full; // Frames refused because disk writer fell behind
+    atomic_llong sessions; // Transfers completed
+    struct histogram rtt; // Round trip time samples (us)
+    struct histogram transfer; // Time per completed transfer (us)
+};
+
+// Trace event types
+enum trace_event {
+    TR_SEND = 1, // Frame sent, arg = payload bytes
+    TR_RESEND, // Frame retransmitted, arg = payload bytes
+    TR_DROP, // Frame dropped by simulator
+    TR_ACK_RX, // ACK received, id = cumulative ACK, arg = SACK ranges
+    TR_ACK_TX, // ACK sent, id = cumulative ACK, arg = SACK ranges
+    TR_TIMEOUT, // Timer expired, id = base frame
+    TR_FRAME_RX, // Frame received, arg = payload bytes
+    TR_WRITE, // Frame written to file, arg = payload bytes
+    TR_WINDOW, // Window changed, id = base frame, arg = new window (frames)
+    TR_RTT, // RTT sample, arg = RTT (us)
+    TR_PARITY, // FEC parity frame sent or received, id = block's first frame, arg = parity index
+    TR_REBUILD, // Lost frame rebuilt from parity, arg = payload bytes
+};
+
+// One trace record (fixed size, written to dump as is)
+struct trace_record {
+    int64_t t_us; // Monotonic time (us)
+    int32_t event; // enum trace_event
+    int32_t session; // Session slot (server) or 0 (client)
+    int64_t id; // Frame number
+    int64_t arg; // Event-specific value
+};
+
+// Header written before records in a trace dump
+struct trace_header {
+    uint32_t magic; // TRACE_MAGIC
+    uint32_t version; // TRACE_VERSION
+    uint32_t record_size; // sizeof(struct trace_record)
+    uint32_t reserved; // 0
+    uint64_t count; // Records that follow, oldest first
+    uint64_t lost; // Older records overwritten before dump
+};
+
+// Ring buffer of most recent trace records
+struct trace_ring {
+    struct trace_record* buf; // NULL = tracing off
+    uint64_t mask; // Entries - 1
+    atomic_ullong head; // Total records ever written
+};
+
+static struct metrics metrics; // Counters for this process
+static struct trace_ring trace; // Frame-level trace (off unless enabled)
+static volatile sig_atomic_t dump_requested; // Set by SIGUSR1
+
+// Function to add one sample to a histogram
+static inline void hist_add(struct histogram* h, long long v) {
+    if (v < 0) {
+        v = 0;
+    }
+    int b = v ? 64 - __builtin_clzll((unsigned long long)v) : 0;
+    if (b >= HIST_BUCKETS) {
+        b = HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&h->bucket[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    long long m = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > m && !atomic_compare_exchange_weak_explicit(&h->max, &m, v, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Function to estimate a percentile (0-100) as upper edge of bucket that holds it
+static inline long long hist_percentile(struct histogram* h, double pct) {
+    long long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    long long rank = (long long)(count * pct / 100.0 + 0.5);
+    long long seen = 0;
+    if (count == 0) {
+        return 0;
+    }
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += atomic_load_explicit(&h->bucket[b], memory_order_relaxed);
+        if (seen >= rank && seen > 0) {
+            long long edge = b ? (1LL << b) - 1 : 0;
+            long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+            return edge < max ? edge : max;
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+// Function to bump a counter
+static inline void metric_add(atomic_llong* c, long long v) {
+    atomic_fetch_add_explicit(c, v, memory_order_relaxed);
+}
+
+// Function to read a counter
+static inline long long metric_get(atomic_llong* c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+// Function to print one histogram's summary
+static inline void hist_print(FILE* out, const char* name, struct histogram* h) {
+    long long count = metric_get(&h->count);
+    fprintf(out, "%s: %lld samples, mean %lld us, p50 %lld us, p90 %lld us, p99 %lld us, max %lld us\n", name, count,
+        count ? metric_get(&h->sum) / count : 0, hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99),
+        metric_get(&h->max));
+}
+
+// Function to print all counters and histograms
+static inline void metrics_print(FILE* out, const char* who) {
+    fprintf(out, "%s metrics: %lld frames (%lld bytes) sent, %lld frames (%lld bytes) received, %lld retransmits, "
+        "%lld timeouts, %lld ACKs sent, %lld ACKs received, %lld duplicates, %lld corrupt, %lld parity, %lld rebuilt, %lld packed, %lld refused by full write queue, %lld transfers\n", who,
+        metric_get(&metrics.frames_sent), metric_get(&metrics.bytes_sent), metric_get(&metrics.frames_received),
+        metric_get(&metrics.bytes_received), metric_get(&metrics.retransmits), metric_get(&metrics.timeouts),
+        metric_get(&metrics.acks_sent), metric_get(&metrics.acks_received), metric_get(&metrics.duplicates),
+        metric_get(&metrics.corrupt), metric_get(&metrics.parity), metric_get(&metrics.rebuilt), metric_get(&metrics.packed), metric_get(&metrics.write_queue_full), metric_get(&metrics.sessions));
+    hist_print(out, "RTT", &metrics.rtt);
+    hist_print(out, "Transfer duration", &metrics.transfer);
+}
+
+// Function to turn tracing on with room for `entries` records (rounded up to a power of two)
+static inline void trace_init(long entries) {
+    uint64_t n = 1;
+    while (n < (uint64_t)entries) {
+        n <<= 1;
+    }
+    trace.buf = calloc(n, sizeof(struct trace_record));
+    if (!trace.buf) {
+        perror("Memory allocation failed for trace");
+        exit(EXIT_FAILURE);
+    }
+    trace.mask = n - 1;
+}
+
+// Function to record one event (no-op when tracing is off)
+static inline void trace_event(int event, int session, long int id, long int arg) {
+    if (!trace.buf) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // Clock is read only when tracing
+    uint64_t i = atomic_fetch_add_explicit(&trace.head, 1, memory_order_relaxed);
+    struct trace_record* r = &trace.buf[i & trace.mask];
+    r->t_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    r->event = event;
+    r->session = session;
+    r->id = id;
+    r->arg = arg;
+}
+
+// Function to write trace records, oldest first, to a file (header then raw records)
+static inline void trace_dump(const char* path) {
+    if (!trace.buf) {
+        return;
+    }
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        perror("Trace dump");
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&trace.head, memory_order_relaxed);
+    uint64_t size = trace.mask + 1;
+    uint64_t count = head < size ? head : size;
+    struct trace_header hdr = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record), 0, count, head - count };
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (uint64_t i = head - count; i < head; i++) {
+        fwrite(&trace.buf[i & trace.mask], sizeof(struct trace_record), 1, fp);
+    }
+    fclose(fp);
+    printf("Trace: %llu records written to %s (%llu older records overwritten)\n",
+        (unsigned long long)count, path, (unsigned long long)(head - count));
+}
+
+// Signal handler asking main loop to dump metrics and trace
+static void request_dump(int sig) {
+    (void)sig;
+    dump_requested = 1;
+}
+
+// Function to install SIGUSR1 handler for on-demand dumps
+static inline void metrics_install_dump_signal(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_dump;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+// Function to dump metrics and trace if SIGUSR1 arrived since last call
+static inline void metrics_poll_dump(const char* who, const char* trace_path) {
+    if (!dump_requested) {
+        return;
+    }
+    dump_requested = 0;
+    metrics_print(stdout, who);
+    if (trace_path) {
+        trace_dump(trace_path);
+    }
+    fflush(stdout);
+}
+
+#endif
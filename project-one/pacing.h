@@ -0,0 +1,212 @@
+// Sender pacing used by the server: a token bucket that spreads a sender's frames evenly over time, and a
+// BBR-style estimator that sets the rate from ACK timing. Every ACK gives a delivery rate sample (bytes delivered
+// between sending the newest acknowledged frame and its ACK, over the longer of the send and ACK intervals).
+// The bottleneck bandwidth is the largest sample of the last PACE_BW_ROUNDS round trips and the path delay the
+// smallest RTT of the last PACE_RTT_WINDOW_US. Startup paces at 2/ln2 times the estimate until it stops growing,
+// drain then empties the queue startup built, and from there the rate cycles through gains that probe for more
+// bandwidth for one RTT and drain what that probe queued for the next, as BBR's ProbeBW does.
+#ifndef PACING_H
+#define PACING_H
+
+#include <string.h>
+
+#define PACE_QUANTUM_US 1000 // Burst is this long's worth of bytes: about what a sender sends back to back
+#define PACE_MIN_BURST 2 // Frames bucket holds however slow the rate
+#define PACE_BW_ROUNDS 10 // Round trips bandwidth max filter covers
+#define PACE_RTT_WINDOW_US 10000000LL // Time min RTT filter covers (10 s)
+#define PACE_STARTUP_GAIN 2.885 // 2/ln2: sending rate doubles every round trip, like slow start
+#define PACE_CWND_GAIN 2.0 // Window in bandwidth-delay products, room for delayed and stretched ACKs
+#define PACE_FULL_BW_GROWTH 1.25 // Startup ends once bandwidth grew by less than this...
+#define PACE_FULL_BW_ROUNDS 3 // ...for this many round trips in a row
+#define PACE_CYCLE 8 // Phases of bandwidth probing cycle, one min RTT each
+
+enum pace_mode { PACE_STARTUP, PACE_DRAIN, PACE_PROBE_BW };
+
+static const double pace_cycle_gain[PACE_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 }; // Probe, drain, cruise
+static const char* const pace_mode_names[] = { "startup", "drain", "probe bandwidth" };
+
+// Token bucket: tokens refill at `rate` and each frame sent spends its bytes
+struct pacer {
+    double rate; // Bytes per us (MB/s), 0 = unpaced
+    double tokens; // Bytes that may be sent now (negative = sent ahead of rate)
+    double burst; // Bytes per batch: a waiting sender wakes once half of it refilled, bucket banks two
+    long long refill_at; // Time tokens were last topped up (us)
+    long long waits; // Times sender had to wait for tokens
+};
+
+// Snapshot of delivery state taken as a frame is sent, read back when it is acknowledged
+struct pace_sample {
+    long long delivered; // Bytes acknowledged when frame was sent
+    long long delivered_at; // Time of that acknowledgment (us)
+    long long first_sent_at; // Send time of newest frame acknowledged by then (us)
+    long long sent_at; // Time frame was sent (us)
+};
+
+// Bottleneck bandwidth and min RTT estimator, and the gain BBR's state machine applies to them
+struct bw_estimator {
+    long long delivered; // Bytes acknowledged so far
+    long long delivered_at; // Time of last acknowledgment (us)
+    long long first_sent_at; // Send time of newest frame acknowledged (us)
+    double max_bw[PACE_BW_ROUNDS]; // Largest delivery rate of each recent round (bytes per us), ring indexed by round
+    long int round; // Round trips counted: one ends when a frame sent after it started is acknowledged
+    long long round_end; // `delivered` value whose acknowledgment ends current round
+    long long min_rtt; // Smallest RTT in filter window (us), 0 = no sample yet
+    long long min_rtt_at; // Time it was measured (us)
+    int mode; // enum pace_mode
+    double full_bw; // Bandwidth startup last grew to
+    int full_rounds; // Rounds since it grew by PACE_FULL_BW_GROWTH
+    int cycle; // Probe bandwidth phase
+    long long cycle_at; // Time phase started (us)
+    double gain; // Pacing gain of current mode and phase
+};
+
+// Function to set a pacer's rate (bytes per us, 0 = unpaced); burst is at least PACE_MIN_BURST frames of `frame_bytes`
+static inline void pacer_set_rate(struct pacer* p, double rate, long int frame_bytes) {
+    p->rate = rate;
+    p->burst = rate * PACE_QUANTUM_US;
+    if (p->burst < (double)PACE_MIN_BURST * frame_bytes) {
+        p->burst = (double)PACE_MIN_BURST * frame_bytes;
+    }
+}
+
+// Function to start a pacer at `rate` with a full bucket
+static inline void pacer_init(struct pacer* p, double rate, long int frame_bytes, long long now) {
+    memset(p, 0, sizeof(*p));
+    pacer_set_rate(p, rate, frame_bytes);
+    p->tokens = p->burst;
+    p->refill_at = now;
+}
+
+// Function to check whether a frame may be sent now. Tokens bank up to two bursts, so a wakeup that comes up to a
+// millisecond timer tick late still sends at full rate.
+static inline int pacer_ready(struct pacer* p, long long now) {
+    if (p->rate <= 0) {
+        return 1;
+    }
+    p->tokens += (double)(now - p->refill_at) * p->rate;
+    if (p->tokens > 2 * p->burst) {
+        p->tokens = 2 * p->burst;
+    }
+    p->refill_at = now;
+    return p->tokens > 0;
+}
+
+// Function to charge a sent datagram's bytes (a sender that may not wait, like a timeout's resends, runs into debt)
+static inline void pacer_spend(struct pacer* p, long long bytes) {
+    if (p->rate > 0) {
+        p->tokens -= bytes;
+    }
+}
+
+// Function to get time (us) a sender refused by pacer_ready() should try again: once half a burst has refilled
+static inline long long pacer_wake(struct pacer* p) {
+    p->waits++;
+    return p->refill_at + (long long)((p->burst / 2 - p->tokens) / p->rate) + 1;
+}
+
+// Function to reset an estimator: no bandwidth known, startup
+static inline void bw_init(struct bw_estimator* e) {
+    memset(e, 0, sizeof(*e));
+    e->mode = PACE_STARTUP;
+    e->gain = PACE_STARTUP_GAIN;
+}
+
+// Function to get bottleneck bandwidth estimate (bytes per us, 0 = no sample yet)
+static inline double bw_estimate(const struct bw_estimator* e) {
+    double bw = 0;
+    for (int i = 0; i < PACE_BW_ROUNDS; i++) {
+        bw = e->max_bw[i] > bw ? e->max_bw[i] : bw;
+    }
+    return bw;
+}
+
+// Function to get estimated bandwidth-delay product (bytes)
+static inline double bw_bdp(const struct bw_estimator* e) {
+    return bw_estimate(e) * e->min_rtt;
+}
+
+// Function to take a frame's snapshot as it is sent. `idle` says nothing was in flight, so time spent idle is not
+// counted against delivery rate.
+static inline void bw_on_send(struct bw_estimator* e, struct pace_sample* sample, int idle, long long now) {
+    if (idle || e->delivered_at == 0) {
+        e->delivered_at = now;
+        e->first_sent_at = now;
+    }
+    sample->delivered = e->delivered;
+    sample->delivered_at = e->delivered_at;
+    sample->first_sent_at = e->first_sent_at;
+    sample->sent_at = now;
+}
+
+// Function to fold in an ACK that newly delivered `bytes`, the newest of them sent with `sample`. `rtt` is that frame's
+// RTT, -1 if it was resent: the ACK for a resent frame can also cover frames that arrived long before, so like an
+// RTT it gives no rate sample. `inflight` is the bytes still unacknowledged after this ACK.
+static inline void bw_on_ack(struct bw_estimator* e, const struct pace_sample* sample, long long bytes, long long rtt,
+    long long inflight, long long now) {
+    if (bytes <= 0) {
+        return;
+    }
+    e->delivered += bytes;
+    e->delivered_at = now;
+    e->first_sent_at = sample->sent_at;
+
+    // A round ends once a frame sent after it began is acknowledged
+    int round_start = sample->delivered >= e->round_end;
+    if (round_start) {
+        e->round++;
+        e->round_end = e->delivered;
+        e->max_bw[e->round % PACE_BW_ROUNDS] = 0; // Oldest round leaves filter
+    }
+
+    // Rate over the longer of send and ACK intervals, so ACKs bunched up on the way back cannot inflate it
+    long long send_elapsed = sample->sent_at - sample->first_sent_at;
+    long long ack_elapsed = now - sample->delivered_at;
+    long long interval = send_elapsed > ack_elapsed ? send_elapsed : ack_elapsed;
+    if (interval > 0 && rtt >= 0) {
+        double rate = (double)(e->delivered - sample->delivered) / interval;
+        int slot = e->round % PACE_BW_ROUNDS;
+        e->max_bw[slot] = rate > e->max_bw[slot] ? rate : e->max_bw[slot];
+    }
+    if (rtt >= 0 && (e->min_rtt == 0 || rtt <= e->min_rtt || now - e->min_rtt_at > PACE_RTT_WINDOW_US)) {
+        e->min_rtt = rtt;
+        e->min_rtt_at = now;
+    }
+
+    double bw = bw_estimate(e);
+    switch (e->mode) {
+    case PACE_STARTUP:
+        if (!round_start) {
+            break;
+        }
+        if (bw >= e->full_bw * PACE_FULL_BW_GROWTH) {
+            e->full_bw = bw;
+            e->full_rounds = 0;
+        } else if (++e->full_rounds >= PACE_FULL_BW_ROUNDS) {
+            e->mode = PACE_DRAIN; // Pipe is full: drain queue startup built
+            e->gain = 1 / PACE_STARTUP_GAIN;
+        }
+        break;
+    case PACE_DRAIN:
+        if (inflight <= bw_bdp(e)) {
+            e->mode = PACE_PROBE_BW;
+            e->cycle = 2; // Cruise first, probe later
+            e->cycle_at = now;
+            e->gain = pace_cycle_gain[e->cycle];
+        }
+        break;
+    default:
+        if (now - e->cycle_at >= e->min_rtt) {
+            e->cycle = (e->cycle + 1) % PACE_CYCLE;
+            e->cycle_at = now;
+            e->gain = pace_cycle_gain[e->cycle];
+        }
+        break;
+    }
+}
+
+// Function to get pacing rate BBR would send at (bytes per us, 0 = no estimate yet)
+static inline double bw_pacing_rate(const struct bw_estimator* e) {
+    return e->gain * bw_estimate(e);
+}
+
+#endif
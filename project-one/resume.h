@@ -0,0 +1,193 @@
+// Resume map used by the client.
+// Next to each output file the client keeps "<output>.part": a small header
+// followed by one bit per frame, set once that frame's data is on disk. When a
+// transfer is interrupted (client gives up on a frame, or is killed) the map
+// survives, and the next request for the same file asks the server only for
+// the runs of frames still missing. The map names the file it belongs to, so
+// a request for a different file never resumes into the wrong output, and
+// keeps the server's tag for that version of it, so a file changed on the
+// server since is fetched anew rather than patched together. Writer threads
+// set bits in memory and write the changed bytes back when they go idle, so
+// the map costs one small write per batch of frames, not one per frame. A bit
+// lost to a crash only means that frame is fetched again.
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESUME_MAGIC 0x31545250 // "PRT1" at start of a resume map
+#define RESUME_SUFFIX ".part" // Appended to output file name
+#define RESUME_FLUSH_FRAMES 64 // Writer saves map at least this often (frames)
+#define RESUME_NAME_SIZE 256 // Bytes for source file name in map header
+
+// Header at start of a resume map file, followed by (total_frame + 7) / 8 bytes of bits
+struct resume_header {
+    uint32_t magic; // RESUME_MAGIC
+    uint32_t tag; // Server's tag for version of file frames came from (0 = unknown)
+    int64_t total_frame; // Frames in file
+    int64_t payload_size; // Bytes per frame
+    int64_t end; // File size once last frame is on disk, 0 until then
+    char source[RESUME_NAME_SIZE]; // File requested from server
+};
+
+// Which frames of an output file are on disk
+struct resume_map {
+    int fd; // Map file, -1 = no map
+    long int total_frame; // Frames in file
+    long int payload_size; // Bytes per frame
+    unsigned int tag; // Server's tag for version of file frames came from (0 = unknown)
+    unsigned char* bits; // Bit (n - 1) set once frame n is on disk
+    atomic_llong end; // File size once last frame is on disk, 0 until then
+    atomic_long have; // Frames on disk
+};
+
+// Function to count frames already on disk
+static inline long int resume_count(const struct resume_map* m) {
+    long int n = 0;
+    for (long int i = 0; i < (m->total_frame + 7) / 8; i++) {
+        n += __builtin_popcount(m->bits[i]);
+    }
+    return n;
+}
+
+// Function to load a map left by an earlier transfer of `source`, returns 0 if there is none, it is unreadable or for another file
+static inline int resume_load(struct resume_map* m, const char* path, const char* source) {
+    struct resume_header h;
+    memset(m, 0, sizeof(*m));
+    m->fd = open(path, O_RDWR);
+    if (m->fd == -1) {
+        return 0;
+    }
+    if (pread(m->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != RESUME_MAGIC || h.total_frame <= 0 || h.payload_size <= 0
+        || strncmp(h.source, source, sizeof(h.source)) != 0) {
+        close(m->fd);
+        m->fd = -1;
+        return 0;
+    }
+    size_t bytes = (size_t)(h.total_frame + 7) / 8;
+    m->bits = calloc(bytes, 1);
+    if (!m->bits || pread(m->fd, m->bits, bytes, sizeof(h)) != (ssize_t)bytes) {
+        free(m->bits);
+        close(m->fd);
+        m->fd = -1;
+        return 0;
+    }
+    m->total_frame = h.total_frame;
+    m->payload_size = h.payload_size;
+    m->tag = h.tag;
+    m->end = h.end;
+    m->have = resume_count(m);
+    return 1;
+}
+
+// Function to start an empty map for `source`, a file of `total_frame` frames, returns -1 on failure
+static inline int resume_create(struct resume_map* m, const char* path, const char* source, long int total_frame, long int payload_size,
+    unsigned int tag) {
+    struct resume_header h = { RESUME_MAGIC, tag, total_frame, payload_size, 0, { 0 } };
+    size_t bytes = (size_t)(total_frame + 7) / 8;
+    snprintf(h.source, sizeof(h.source), "%s", source);
+    memset(m, 0, sizeof(*m));
+    m->bits = calloc(bytes, 1);
+    m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!m->bits || m->fd == -1 || pwrite(m->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)
+        || pwrite(m->fd, m->bits, bytes, sizeof(h)) != (ssize_t)bytes) {
+        free(m->bits);
+        if (m->fd != -1) {
+            close(m->fd);
+        }
+        m->fd = -1;
+        return -1;
+    }
+    m->total_frame = total_frame;
+    m->payload_size = payload_size;
+    m->tag = tag;
+    return 0;
+}
+
+// Function to check whether frame `id` is on disk
+static inline int resume_has(const struct resume_map* m, long int id) {
+    return (__atomic_load_n(&m->bits[(id - 1) / 8], __ATOMIC_RELAXED) >> ((id - 1) % 8)) & 1;
+}
+
+// Function to record that frame `id` (ending at byte `end` of file) is on disk; safe from several writer threads
+static inline void resume_mark(struct resume_map* m, long int id, long long end) {
+    unsigned char bit = 1 << ((id - 1) % 8);
+    if (!(__atomic_fetch_or(&m->bits[(id - 1) / 8], bit, __ATOMIC_RELAXED) & bit)) {
+        atomic_fetch_add_explicit(&m->have, 1, memory_order_relaxed);
+    }
+    if (id == m->total_frame) {
+        atomic_store_explicit(&m->end, end, memory_order_relaxed);
+    }
+}
+
+// Function to record that frame `id` is not on disk after all (its data turned out to be wrong)
+static inline void resume_clear(struct resume_map* m, long int id) {
+    unsigned char bit = 1 << ((id - 1) % 8);
+    if (__atomic_fetch_and(&m->bits[(id - 1) / 8], (unsigned char)~bit, __ATOMIC_RELAXED) & bit) {
+        atomic_fetch_sub_explicit(&m->have, 1, memory_order_relaxed);
+    }
+}
+
+// Function to write bits for frames [lo, hi] and header's end back to map file
+static inline void resume_flush(struct resume_map* m, long int lo, long int hi) {
+    int64_t end = atomic_load_explicit(&m->end, memory_order_relaxed);
+    size_t first = (lo - 1) / 8, last = (hi - 1) / 8;
+    if (pwrite(m->fd, m->bits + first, last - first + 1, sizeof(struct resume_header) + first) == -1
+        || (end && pwrite(m->fd, &end, sizeof(end), offsetof(struct resume_header, end)) == -1)) {
+        perror("Client: Save resume map");
+    }
+}
+
+// Function to find first run of missing frames within [from, to], returns 0 if all of them are on disk
+static inline int resume_next_gap(const struct resume_map* m, long int from, long int to, long int* first, long int* last) {
+    while (from <= to && resume_has(m, from)) {
+        from++;
+    }
+    if (from > to) {
+        return 0;
+    }
+    *first = from;
+    while (from + 1 <= to && !resume_has(m, from + 1)) {
+        from++;
+    }
+    *last = from;
+    return 1;
+}
+
+// Function to check whether every frame is on disk
+static inline int resume_complete(const struct resume_map* m) {
+    return atomic_load_explicit(&m->have, memory_order_relaxed) == m->total_frame;
+}
+
+// Function to release a map without saving it
+static inline void resume_discard(struct resume_map* m) {
+    if (m->fd != -1) {
+        close(m->fd);
+    }
+    free(m->bits);
+    m->fd = -1;
+    m->bits = NULL;
+}
+
+// Function to save and release a map; a complete map's file is removed since nothing is left to resume
+static inline void resume_close(struct resume_map* m, const char* path) {
+    if (m->fd == -1) {
+        return;
+    }
+    if (resume_complete(m)) {
+        unlink(path);
+    } else {
+        resume_flush(m, 1, m->total_frame);
+    }
+    resume_discard(m);
+}
+
+#endif
@@ -0,0 +1,81 @@
+// Retransmission timeout (RTO) estimator shared by server and client.
+// Follows RFC 6298: smoothed RTT and RTT variance from measured samples,
+// RTO = SRTT + 4 * RTTVAR, doubled on every consecutive timeout and
+// clamped between RTO_MIN_US and RTO_MAX_US.
+#ifndef RTO_H
+#define RTO_H
+
+#include <time.h>
+
+#define RTO_INITIAL_US 1000000LL // RTO before first RTT sample (1 s)
+#define RTO_MIN_US 10000LL // Lower bound on RTO (10 ms)
+#define RTO_MAX_US 10000000LL // Upper bound on RTO (10 s)
+#define RTO_MAX_BACKOFF 6 // Max doublings of RTO after consecutive timeouts
+
+// RTT estimator state
+struct rto_estimator {
+    long long srtt; // Smoothed round trip time (us)
+    long long rttvar; // Round trip time variance (us)
+    long long rto; // Timeout before backoff (us)
+    int backoff; // Consecutive timeouts since last valid sample
+    int has_sample; // 0 until first RTT sample arrives
+};
+
+// Function to read monotonic clock in microseconds
+static inline long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Function to reset estimator to its initial timeout
+static inline void rto_init(struct rto_estimator* e) {
+    e->srtt = 0;
+    e->rttvar = 0;
+    e->rto = RTO_INITIAL_US;
+    e->backoff = 0;
+    e->has_sample = 0;
+}
+
+// Function to fold one RTT measurement into estimator (caller applies Karn's rule:
+// never sample a frame that was retransmitted)
+static inline void rto_sample(struct rto_estimator* e, long long rtt) {
+    if (rtt < 0) {
+        return;
+    }
+    if (!e->has_sample) {
+        e->srtt = rtt; // First sample: SRTT = R, RTTVAR = R/2
+        e->rttvar = rtt / 2;
+        e->has_sample = 1;
+    } else {
+        long long err = e->srtt - rtt;
+        if (err < 0) {
+            err = -err;
+        }
+        e->rttvar = (3 * e->rttvar + err) / 4; // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+        e->srtt = (7 * e->srtt + rtt) / 8; // SRTT = 7/8 SRTT + 1/8 R
+    }
+    e->rto = e->srtt + 4 * e->rttvar;
+    e->backoff = 0; // A valid sample ends any backoff
+}
+
+// Function to double timeout after a retransmission timer fires
+static inline void rto_backoff(struct rto_estimator* e) {
+    if (e->backoff < RTO_MAX_BACKOFF) {
+        e->backoff++;
+    }
+}
+
+// Function to get current timeout (us) with backoff and bounds applied
+static inline long long rto_current(const struct rto_estimator* e) {
+    long long rto = e->rto << e->backoff;
+    if (rto < RTO_MIN_US) {
+        rto = RTO_MIN_US;
+    }
+    if (rto > RTO_MAX_US) {
+        rto = RTO_MAX_US;
+    }
+    return rto;
+}
+
+#endif
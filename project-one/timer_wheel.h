@@ -0,0 +1,204 @@
+// Hierarchical timer wheel shared by server and client.
+// Timers live in doubly linked slot lists, so arming, re-arming and cancelling
+// one is O(1) however many are armed. Level 0 has one slot per tick; each
+// higher level has slots WHEEL_SLOTS times wider, and a slot's timers are
+// moved down a level when time reaches it. A bitmap of non-empty slots per
+// level gives the next expiry in O(WHEEL_LEVELS), and lets time skip over
+// empty stretches instead of stepping through every tick. Timers never fire
+// early: expiry is rounded up to the next tick. Driven by now_us() (monotonic).
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WHEEL_TICK_US 64 // Wheel resolution (us)
+#define WHEEL_BITS 6 // log2 of slots per level (a level's bitmap is one 64-bit word)
+#define WHEEL_SLOTS (1 << WHEEL_BITS) // Slots per level
+#define WHEEL_LEVELS 4 // Levels: span of 2^24 ticks (about 18 minutes), later timers wait in last level
+
+// One timer, embedded in what it times
+struct timer {
+    struct timer* next; // Next timer in same slot
+    struct timer* prev; // Previous timer in same slot, NULL = first
+    long long expires; // Time it fires (us), 0 = not armed
+    long long tick; // Tick it fires on (expires rounded up)
+    int slot; // Slot holding it (level * WHEEL_SLOTS + index)
+    int kind; // What its owner does when it fires
+    void* owner; // Session or stream it belongs to
+    long int id; // Frame it times, for per-frame timers
+};
+
+// Wheel of timers
+struct timer_wheel {
+    struct timer* slots[WHEEL_LEVELS * WHEEL_SLOTS]; // First timer of each slot
+    uint64_t occupied[WHEEL_LEVELS]; // Bit i set: slot i of level is not empty
+    long long tick; // Current tick: timers of earlier ticks have fired
+    long long armed; // Timers armed
+};
+
+// Function to set up an empty wheel whose time starts at `now` (us)
+static inline void wheel_init(struct timer_wheel* w, long long now) {
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        w->slots[i] = NULL;
+    }
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        w->occupied[l] = 0;
+    }
+    w->tick = now / WHEEL_TICK_US;
+    w->armed = 0;
+}
+
+// Function to set up a timer, not armed
+static inline void timer_init(struct timer* tm, int kind, void* owner, long int id) {
+    tm->next = NULL;
+    tm->prev = NULL;
+    tm->expires = 0;
+    tm->tick = 0;
+    tm->slot = 0;
+    tm->kind = kind;
+    tm->owner = owner;
+    tm->id = id;
+}
+
+// Function to check whether a timer is armed
+static inline int timer_armed(const struct timer* tm) {
+    return tm->expires != 0;
+}
+
+// Function to put an armed timer in the slot for its tick: the lowest level whose span still reaches it
+static inline void wheel_link(struct timer_wheel* w, struct timer* tm) {
+    long long at = tm->tick < w->tick ? w->tick : tm->tick; // Overdue: fires on current tick
+    long long delta = at - w->tick;
+    if (delta >= 1LL << (WHEEL_BITS * WHEEL_LEVELS)) {
+        at = w->tick + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1; // Past span: wait in last level, placed again from there
+        delta = at - w->tick;
+    }
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1LL << (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    int index = (int)((at >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    tm->slot = level * WHEEL_SLOTS + index;
+    tm->prev = NULL;
+    tm->next = w->slots[tm->slot];
+    if (tm->next) {
+        tm->next->prev = tm;
+    }
+    w->slots[tm->slot] = tm;
+    w->occupied[level] |= 1ULL << index;
+}
+
+// Function to take a timer out of its slot
+static inline void wheel_unlink(struct timer_wheel* w, struct timer* tm) {
+    if (tm->prev) {
+        tm->prev->next = tm->next;
+    } else {
+        w->slots[tm->slot] = tm->next;
+        if (!tm->next) {
+            w->occupied[tm->slot / WHEEL_SLOTS] &= ~(1ULL << (tm->slot % WHEEL_SLOTS));
+        }
+    }
+    if (tm->next) {
+        tm->next->prev = tm->prev;
+    }
+}
+
+// Function to cancel a timer (nothing happens if it is not armed)
+static inline void wheel_cancel(struct timer_wheel* w, struct timer* tm) {
+    if (!timer_armed(tm)) {
+        return;
+    }
+    wheel_unlink(w, tm);
+    tm->expires = 0;
+    w->armed--;
+}
+
+// Function to arm a timer to fire at `expires` (us), moving it if it was already armed
+static inline void wheel_arm(struct timer_wheel* w, struct timer* tm, long long expires) {
+    wheel_cancel(w, tm);
+    tm->expires = expires > 0 ? expires : 1;
+    tm->tick = (tm->expires + WHEEL_TICK_US - 1) / WHEEL_TICK_US;
+    w->armed++;
+    wheel_link(w, tm);
+}
+
+// Function to get the next tick anything happens on: a level 0 slot's timers fire, or a higher slot moves down.
+// Returns -1 when no timer is armed.
+static inline long long wheel_next_tick(const struct timer_wheel* w) {
+    long long next = -1;
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        uint64_t bits = w->occupied[l];
+        if (!bits) {
+            continue;
+        }
+        // Level 0 looks from current slot on; a higher level from the slot after it, since its current slot
+        // was moved down already and anything there now is a full turn away
+        int shift = WHEEL_BITS * l;
+        int from = (int)(((w->tick >> shift) + (l > 0)) & (WHEEL_SLOTS - 1));
+        uint64_t ahead = bits >> from | (from ? bits << (WHEEL_SLOTS - from) : 0); // Bit k: k slots after `from`
+        long long k = __builtin_ctzll(ahead) + (l > 0);
+        long long at = l == 0 ? w->tick + k : ((w->tick >> shift) + k) << shift;
+        if (next == -1 || at < next) {
+            next = at;
+        }
+    }
+    return next;
+}
+
+// Function to get when the wheel next needs attention (us), 0 when no timer is armed. May be earlier than the
+// first expiry (when a higher level's timers move down), never later.
+static inline long long wheel_next(const struct timer_wheel* w) {
+    long long tick = wheel_next_tick(w);
+    return tick == -1 ? 0 : tick * WHEEL_TICK_US;
+}
+
+// Function to advance one tick, moving down the timers of each higher level slot that time has now reached
+static inline void wheel_step(struct timer_wheel* w) {
+    w->tick++;
+    for (int l = 1; l < WHEEL_LEVELS; l++) {
+        int shift = WHEEL_BITS * l;
+        if (w->tick & ((1LL << shift) - 1)) {
+            break; // Lower level did not wrap
+        }
+        int index = (int)((w->tick >> shift) & (WHEEL_SLOTS - 1));
+        struct timer* tm = w->slots[l * WHEEL_SLOTS + index];
+        w->slots[l * WHEEL_SLOTS + index] = NULL;
+        w->occupied[l] &= ~(1ULL << index);
+        while (tm) {
+            struct timer* next = tm->next;
+            wheel_link(w, tm);
+            tm = next;
+        }
+    }
+}
+
+// Function to take the next timer that has expired by `now` (us), disarmed, or NULL once none is left. Call
+// until it returns NULL; timers armed meanwhile for `now` or later are left for a later call.
+static inline struct timer* wheel_expire(struct timer_wheel* w, long long now) {
+    long long target = now / WHEEL_TICK_US;
+    for (;;) {
+        struct timer* tm = w->slots[w->tick & (WHEEL_SLOTS - 1)];
+        if (tm) {
+            wheel_unlink(w, tm);
+            tm->expires = 0;
+            w->armed--;
+            return tm;
+        }
+        if (w->tick >= target) {
+            return NULL;
+        }
+
+        // Skip ticks where nothing happens, stopping at target
+        long long next = wheel_next_tick(w);
+        if (next == -1 || next > target) {
+            next = target;
+        }
+        if (next > w->tick + 1) {
+            w->tick = next - 1;
+        }
+        wheel_step(w);
+    }
+}
+
+#endif
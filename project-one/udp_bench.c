@@ -0,0 +1,565 @@
+#define _GNU_SOURCE // wait4
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include "rto.h"
+
+#define MAX_LIST 16 // Max values in one sweep list
+#define MAX_ARGS 32 // Max arguments passed to server or client
+#define LINE_SIZE 512 // Longest log line inspected
+#define COPY_CHUNK (1 << 20) // Bytes per read when generating and comparing files
+#define STARTUP_US 200000 // Time given to server to bind before client starts (us)
+#define SHUTDOWN_US 2000000 // Time given to server to exit after client sent EXIT (us)
+#define RUN_TIMEOUT_S 120 // Default limit on one run (s)
+#define BENCH_DIR_TEMPLATE "/tmp/udp_bench.XXXXXX" // Scratch directory for files and logs
+
+// One point of the sweep
+struct bench_run {
+    int protocol; // 1 = Stop-and-Wait, 2 = Go-Back-N, 3 = Selective Repeat
+    long long file_size; // Bytes transferred
+    long int payload; // Payload requested by client (0 = fit path MTU)
+    int window; // Server's Go-Back-N window ceiling
+    int streams; // Parallel streams requested by client
+    int crc; // 1 = client asks for frame checksums and file digest
+    const char* fec; // Client's -F value, e.g. "16,2" ("0" = no FEC)
+    const char* codec; // Client's -z value, e.g. "lz" ("none" = raw frames)
+    double loss; // Client's drop percentage
+    const char* model; // Extra server options, e.g. "-G 1,30 -D 500"
+    int rep; // Repetition number
+};
+
+// Measurements of one run
+struct bench_result {
+    int ok; // 1 if transfer finished and received file matches
+    double seconds; // Transfer time seen by client (request to last frame)
+    long int payload; // Payload both sides agreed to
+    long int frames; // Frames in file (summed over streams)
+    long int resent; // Frames retransmitted by server (summed over streams)
+    long long syscalls; // Datagram send/receive syscalls by server and client
+    long long datagrams; // Datagrams moved by server and client
+    double cpu_user; // User CPU time of server and client (s)
+    double cpu_sys; // System CPU time of server and client (s)
+};
+
+// Values to sweep over
+struct bench_plan {
+    int protocols[MAX_LIST];
+    int n_protocols;
+    long long sizes[MAX_LIST];
+    int n_sizes;
+    long long payloads[MAX_LIST];
+    int n_payloads;
+    long long windows[MAX_LIST];
+    int n_windows;
+    long long streams[MAX_LIST];
+    int n_streams;
+    long long crcs[MAX_LIST];
+    int n_crcs;
+    char* fecs[MAX_LIST];
+    int n_fecs;
+    char* codecs[MAX_LIST];
+    int n_codecs;
+    double losses[MAX_LIST];
+    int n_losses;
+    char* models[MAX_LIST];
+    int n_models;
+};
+
+static char server_bin[PATH_MAX]; // Absolute path of server program
+static char client_bin[PATH_MAX]; // Absolute path of client program
+static int batch_size = 0; // Batch size passed to both programs (0 = their default)
+static int run_timeout = RUN_TIMEOUT_S; // Limit on one run (s)
+
+//Function prototypes
+void print_error(char* msg);
+long long parse_size(const char* text);
+int parse_list(char* text, long long* out, int is_size);
+int parse_losses(char* text, double* out);
+void make_file(const char* name, long long size);
+int same_file(const char* a, const char* b);
+pid_t spawn(char** argv, const char* out, int* stdin_fd);
+int wait_child(pid_t pid, long long deadline, struct rusage* ru);
+void run_once(const struct bench_run* run, struct bench_result* res);
+void print_header(int json);
+void print_result(int json, int first, const struct bench_run* run, const struct bench_result* res);
+
+int main(int argc, char** argv) {
+    struct bench_plan plan;
+    char protocols[64] = "1,2,3", sizes[256] = "1M,16M", payloads[256] = "0", windows[256] = "64", streams[256] = "1", crcs[64] = "1", losses[256] = "0,1";
+    char models[1024] = ""; // ';'-separated server option strings
+    char fecs[256] = "0"; // ';'-separated client FEC settings
+    char codecs[256] = "none"; // Client codec names
+    char dir[] = BENCH_DIR_TEMPLATE;
+    int reps = 1; // Repetitions per point
+    int json = 0; // 1 = JSON, 0 = CSV
+    int opt;
+
+    snprintf(server_bin, sizeof(server_bin), "./server");
+    snprintf(client_bin, sizeof(client_bin), "./client");
+
+    // Parse options
+    while ((opt = getopt(argc, argv, "p:f:s:w:n:k:e:z:l:M:r:b:t:S:C:o:")) != -1) {
+        switch (opt) {
+        case 'p': // Protocols
+            snprintf(protocols, sizeof(protocols), "%s", optarg);
+            break;
+        case 'f': // File sizes
+            snprintf(sizes, sizeof(sizes), "%s", optarg);
+            break;
+        case 's': // Payload sizes
+            snprintf(payloads, sizeof(payloads), "%s", optarg);
+            break;
+        case 'w': // Go-Back-N window ceilings
+            snprintf(windows, sizeof(windows), "%s", optarg);
+            break;
+        case 'n': // Parallel streams
+            snprintf(streams, sizeof(streams), "%s", optarg);
+            break;
+        case 'k': // Frame checksums off (0) and/or on (1)
+            snprintf(crcs, sizeof(crcs), "%s", optarg);
+            break;
+        case 'e': // FEC settings
+            snprintf(fecs, sizeof(fecs), "%s", optarg);
+            break;
+        case 'z': // Codecs
+            snprintf(codecs, sizeof(codecs), "%s", optarg);
+            break;
+        case 'l': // Drop percentages
+            snprintf(losses, sizeof(losses), "%s", optarg);
+            break;
+        case 'M': // Loss models (server options)
+            snprintf(models, sizeof(models), "%s", optarg);
+            break;
+        case 'r': // Repetitions
+            reps = atoi(optarg);
+            break;
+        case 'b': // Batch size
+            batch_size = atoi(optarg);
+            break;
+        case 't': // Timeout per run
+            run_timeout = atoi(optarg);
+            break;
+        case 'S': // Server program
+            snprintf(server_bin, sizeof(server_bin), "%s", optarg);
+            break;
+        case 'C': // Client program
+            snprintf(client_bin, sizeof(client_bin), "%s", optarg);
+            break;
+        case 'o': // Output format
+            json = strcmp(optarg, "json") == 0;
+            break;
+        default:
+            fprintf(stderr, "Usage: ./[%s] [-p protocols] [-f sizes] [-s payloads] [-w windows] [-n streams] [-k crc_modes] [-e fec_modes] [-z codecs] [-l loss_pcts] [-M models] [-r reps] [-b batch_size] [-t timeout_s] [-S server] [-C client] [-o csv|json]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Build sweep lists
+    long long protocol_list[MAX_LIST];
+    plan.n_protocols = parse_list(protocols, protocol_list, 0);
+    for (int i = 0; i < plan.n_protocols; i++) {
+        plan.protocols[i] = (int)protocol_list[i];
+    }
+    plan.n_sizes = parse_list(sizes, plan.sizes, 1);
+    plan.n_payloads = parse_list(payloads, plan.payloads, 1);
+    plan.n_windows = parse_list(windows, plan.windows, 0);
+    plan.n_streams = parse_list(streams, plan.streams, 0);
+    plan.n_crcs = parse_list(crcs, plan.crcs, 0);
+    plan.n_losses = parse_losses(losses, plan.losses);
+    plan.n_fecs = 0;
+    char* rest = fecs;
+    while (rest && plan.n_fecs < MAX_LIST) {
+        plan.fecs[plan.n_fecs++] = strsep(&rest, ";");
+    }
+    plan.n_codecs = 0;
+    rest = codecs;
+    while (rest && plan.n_codecs < MAX_LIST) {
+        plan.codecs[plan.n_codecs++] = strsep(&rest, ",");
+    }
+    plan.n_models = 0;
+    rest = models;
+    while (rest && plan.n_models < MAX_LIST) {
+        plan.models[plan.n_models++] = strsep(&rest, ";"); // Empty entry = no extra impairment
+    }
+    if (optind != argc || reps <= 0 || run_timeout <= 0 || plan.n_protocols == 0 || plan.n_sizes == 0
+        || plan.n_payloads == 0 || plan.n_windows == 0 || plan.n_streams == 0 || plan.n_crcs == 0 || plan.n_losses == 0) {
+        fprintf(stderr, "Usage: ./[%s] [-p protocols] [-f sizes] [-s payloads] [-w windows] [-n streams] [-k crc_modes] [-e fec_modes] [-z codecs] [-l loss_pcts] [-M models] [-r reps] [-b batch_size] [-t timeout_s] [-S server] [-C client] [-o csv|json]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Programs are started from scratch directory, so resolve their paths first
+    char resolved[PATH_MAX];
+    if (!realpath(server_bin, resolved)) {
+        print_error("Bench: Server program");
+    }
+    snprintf(server_bin, sizeof(server_bin), "%s", resolved);
+    if (!realpath(client_bin, resolved)) {
+        print_error("Bench: Client program");
+    }
+    snprintf(client_bin, sizeof(client_bin), "%s", resolved);
+    if (!mkdtemp(dir) || chdir(dir) == -1) {
+        print_error("Bench: Scratch directory");
+    }
+    fprintf(stderr, "Bench: Working in %s\n", dir);
+
+    print_header(json);
+    int first = 1;
+    for (int f = 0; f < plan.n_sizes; f++) {
+        char name[64];
+        snprintf(name, sizeof(name), "bench_%lld.bin", plan.sizes[f]);
+        make_file(name, plan.sizes[f]);
+
+        for (int p = 0; p < plan.n_protocols; p++)
+        for (int s = 0; s < plan.n_payloads; s++)
+        for (int w = 0; w < plan.n_windows; w++)
+        for (int n = 0; n < plan.n_streams; n++)
+        for (int k = 0; k < plan.n_crcs; k++)
+        for (int e = 0; e < plan.n_fecs; e++)
+        for (int z = 0; z < plan.n_codecs; z++)
+        for (int l = 0; l < plan.n_losses; l++)
+        for (int m = 0; m < plan.n_models; m++)
+        for (int r = 0; r < reps; r++) {
+            struct bench_run run = { plan.protocols[p], plan.sizes[f], (long int)plan.payloads[s],
+                (int)plan.windows[w], (int)plan.streams[n], plan.crcs[k] != 0, plan.fecs[e], plan.codecs[z], plan.losses[l], plan.models[m], r + 1 };
+            struct bench_result res;
+            run_once(&run, &res);
+            print_result(json, first, &run, &res);
+            first = 0;
+        }
+        unlink(name);
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+
+    // Remove scratch directory
+    unlink("server.log");
+    unlink("client.log");
+    if (chdir("/") == 0) {
+        rmdir(dir);
+    }
+    return 0;
+}
+
+// Function to print an error message and exit program
+void print_error(char* msg) {
+    perror(msg); // Print error
+    exit(EXIT_FAILURE); // Exit program with failure status
+}
+
+// Function to parse a byte count with an optional K, M or G (binary) suffix
+long long parse_size(const char* text) {
+    char* end;
+    long long v = strtoll(text, &end, 10);
+    switch (*end) {
+    case 'K': case 'k':
+        return v << 10;
+    case 'M': case 'm':
+        return v << 20;
+    case 'G': case 'g':
+        return v << 30;
+    default:
+        return v;
+    }
+}
+
+// Function to parse a comma-separated list of integers (or sizes), returns count
+int parse_list(char* text, long long* out, int is_size) {
+    int n = 0;
+    for (char* v = strtok(text, ","); v && n < MAX_LIST; v = strtok(NULL, ",")) {
+        out[n++] = is_size ? parse_size(v) : atoll(v);
+    }
+    return n;
+}
+
+// Function to parse a comma-separated list of percentages, returns count
+int parse_losses(char* text, double* out) {
+    int n = 0;
+    for (char* v = strtok(text, ","); v && n < MAX_LIST; v = strtok(NULL, ",")) {
+        out[n++] = atof(v);
+    }
+    return n;
+}
+
+// Function to write a file of `size` pseudo-random bytes (same contents every run)
+void make_file(const char* name, long long size) {
+    FILE* fp = fopen(name, "wb");
+    unsigned long long x = 0x9e3779b97f4a7c15ULL;
+    unsigned long long* chunk = malloc(COPY_CHUNK);
+    if (!fp || !chunk) {
+        print_error("Bench: Create test file");
+    }
+    while (size > 0) {
+        for (size_t i = 0; i < COPY_CHUNK / sizeof(*chunk); i++) {
+            x ^= x << 13; // xorshift64
+            x ^= x >> 7;
+            x ^= x << 17;
+            chunk[i] = x;
+        }
+        size_t n = size < COPY_CHUNK ? (size_t)size : COPY_CHUNK;
+        if (fwrite(chunk, 1, n, fp) != n) {
+            print_error("Bench: Write test file");
+        }
+        size -= n;
+    }
+    free(chunk);
+    fclose(fp);
+}
+
+// Function to compare two files byte for byte
+int same_file(const char* a, const char* b) {
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    char* ba = malloc(COPY_CHUNK);
+    char* bb = malloc(COPY_CHUNK);
+    int same = fa && fb && ba && bb;
+    while (same) {
+        size_t na = fread(ba, 1, COPY_CHUNK, fa);
+        size_t nb = fread(bb, 1, COPY_CHUNK, fb);
+        if (na != nb || memcmp(ba, bb, na) != 0) {
+            same = 0;
+        }
+        if (na < COPY_CHUNK) {
+            break;
+        }
+    }
+    if (fa) {
+        fclose(fa);
+    }
+    if (fb) {
+        fclose(fb);
+    }
+    free(ba);
+    free(bb);
+    return same;
+}
+
+// Function to start a program with stdout/stderr sent to `out`, optionally giving caller a pipe to its stdin
+pid_t spawn(char** argv, const char* out, int* stdin_fd) {
+    int in[2] = { -1, -1 };
+    if (stdin_fd && pipe(in) == -1) {
+        print_error("Bench: pipe");
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        print_error("Bench: fork");
+    }
+    if (pid == 0) {
+        int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            _exit(127);
+        }
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        if (stdin_fd) {
+            dup2(in[0], STDIN_FILENO);
+            close(in[0]);
+            close(in[1]);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (stdin_fd) {
+        close(in[0]);
+        *stdin_fd = in[1];
+    }
+    return pid;
+}
+
+// Function to wait for a child until `deadline` (us), returns its status or -1 on timeout
+int wait_child(pid_t pid, long long deadline, struct rusage* ru) {
+    int status;
+    for (;;) {
+        pid_t r = wait4(pid, &status, WNOHANG, ru);
+        if (r == pid) {
+            return status;
+        }
+        if (r == -1 && errno != EINTR) {
+            return -1;
+        }
+        if (now_us() >= deadline) {
+            return -1;
+        }
+        usleep(10000);
+    }
+}
+
+// Function to read the "Send syscalls" summary line of a log, adding its counts to `res`
+static void add_syscalls(const char* line, struct bench_result* res) {
+    long long tx_calls, tx_dgrams, rx_calls, rx_dgrams;
+    if (sscanf(line, "Send syscalls: %lld for %lld datagrams, receive syscalls: %lld for %lld datagrams",
+            &tx_calls, &tx_dgrams, &rx_calls, &rx_dgrams) == 4) {
+        res->syscalls += tx_calls + rx_calls;
+        res->datagrams += tx_dgrams + rx_dgrams;
+    }
+}
+
+// Function to add a child's CPU time to `res`
+static void add_cpu(const struct rusage* ru, struct bench_result* res) {
+    res->cpu_user += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    res->cpu_sys += ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+// Function to run one transfer on loopback and collect its measurements
+void run_once(const struct bench_run* run, struct bench_result* res) {
+    static const char* received[] = { "", "received_file_sw.txt", "received_file_gbn.txt", "received_file_sr.txt" };
+    char window[16], batch[16], payload[24], streams[16], crc[4], fec[32], codec[16], request[128], line[LINE_SIZE], model[LINE_SIZE];
+    char* server_argv[MAX_ARGS];
+    char* client_argv[MAX_ARGS];
+    struct rusage ru;
+    int n = 0, client_in;
+
+    memset(res, 0, sizeof(*res));
+    snprintf(window, sizeof(window), "%d", run->window);
+    snprintf(batch, sizeof(batch), "%d", batch_size);
+    snprintf(payload, sizeof(payload), "%ld", run->payload);
+    snprintf(streams, sizeof(streams), "%d", run->streams);
+    snprintf(crc, sizeof(crc), "%d", run->crc);
+    snprintf(fec, sizeof(fec), "%s", run->fec);
+    snprintf(codec, sizeof(codec), "%s", run->codec);
+    snprintf(model, sizeof(model), "%s", run->model);
+    if (run->protocol >= 1 && run->protocol <= 3) {
+        unlink(received[run->protocol]);
+    }
+
+    // Server: window ceiling, batch size and loss model options
+    server_argv[n++] = server_bin;
+    server_argv[n++] = "-w";
+    server_argv[n++] = window;
+    if (batch_size > 0) {
+        server_argv[n++] = "-b";
+        server_argv[n++] = batch;
+    }
+    for (char* a = strtok(model, " "); a && n < MAX_ARGS - 1; a = strtok(NULL, " ")) {
+        server_argv[n++] = a;
+    }
+    server_argv[n] = NULL;
+    pid_t server = spawn(server_argv, "server.log", NULL);
+    usleep(STARTUP_US);
+
+    // Client: requested payload, streams, checksum mode, FEC, codec and batch size, then one transfer followed by exit
+    n = 0;
+    client_argv[n++] = client_bin;
+    client_argv[n++] = "-s";
+    client_argv[n++] = payload;
+    client_argv[n++] = "-n";
+    client_argv[n++] = streams;
+    client_argv[n++] = "-c";
+    client_argv[n++] = crc;
+    client_argv[n++] = "-F";
+    client_argv[n++] = fec;
+    client_argv[n++] = "-z";
+    client_argv[n++] = codec;
+    if (batch_size > 0) {
+        client_argv[n++] = "-b";
+        client_argv[n++] = batch;
+    }
+    client_argv[n++] = "127.0.0.1";
+    client_argv[n] = NULL;
+    pid_t client = spawn(client_argv, "client.log", &client_in);
+    int len = snprintf(request, sizeof(request), "%d bench_%lld.bin %g\nexit\n", run->protocol, run->file_size, run->loss);
+    if (write(client_in, request, len) != len) {
+        perror("Bench: Write client input");
+    }
+    close(client_in);
+
+    // Wait for client to finish transfer and stop server
+    int client_status = wait_child(client, now_us() + run_timeout * 1000000LL, &ru);
+    if (client_status == -1) {
+        fprintf(stderr, "Bench: Run timed out\n");
+        kill(client, SIGKILL);
+        wait4(client, NULL, 0, &ru);
+    }
+    add_cpu(&ru, res);
+    if (wait_child(server, now_us() + SHUTDOWN_US, &ru) == -1) {
+        kill(server, SIGKILL);
+        wait4(server, NULL, 0, &ru);
+    }
+    add_cpu(&ru, res);
+
+    // Client log: agreed payload, transfer time, digest check and syscalls
+    long long transfer_us = 0;
+    int digest_bad = 0;
+    FILE* log = fopen("client.log", "r");
+    while (log && fgets(line, sizeof(line), log)) {
+        long int frames, agreed;
+        if (sscanf(line, "SERVER: Total number of frames to be transmitted: %ld frames of %ld bytes", &frames, &agreed) == 2) {
+            res->payload = agreed;
+        }
+        sscanf(line, "Transfer time: %lld us", &transfer_us);
+        if (strncmp(line, "Digest MISMATCH", 15) == 0) {
+            digest_bad = 1;
+        }
+        add_syscalls(line, res);
+    }
+    if (log) {
+        fclose(log);
+    }
+
+    // Server log: frames, retransmissions (one summary per stream) and syscalls
+    log = fopen("server.log", "r");
+    while (log && fgets(line, sizeof(line), log)) {
+        long int count;
+        if (sscanf(line, "Total frames attempted to be sent: %ld", &count) == 1) {
+            res->frames += count;
+        }
+        if (sscanf(line, "Total frames resent: %ld", &count) == 1) {
+            res->resent += count;
+        }
+        add_syscalls(line, res);
+    }
+    if (log) {
+        fclose(log);
+    }
+
+    res->seconds = transfer_us / 1e6;
+    if (client_status != -1 && transfer_us > 0 && run->protocol >= 1 && run->protocol <= 3) {
+        char source[64];
+        snprintf(source, sizeof(source), "bench_%lld.bin", run->file_size);
+        res->ok = !digest_bad && same_file(source, received[run->protocol]);
+        unlink(received[run->protocol]);
+    }
+}
+
+// Function to print output preamble (CSV header or start of JSON array)
+void print_header(int json) {
+    if (json) {
+        printf("[");
+    } else {
+        printf("protocol,file_bytes,payload,window,streams,crc,fec,codec,loss_pct,model,rep,ok,time_s,goodput_MBps,frames,resent,retx_ratio,syscalls,syscalls_per_MB,cpu_user_s,cpu_sys_s\n");
+    }
+    fflush(stdout);
+}
+
+// Function to print one run as a CSV row or JSON object
+void print_result(int json, int first, const struct bench_run* run, const struct bench_result* res) {
+    double mb = run->file_size / 1e6;
+    double goodput = res->ok && res->seconds > 0 ? mb / res->seconds : 0;
+    double retx = res->frames ? (double)res->resent / res->frames : 0;
+    double per_mb = mb > 0 ? res->syscalls / mb : 0;
+
+    if (json) {
+        printf("%s\n  {\"protocol\": %d, \"file_bytes\": %lld, \"payload\": %ld, \"window\": %d, \"streams\": %d, \"crc\": %d, \"fec\": \"%s\", \"codec\": \"%s\", \"loss_pct\": %g, \"model\": \"%s\", "
+            "\"rep\": %d, \"ok\": %s, \"time_s\": %.6f, \"goodput_MBps\": %.3f, \"frames\": %ld, \"resent\": %ld, "
+            "\"retx_ratio\": %.6f, \"syscalls\": %lld, \"syscalls_per_MB\": %.1f, \"cpu_user_s\": %.3f, \"cpu_sys_s\": %.3f}",
+            first ? "" : ",", run->protocol, run->file_size, res->payload, run->window, run->streams, run->crc, run->fec, run->codec, run->loss, run->model,
+            run->rep, res->ok ? "true" : "false", res->seconds, goodput, res->frames, res->resent,
+            retx, res->syscalls, per_mb, res->cpu_user, res->cpu_sys);
+    } else {
+        printf("%d,%lld,%ld,%d,%d,%d,\"%s\",%s,%g,\"%s\",%d,%d,%.6f,%.3f,%ld,%ld,%.6f,%lld,%.1f,%.3f,%.3f\n",
+            run->protocol, run->file_size, res->payload, run->window, run->streams, run->crc, run->fec, run->codec, run->loss, run->model,
+            run->rep, res->ok, res->seconds, goodput, res->frames, res->resent,
+            retx, res->syscalls, per_mb, res->cpu_user, res->cpu_sys);
+    }
+    fflush(stdout);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // sendmmsg/recvmmsg
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -12,37 +13,881 @@
 #include <string.h>
 #include <stdarg.h>
 #include <dirent.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "rto.h"
+#include "batch_io.h"
+#include "ack.h"
+#include "metrics.h"
+#include "disk_writer.h"
+#include "crc32c.h"
+#include "fec.h"
+#include "compress.h"
+#include "impair.h"
+#include "wire.h"
+#include "timer_wheel.h"
+#include "bundle.h"
 
-#define BUF_SIZE 4096   // Maximum buffer size for data in a frame
+#define DEFAULT_MTU 1500 // Assumed path MTU when it cannot be discovered
+#define UDP_IP_OVERHEAD 28 // IPv4 (20) plus UDP (8) header bytes
+#define SOCKET_BUF_SIZE (4 * 1024 * 1024) // Requested socket receive buffer size
 #define SERVER_PORT 2226 // Fixed server port number
+#define ACK_EVERY 2 // Default: acknowledge every 2nd in-order frame
+#define ACK_DELAY_US 500 // Default: longest a pending ACK is held back (us)
+#define CLIENT_RTO_FACTOR 2 // Client waits this many RTOs so server's own retransmission normally arrives first
+#define DIGEST_CHUNK (1 << 20) // Bytes read at a time when checking a digest
+#define MCAST_RETRY_LIMIT 10 // Multicast receiver gives up after this many timeouts in a row
+#define MCAST_DONE_COPIES 3 // Multicast receiver's final NACK is sent this many times, as nothing answers it
 long int total_frame = 0; // Total number of frames to receive
+static int frame_checksum; // 1 = current transfer's frames carry CRC32C (agreed in reply)
 
-// Structure for data packets
-struct frame_packet {
-    long int ID;          // Frame identifier (sequence number)
-    long int length;      // Length of data in frame
-    char data[BUF_SIZE];  // Actual data content
+// Server's digest of one stream's frames, checked against file once they are on disk
+struct slice_digest {
+    long int first; // First frame of stream
+    long int last; // Last frame of stream
+    int valid; // 1 once stream's last frame, which carries digest, arrived
+    unsigned int crc; // CRC32C of data of frames first..last
 };
 
+static const char* trace_path; // Trace dump file, NULL = tracing off
+static long long disk_calls, disk_frames; // Write syscalls made and frames written by finished disk writers
+
 // Function to handle errors
 static void print_error(char* msg) {
     perror(msg);  // Print error message
     exit(EXIT_FAILURE);  // Exit program with failure status
 }
 
+// Function to set socket receive timeout (us), skipping the syscall when it is unchanged. An io_uring receive batch
+// keeps its own copy, as the kernel does not apply SO_RCVTIMEO to its receives.
+static void set_recv_timeout(int s, struct batch_io* rx, long long us, long long* current) {
+    rx->timeout = us;
+    if (us == *current) {
+        return;
+    }
+    struct timeval t_out = { us / 1000000, us % 1000000 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&t_out, sizeof(struct timeval)); // Sets option specified by SO_RCVTIMEO at level SOL_SOCKET to value of t_out
+    *current = us;
+}
+
+// Function to pick a payload size that fits path MTU to server, so frames are never IP fragmented
+static long int discover_payload(struct sockaddr_in* server) {
+    int mtu = DEFAULT_MTU;
+    socklen_t mtu_len = sizeof(mtu);
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+
+    // Connected UDP socket reports kernel's path MTU for that route
+    if (probe != -1 && connect(probe, (struct sockaddr*)server, sizeof(*server)) == 0) {
+        if (getsockopt(probe, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) == -1) {
+            mtu = DEFAULT_MTU;
+        }
+    }
+    if (probe != -1) {
+        close(probe);
+    }
+
+    long int payload = mtu - UDP_IP_OVERHEAD - (long int)FRAME_HEADER_SIZE;
+    return payload > MAX_PAYLOAD ? MAX_PAYLOAD : payload;
+}
+
+// Function to receive next well-formed frame (header plus exactly `length` bytes, and a matching checksum
+// when checksums are on), -1 on timeout or error. Its frame number is widened next to `ref`, the frame
+// caller expects next. A corrupt frame is dropped, so it is recovered like a lost one.
+// A packed frame is unpacked with `codec`, so callers only see file data.
+static ssize_t recv_frame(int s, struct batch_io* rx, struct frame_packet* frame, long int ref, struct sockaddr_in* from,
+    socklen_t* length, struct codec_state* codec) {
+    for (;;) {
+        ssize_t n = batch_recv(s, rx, frame->header, FRAME_HEADER_SIZE + MAX_PAYLOAD, from, length);
+        if (n == -1) {
+            return -1;
+        }
+        if (!frame_decode(frame, n, ref)) {
+            VLOG("Ignoring malformed datagram of %zd bytes\n", n);
+            continue;
+        }
+        if (frame_checksum && !frame_crc_ok(frame)) {
+            metric_add(&metrics.corrupt, 1);
+            VLOG("Dropping frame #%ld with bad checksum\n", frame->ID);
+            continue;
+        }
+        if (frame->flags & FRAME_PACKED) {
+            long int unpacked = codec->codec != CODEC_NONE ? codec_unpack(codec, frame->data, frame->length) : -1;
+            if (unpacked == -1) {
+                metric_add(&metrics.corrupt, 1);
+                VLOG("Dropping frame #%ld that does not unpack\n", frame->ID);
+                continue;
+            }
+            memcpy(frame->data, codec->buf, unpacked);
+            frame->length = unpacked;
+            metric_add(&metrics.packed, 1);
+        }
+        return n;
+    }
+}
+
+// Function to receive server's reply to request `request_id`, skipping late frames of a previous transfer and replies
+// to earlier requests. A refused request is reported here and comes back with no frames to receive. Read through
+// receive batch `rx`, since with io_uring its armed receive takes every datagram off the socket.
+static int recv_reply(int s, struct batch_io* rx, struct transfer_reply* reply, struct sockaddr_in* from, socklen_t* length,
+    unsigned int request_id) {
+    static const char* const refusals[] = { "", "file not found or not readable", "server busy", "request not understood",
+        "server speaks another wire version", "too many files or bytes for one bundle" };
+    unsigned char buf[REPLY_SIZE(MAX_STREAMS)];
+    for (;;) {
+        ssize_t n = batch_recv(s, rx, buf, sizeof(buf), from, length); // A longer datagram is cut short and fails parse
+        if (n == -1) {
+            return -1;
+        }
+        if (reply_parse(buf, n, reply) && (reply->request_id == request_id || reply->version != WIRE_VERSION)) {
+            break; // A server of another version cannot echo request's number
+        }
+        VLOG("Ignoring %zd byte datagram while waiting for reply\n", n);
+    }
+    if (reply->status != REPLY_OK) {
+        printf("SERVER: Request refused: %s", reply->status <= REPLY_TOO_BIG ? refusals[reply->status] : "unknown reason");
+        printf(reply->status == REPLY_VERSION ? " (server version %d, client version %d)\n" : "\n", reply->version, WIRE_VERSION);
+        reply->total_frame = 0;
+    }
+    return 0;
+}
+
+// Function to keep digest carried by a stream's last frame
+static void note_digest(const struct frame_packet* frame, struct slice_digest* d) {
+    if (frame_checksum && (frame->flags & FRAME_DIGEST) && frame->ID == d->last) {
+        d->crc = frame->digest;
+        d->valid = 1;
+    }
+}
+
+// Function to count and trace a received frame
+static void note_frame(const struct frame_packet* frame) {
+    metric_add(&metrics.frames_received, 1);
+    metric_add(&metrics.bytes_received, frame->length);
+    trace_event(TR_FRAME_RX, 0, frame->ID, frame->length);
+    VLOG("Received frame #%ld\n", frame->ID);
+}
+
+// Function to fold an RTT measurement into estimator and RTT histogram
+static void note_rtt(struct rto_estimator* rto, long long rtt) {
+    rto_sample(rto, rtt);
+    hist_add(&metrics.rtt, rtt);
+    trace_event(TR_RTT, 0, 0, rtt);
+}
+
+// Function to count a receive timeout
+static void note_timeout(long int base) {
+    metric_add(&metrics.timeouts, 1);
+    trace_event(TR_TIMEOUT, 0, base, 0);
+    VLOG("Client: Receive frame timed out\n");
+}
+
+// Counters at start of a transfer, so its own share can be reported
+struct transfer_stats {
+    long long frames; // Frames received
+    long long duplicates; // Frames received more than once
+    long long acks; // ACKs sent
+    long long timeouts; // Receive timeouts
+    long long parity; // FEC parity frames received
+    long long rebuilt; // Lost frames rebuilt from parity
+    long long packed; // Frames that arrived packed
+};
+
+// Function to snapshot process counters
+static void stats_snapshot(struct transfer_stats* st) {
+    st->frames = metric_get(&metrics.frames_received);
+    st->duplicates = metric_get(&metrics.duplicates);
+    st->acks = metric_get(&metrics.acks_sent);
+    st->timeouts = metric_get(&metrics.timeouts);
+    st->parity = metric_get(&metrics.parity);
+    st->rebuilt = metric_get(&metrics.rebuilt);
+    st->packed = metric_get(&metrics.packed);
+}
+
+// Function to wait for a disk writer's frames to reach file and add up its writes, returns end of furthest frame
+static long writer_done(struct disk_writer* w) {
+    long end = disk_writer_close(w);
+    disk_calls += w->calls;
+    disk_frames += w->frames;
+    return end;
+}
+
+// Function to print one transfer's statistics and add it to transfer histogram
+static void transfer_done(const struct transfer_stats* start, long long elapsed, long bytes) {
+    struct transfer_stats now;
+    stats_snapshot(&now);
+    metric_add(&metrics.sessions, 1);
+    hist_add(&metrics.transfer, elapsed);
+    printf("Transfer time: %lld us\n", elapsed);
+    printf("Transfer: %ld bytes written, %lld frames received (%lld duplicates), %lld ACKs sent, %lld timeouts, goodput %.2f MB/s\n",
+        bytes, now.frames - start->frames, now.duplicates - start->duplicates, now.acks - start->acks,
+        now.timeouts - start->timeouts, elapsed > 0 ? (double)bytes / elapsed : 0);
+    if (now.parity > start->parity) {
+        printf("FEC: %lld parity frames received, %lld lost frames rebuilt\n", now.parity - start->parity, now.rebuilt - start->rebuilt);
+    }
+    if (now.packed > start->packed) {
+        printf("Compression: %lld of %lld frames arrived packed\n", now.packed - start->packed, now.frames - start->frames);
+    }
+}
+
+// Receive window: tracks which frames past a gap have arrived (their data is already queued for writing)
+struct receiver {
+    long int base; // First frame not yet received
+    long int total_frame; // Last frame to receive (total frames in transfer unless receiving one stream)
+    int window; // Frames that can be accepted from base onward
+    char* have; // 1 if frame (index frame % window) has arrived
+    struct fec_decoder* fec; // Rebuilds lost frames from parity, NULL = FEC off
+};
+
+// Function to allocate an empty receive window for frames [first, last]
+static void receiver_init(struct receiver* r, long int first, long int last, int window) {
+    r->base = first;
+    r->total_frame = last;
+    r->window = window;
+    r->have = calloc(window, sizeof(char));
+    r->fec = NULL;
+    if (!r->have) {
+        print_error("Memory allocation failed for receive window");
+    }
+}
+
+// Function to release receive window
+static void receiver_free(struct receiver* r) {
+    free(r->have);
+}
+
+// Function to accept frame `id` of `len` bytes: queued for writing at its own offset, in order or not.
+// Returns 1 for a new frame, 0 for a duplicate and -1 for a frame outside window or with writer's queue full.
+static int receiver_accept(struct receiver* r, long int id, const char* data, long int len, struct disk_writer* w) {
+    if (id < r->base) {
+        metric_add(&metrics.duplicates, 1);
+        return 0; // Already received, our earlier ACK was lost
+    }
+    if (id >= r->base + r->window || id > r->total_frame) {
+        return -1;
+    }
+    int slot = id % r->window;
+    if (r->have[slot]) {
+        metric_add(&metrics.duplicates, 1);
+        return 0;
+    }
+    if (!disk_writer_submit(w, id, data, len)) {
+        metric_add(&metrics.write_queue_full, 1);
+        return -1; // Never wait on disk: leave frame unacknowledged, server resends it
+    }
+    trace_event(TR_WRITE, 0, id, len);
+    VLOG("Writing %ld bytes of data for frame ID: %ld\n", len, id);
+    r->have[slot] = 1;
+
+    // Slide base over every frame that has now arrived
+    while (r->base <= r->total_frame && r->have[r->base % r->window]) {
+        r->have[r->base % r->window] = 0;
+        r->base++;
+    }
+    return 1;
+}
+
+// Function to accept frames of block `b` (NULL = none) that its parity rebuilds, returns how many were accepted
+static int receiver_rebuild(struct receiver* r, struct fec_block* b, struct disk_writer* w) {
+    int rebuilt[FEC_MAX_PARITY];
+    int n = b ? fec_rebuild(r->fec, b, rebuilt) : 0;
+    int accepted = 0;
+    for (int i = 0; i < n; i++) {
+        long int id = b->first + rebuilt[i];
+        long int len = fec_frame_len(r->fec, id);
+        if (receiver_accept(r, id, (const char*)fec_slot_buf(r->fec, b, rebuilt[i]), len, w) == 1) {
+            metric_add(&metrics.rebuilt, 1);
+            trace_event(TR_REBUILD, 0, id, len);
+            VLOG("Rebuilt frame #%ld from parity\n", id);
+            accepted++;
+        }
+    }
+    return accepted;
+}
+
+// Function to queue an ACK: cumulative ACK, frame that triggered it, and SACK ranges of frames received past gap in `r` (may be NULL)
+static void send_ack(int s, struct batch_io* tx, struct sockaddr_in* to, long int cum_ack, long int trigger, const struct receiver* r) {
+    struct ack_packet ack;
+    ack.magic = ACK_MAGIC;
+    ack.n_blocks = 0;
+    ack.cum_ack = cum_ack;
+    ack.trigger = trigger;
+    ack.fec_shares = r && r->fec ? r->fec->shares : 0;
+    ack.fec_lost = r && r->fec ? r->fec->lost : 0;
+
+    // Report runs of received frames above gap
+    if (r) {
+        long int last = r->base + r->window - 1;
+        for (long int i = r->base + 1; i <= last && ack.n_blocks < SACK_BLOCKS; i++) {
+            if (!r->have[i % r->window]) {
+                continue;
+            }
+            long int start = i;
+            while (i + 1 <= last && r->have[(i + 1) % r->window]) {
+                i++;
+            }
+            ack.sack[ack.n_blocks][0] = start;
+            ack.sack[ack.n_blocks][1] = i;
+            ack.n_blocks++;
+        }
+    }
+
+    unsigned char buf[ACK_SIZE(SACK_BLOCKS)];
+    if (batch_send(s, tx, buf, ack_encode(&ack, buf), to) == -1) {
+        perror("Client: Send ACK failed");
+    } else {
+        metric_add(&metrics.acks_sent, 1);
+        trace_event(TR_ACK_TX, 0, cum_ack, ack.n_blocks);
+        VLOG("Sent ACK for frame #%ld (%d SACK ranges)\n", cum_ack, ack.n_blocks);
+    }
+}
+
+// Function to get how long client waits for a frame before resending its last ACK
+static long long client_timeout(const struct rto_estimator* rto) {
+    long long us = CLIENT_RTO_FACTOR * rto_current(rto);
+    return us > RTO_MAX_US ? RTO_MAX_US : us;
+}
+
+// Function to open output file for a transfer of `source`: file and resume map left by an interrupted
+// transfer of same file are reused, otherwise both start afresh. Returns file descriptor.
+static int open_output(const char* out_name, const char* part_name, const char* source, struct resume_map* map, const struct transfer_reply* reply) {
+    if (map->fd != -1 && map->total_frame == reply->total_frame && map->payload_size == reply->payload_size
+        && (map->tag == 0 || map->tag == reply->file_tag)) {
+        int fd = open(out_name, O_WRONLY);
+        if (fd != -1) {
+            return fd;
+        }
+    }
+    if (map->fd != -1) {
+        printf("Partial copy of %s does not match server's file, starting over\n", source);
+        resume_discard(map);
+    }
+    if (resume_create(map, part_name, source, reply->total_frame, reply->payload_size, reply->file_tag) == -1) {
+        perror("Client: Create resume map"); // Transfer still works, it just cannot be resumed
+    }
+    int fd = disk_file_create(out_name, reply->total_frame, reply->payload_size);
+    if (fd == -1) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+// Function to read frames [first, last] back from output file and compare them with server's digest of them.
+// On a mismatch they are marked missing again, so the next request fetches them anew.
+static int check_digest(const char* out_name, struct resume_map* map, const struct slice_digest* d) {
+    off_t pos = (off_t)(d->first - 1) * map->payload_size;
+    off_t end = d->last == map->total_frame ? atomic_load(&map->end) : (off_t)d->last * map->payload_size;
+    unsigned int crc = 0;
+    char* buf = malloc(DIGEST_CHUNK);
+    int fd = open(out_name, O_RDONLY);
+    ssize_t n = 0;
+    if (!buf || fd == -1) {
+        perror("Client: Read back output file");
+        free(buf);
+        return 0;
+    }
+    posix_fadvise(fd, pos, end - pos, POSIX_FADV_SEQUENTIAL);
+    while (pos < end && (n = pread(fd, buf, end - pos < DIGEST_CHUNK ? end - pos : DIGEST_CHUNK, pos)) > 0) {
+        crc = crc32c(crc, buf, n);
+        pos += n;
+    }
+    free(buf);
+    close(fd);
+    if (pos == end && crc == d->crc) {
+        return 1;
+    }
+    printf("Digest MISMATCH for frames %ld-%ld: file has CRC32C %08x, server sent %08x; they will be fetched again\n",
+        d->first, d->last, crc, d->crc);
+    for (long int id = d->first; id <= d->last; id++) {
+        resume_clear(map, id);
+    }
+    return 0;
+}
+
+// Function to finish output file after a transfer. Streams whose frames are all on disk are checked against
+// server's digests. A complete file is then trimmed to size and its resume map removed; an incomplete one keeps its
+// preallocated length and map. A complete bundle is extracted into `bundle_dir` (NULL = output is a plain file).
+// Returns 1 if frames in [from, to] (0 = first / last frame) are still missing and this transfer added some, so
+// fetching them again can make progress.
+static int finish_output(int fd, struct resume_map* map, const char* out_name, const char* part_name, const char* source,
+    const struct slice_digest* digests, int n_digests, long int had, off_t written, long int from, long int to, const char* bundle_dir) {
+    if (map->fd == -1) {
+        disk_file_finish(fd, written);
+        if (bundle_dir) {
+            bundle_extract(out_name, bundle_dir); // No resume map to say whether every frame arrived: manifest is checked
+        }
+        return 0;
+    }
+    int checked = 0, good = 0;
+    long int first, last;
+    for (int k = 0; k < n_digests; k++) {
+        if (digests[k].valid && !resume_next_gap(map, digests[k].first, digests[k].last, &first, &last)) {
+            checked++;
+            good += check_digest(out_name, map, &digests[k]);
+        }
+    }
+    if (checked && good == checked) {
+        printf("Digest OK for frames %ld-%ld\n", digests[0].first, digests[n_digests - 1].last);
+    }
+    long int have = atomic_load(&map->have);
+    if (resume_complete(map)) {
+        disk_file_finish(fd, atomic_load(&map->end));
+        resume_close(map, part_name);
+        if (bundle_dir) {
+            bundle_extract(out_name, bundle_dir);
+        }
+        return 0;
+    }
+    int missing = resume_next_gap(map, from > 0 ? from : 1, to > 0 && to < map->total_frame ? to : map->total_frame, &first, &last);
+    close(fd); // Missing frames are written in place by a later transfer
+    printf("Incomplete: %ld of %ld frames of %s on disk, request it again to resume\n", have, map->total_frame, source);
+    resume_close(map, part_name);
+    return missing && have > had;
+}
+
+// One Go-Back-N or Selective Repeat receive stream (the whole file, or one slice of a parallel transfer)
+struct stream {
+    int s; // Socket frames arrive on
+    struct sockaddr_in to; // Where ACKs go
+    struct batch_io* rx; // Frames drained with one recvmmsg
+    struct batch_io* tx; // ACKs queued for one sendmmsg
+    struct rto_estimator rto; // Adaptive receive timeout
+    long long cur_timeout; // Receive timeout currently set on socket (us)
+    struct disk_writer* writer; // Writes this stream's frames
+    int go_back_n; // 1 = Go-Back-N, 0 = Selective Repeat
+    int window; // Agreed window: frames accepted past a gap
+    long int first; // First frame of stream
+    long int last; // Last frame of stream
+    int ack_every; // In-order frames per ACK
+    long long ack_delay; // Longest a pending ACK is held back (us)
+    int announce; // 1 = send an ACK first so server learns this socket's address
+    struct slice_digest digest; // Server's digest of stream's frames
+    int fec_k; // FEC data frames per block, 0 = off
+    long int total_frame; // Frames in file
+    long long file_size; // File size in bytes
+    int codec; // Codec frames may be packed with
+    int ns; // Multicast: socket NACKs are sent from (frames arrive on s, which may be the group's socket)
+    double drop; // Multicast: share of frames receiver drops itself (simulated loss on its own link)
+    struct resume_map* map; // Multicast: frames already on disk, never asked for (NULL = none)
+};
+
+// Function to receive frames [first, last] of a stream, acknowledging them as they arrive
+static void receive_stream(struct stream* st) {
+    struct frame_packet* frame = malloc(sizeof(*frame)); // Too large for a thread's stack
+    struct sockaddr_in from_addr;
+    socklen_t length = sizeof(from_addr);
+    long long ack_sent_at = 0; // Time last in-order ACK was sent (us), 0 = no sample pending
+    if (!frame) {
+        print_error("Memory allocation failed for frame");
+    }
+
+    // Frames past a gap are accepted up to window agreed in handshake, and with FEC at least a whole block
+    struct receiver r;
+    struct fec_decoder fec;
+    receiver_init(&r, st->first, st->last, st->window > st->fec_k ? st->window : st->fec_k);
+    if (st->fec_k) {
+        if (fec_decoder_init(&fec, st->fec_k, st->first, st->last, st->total_frame, st->writer->payload_size, st->file_size, r.window) == -1) {
+            print_error("Memory allocation failed for FEC");
+        }
+        r.fec = &fec;
+    }
+    struct codec_state codec;
+    if (codec_init(&codec, st->codec, st->writer->payload_size, 0) == -1) {
+        print_error("Memory allocation failed for codec");
+    }
+    int unacked = 0; // In-order frames not yet acknowledged
+    long int trigger = st->first - 1; // Last frame received
+    st->digest.first = st->first;
+    st->digest.last = st->last;
+
+    // Delayed ACK and keepalive timers. Keepalive runs from the last frame's arrival but is not moved on every
+    // frame: when it runs out early it is armed again from `heard_at`.
+    struct timer_wheel wheel;
+    struct timer ack_timer; // Armed while an ACK is held back
+    struct timer keepalive; // Runs out after a timeout without frames: last ACK is repeated
+    long long heard_at = now_us(); // Time last frame arrived (us)
+    wheel_init(&wheel, heard_at);
+    timer_init(&ack_timer, 0, st, 0);
+    timer_init(&keepalive, 0, st, 0);
+    wheel_arm(&wheel, &keepalive, heard_at + client_timeout(&st->rto));
+
+    if (st->announce) {
+        send_ack(st->s, st->tx, &st->to, r.base - 1, trigger, NULL); // Server starts stream on this ACK
+    }
+
+    while (r.base <= st->last) {
+        if (!st->announce) {
+            metrics_poll_dump("Client", trace_path);
+        }
+        long long wait = client_timeout(&st->rto);
+
+        // Fire timers that ran out and send queued ACKs before waiting for more frames
+        if (!batch_pending(st->rx)) {
+            long long now = now_us();
+            struct timer* tm;
+            while ((tm = wheel_expire(&wheel, now))) {
+                if (tm == &keepalive) {
+                    if (now - heard_at < client_timeout(&st->rto)) {
+                        wheel_arm(&wheel, &keepalive, heard_at + client_timeout(&st->rto)); // Frames came meanwhile
+                        continue;
+                    }
+                    note_timeout(r.base);
+                    rto_backoff(&st->rto);
+                    ack_sent_at = 0;
+                    heard_at = now;
+                    wheel_arm(&wheel, &keepalive, now + client_timeout(&st->rto));
+
+                    // Timeout occurred, repeat ACK in case it was lost (also repeats a lost start ACK)
+                    VLOG("Resending ACK for frame #%ld due to timeout\n", r.base - 1);
+                }
+                send_ack(st->s, st->tx, &st->to, r.base - 1, trigger, &r); // Held-back ACK is due, or repeated one
+                unacked = 0;
+                wheel_cancel(&wheel, &ack_timer);
+            }
+            batch_flush(st->s, st->tx);
+            if (timer_armed(&ack_timer)) {
+                wait = wheel_next(&wheel) - now; // Wake up for delayed ACK
+            }
+        }
+
+        // Receive frame from server; a timeout is handled by timers at top of loop
+        set_recv_timeout(st->s, st->rx, wait > 0 ? wait : 1, &st->cur_timeout);
+        if (recv_frame(st->s, st->rx, frame, r.base, &from_addr, &length, &codec) == -1) {
+            continue;
+        }
+        heard_at = now_us();
+
+        long int expected = r.base;
+        int in_order;
+        int fresh = 1; // Frame is further along than any before it, so not a retransmission
+        if (frame->flags & FRAME_PARITY) {
+            // Parity frame: report at once if it rebuilt lost frames, or if its block is still short of frames
+            int row = frame->fec & 0xff, rows = frame->fec >> 8 & 0xff;
+            metric_add(&metrics.parity, 1);
+            trace_event(TR_PARITY, 0, frame->ID, row);
+            VLOG("Received parity frame %d of %d for block at frame #%ld\n", row, rows, frame->ID);
+            if (!r.fec || (!receiver_rebuild(&r, fec_add_parity(r.fec, frame->ID, row, rows, frame->data, frame->length), st->writer)
+                    && r.fec->highest < r.base)) {
+                continue;
+            }
+            in_order = 0;
+        } else {
+            note_frame(frame);
+            note_digest(frame, &st->digest);
+            if (ack_sent_at && frame->ID == r.base) {
+                note_rtt(&st->rto, now_us() - ack_sent_at);
+            }
+            fresh = !r.fec || frame->ID > r.fec->highest;
+            int accepted = receiver_accept(&r, frame->ID, frame->data, frame->length, st->writer);
+            if (accepted == 1 && r.fec) {
+                receiver_rebuild(&r, fec_add_data(r.fec, frame->ID, frame->data, frame->length), st->writer);
+            }
+            trigger = frame->ID;
+            in_order = accepted == 1 && frame->ID == expected && r.base == expected + 1;
+        }
+
+        // With FEC a gap that its block's parity may still fill is not reported yet, so it causes no duplicate ACKs;
+        // a retransmitted frame is always answered, or a lost parity frame would leave server waiting forever
+        if (r.fec && fresh && fec_pending(r.fec, r.base)) {
+            continue;
+        }
+
+        // ACK policy: at once on a gap, duplicate or filled hole, otherwise every `ack_every` frames or after `ack_delay`
+        if (in_order) {
+            unacked++;
+        }
+        if (!in_order || unacked >= st->ack_every || st->ack_delay == 0) {
+            if (!in_order) {
+                VLOG("Out of order or duplicate frame, sending ACK for #%ld\n", r.base - 1);
+            }
+            send_ack(st->s, st->tx, &st->to, r.base - 1, trigger, &r);
+            ack_sent_at = heard_at;
+            unacked = 0;
+            wheel_cancel(&wheel, &ack_timer);
+        } else if (!timer_armed(&ack_timer)) {
+            wheel_arm(&wheel, &ack_timer, heard_at + st->ack_delay);
+        }
+    }
+
+    send_ack(st->s, st->tx, &st->to, r.base - 1, trigger, &r); // Final ACK
+    batch_flush(st->s, st->tx);
+    if (r.fec) {
+        fec_decoder_free(&fec);
+    }
+    codec_free(&codec, 0);
+    receiver_free(&r);
+    free(frame);
+}
+
+// Function to run one stream of a parallel transfer on its own thread
+static void* stream_thread(void* arg) {
+    receive_stream(arg);
+    return NULL;
+}
+
+// Function to queue a NACK listing up to NACK_RANGES gaps in `have` from *from up to `to`; *from moves past what was
+// listed, so the next NACK goes on from there. Returns ranges listed (a NACK with none is only sent when `flags` are set).
+static int send_nack(struct stream* st, const char* have, long int have_count, long int* from, long int to, int flags) {
+    struct nack_packet nack;
+    nack.magic = NACK_MAGIC;
+    nack.n_ranges = 0;
+    nack.flags = flags;
+    nack.have = have_count;
+    long int id = *from;
+    while (id <= to && nack.n_ranges < NACK_RANGES) {
+        if (have[id]) {
+            id++;
+            continue;
+        }
+        long int start = id;
+        while (id + 1 <= to && !have[id + 1]) {
+            id++;
+        }
+        nack.range[nack.n_ranges][0] = start;
+        nack.range[nack.n_ranges][1] = id;
+        nack.n_ranges++;
+        id++;
+    }
+    *from = id;
+    if (nack.n_ranges == 0 && !flags) {
+        return 0;
+    }
+    unsigned char buf[NACK_SIZE(NACK_RANGES)];
+    if (batch_send(st->ns, st->tx, buf, nack_encode(&nack, buf), &st->to) == -1) {
+        perror("Client: Send NACK failed");
+    } else {
+        metric_add(&metrics.acks_sent, 1);
+        trace_event(TR_ACK_TX, 0, have_count, nack.n_ranges);
+        VLOG("Sent NACK for %d ranges from frame #%ld\n", nack.n_ranges, nack.n_ranges ? nack.range[0][0] : 0);
+    }
+    return nack.n_ranges;
+}
+
+// Function to receive a whole file from a multicast transfer. Frames are taken in any order; gaps below the highest
+// frame seen are reported in NACKs at most once per ack_delay, and reported again once a timeout's worth of time passed
+// without their repair. When frames stop coming every gap up to the last frame is reported, which also finds a lost tail.
+static void receive_multicast(struct stream* st) {
+    struct frame_packet* frame = malloc(sizeof(*frame));
+    char* have = calloc(st->total_frame + 2, sizeof(char)); // Per frame: 1 once it is queued for writing
+    struct sockaddr_in from_addr;
+    socklen_t length = sizeof(from_addr);
+    struct codec_state codec;
+    if (!frame || !have || codec_init(&codec, st->codec, st->writer->payload_size, 0) == -1) {
+        print_error("Memory allocation failed for multicast");
+    }
+    long int got = 0; // Frames queued for writing (or already on disk)
+    for (long int id = 1; st->map && id <= st->total_frame; id++) {
+        if (resume_has(st->map, id)) {
+            have[id] = 1;
+            got++;
+        }
+    }
+
+    // Each receiver loses its own frames, as it would on its own link
+    struct impair loss;
+    struct impair_model model;
+    memset(&model, 0, sizeof(model));
+    model.loss = st->drop;
+    impair_init(&loss, &model, IMPAIR_DEFAULT_SEED, (unsigned long long)getpid());
+
+    long int low = 1; // No frame below this is missing
+    long int highest = 0; // Highest frame seen
+    long int nack_from = 1; // Gaps from here on were not reported this round
+    long long round_at = 0; // When current round of NACKs started (us)
+    long long nack_at = 0; // When last NACK was sent (us)
+    long long nack_probe_at = 0; // When a NACK asked for `nack_probe` (us), 0 = no RTT sample pending
+    long int nack_probe = 0; // First frame last NACK asked for; its repair gives an RTT sample
+    int timeouts = 0; // Timeouts in a row
+    int joined = 0; // 1 once first frame arrived
+    long long nacks = metric_get(&metrics.acks_sent);
+    st->digest.first = 1;
+    st->digest.last = st->total_frame;
+    while (low <= st->total_frame && have[low]) {
+        low++;
+    }
+
+    send_nack(st, have, got, &nack_from, 0, NACK_JOIN); // Server adds us to transfer on this
+    while (got < st->total_frame) {
+        metrics_poll_dump("Client", trace_path);
+        if (!batch_pending(st->rx)) {
+            long long now = now_us();
+            if (now - round_at >= client_timeout(&st->rto)) {
+                nack_from = low; // Repairs asked for last round had time to arrive, ask again for what is still missing
+                round_at = now;
+            }
+            if (joined && now - nack_at >= st->ack_delay && nack_from < highest) {
+                long int probe = nack_from;
+                if (send_nack(st, have, got, &nack_from, highest, 0)) {
+                    nack_at = now;
+                    if (!nack_probe_at) {
+                        nack_probe = probe;
+                        nack_probe_at = now;
+                    }
+                }
+            }
+            batch_flush(st->ns, st->tx);
+        }
+
+        set_recv_timeout(st->s, st->rx, client_timeout(&st->rto), &st->cur_timeout);
+        if (recv_frame(st->s, st->rx, frame, low, &from_addr, &length, &codec) == -1) {
+            if (joined) {
+                note_timeout(low); // Waiting out server's join window is not a loss
+            }
+            rto_backoff(&st->rto);
+            nack_probe_at = 0;
+            if (++timeouts >= MCAST_RETRY_LIMIT) {
+                printf("Multicast: nothing from server after %d timeouts, giving up\n", timeouts);
+                break;
+            }
+            // Nothing arriving: first pass is over or its tail was lost, so report every gap up to last frame
+            nack_from = low;
+            round_at = now_us();
+            nack_at = round_at;
+            send_nack(st, have, got, &nack_from, joined ? st->total_frame : 0, joined ? 0 : NACK_JOIN);
+            batch_flush(st->ns, st->tx);
+            continue;
+        }
+        timeouts = 0;
+        joined = 1;
+        if (impair_decide(&loss).copies == 0) {
+            VLOG("Frame #%ld dropped (simulated loss)\n", frame->ID);
+            continue;
+        }
+        long int id = frame->ID;
+        if ((frame->flags & FRAME_PARITY) || id < 1 || id > st->total_frame) {
+            continue; // Multicast sends no parity
+        }
+        note_frame(frame);
+        note_digest(frame, &st->digest);
+        if (nack_probe_at && id == nack_probe) {
+            note_rtt(&st->rto, now_us() - nack_probe_at);
+            nack_probe_at = 0;
+        }
+        if (have[id]) {
+            metric_add(&metrics.duplicates, 1);
+            continue;
+        }
+        if (!disk_writer_submit(st->writer, id, frame->data, frame->length)) {
+            metric_add(&metrics.write_queue_full, 1);
+            continue; // Reported as missing like a lost frame
+        }
+        trace_event(TR_WRITE, 0, id, frame->length);
+        have[id] = 1;
+        got++;
+        highest = id > highest ? id : highest;
+        while (low <= st->total_frame && have[low]) {
+            low++;
+        }
+        nack_from = nack_from < low ? low : nack_from;
+    }
+
+    // Server waits for every receiver to say it is done; nothing answers this, so send it a few times
+    for (int i = 0; got == st->total_frame && i < MCAST_DONE_COPIES; i++) {
+        long int none = st->total_frame + 1;
+        send_nack(st, have, got, &none, st->total_frame, NACK_DONE);
+    }
+    batch_flush(st->ns, st->tx);
+    printf("Multicast: %ld of %ld frames, %lld NACKs sent, %lld frames dropped by simulated loss\n", got, st->total_frame,
+        metric_get(&metrics.acks_sent) - nacks, loss.dropped);
+    codec_free(&codec, 0);
+    free(have);
+    free(frame);
+}
+
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Client: Usage: ./[%s] Hostname \n", argv[0]);
+    int batch_size = BATCH_MAX; // Datagrams per syscall (1 = one sendto/recvfrom per datagram)
+    int offload = 1; // 1 = let kernel coalesce received frames (UDP GRO) when it supports it
+    int uring_io = 0; // 1 = socket batches and file writes go through io_uring when kernel has it
+    long int payload_request = 0; // Payload size to ask server for (0 = fit path MTU)
+    int ack_every = ACK_EVERY; // In-order frames per ACK
+    long long ack_delay = ACK_DELAY_US; // Longest a pending ACK is held back (us)
+    int streams_request = 1; // Parallel streams to ask server for
+    int window_request = 0; // Window to ask server for (0 = server's default for protocol)
+    int checksum_request = 1; // 1 = ask for frame checksums and file digest
+    struct fec_config fec_request = { 0, 0, 1 }; // FEC block size, starting parity per block and adaptation to ask for (k = 0: off)
+    int codec_request = 0; // Codecs server may pack frames with (bit n = codec n, 0 = none)
+    int opt;
+
+    // Parse options
+    while ((opt = getopt(argc, argv, "b:O:I:s:a:d:n:W:c:F:z:vT:")) != -1) {
+        switch (opt) {
+        case 'b': // Batch size for sendmmsg/recvmmsg
+            batch_size = atoi(optarg);
+            break;
+        case 'O': // Receive offload on or off
+            offload = atoi(optarg);
+            break;
+        case 'I': // I/O engine
+            uring_io = strcmp(optarg, "uring") == 0 ? 1 : strcmp(optarg, "classic") == 0 ? 0 : -1;
+            break;
+        case 's': // Payload bytes per frame
+            payload_request = atol(optarg);
+            break;
+        case 'a': // ACK every N in-order frames
+            ack_every = atoi(optarg);
+            break;
+        case 'd': // Delayed ACK timeout
+            ack_delay = atoll(optarg);
+            break;
+        case 'n': // Parallel streams
+            streams_request = atoi(optarg);
+            break;
+        case 'W': // Window: frames in flight and accepted past a gap
+            window_request = atoi(optarg);
+            break;
+        case 'c': // Frame checksums and file digest on or off
+            checksum_request = atoi(optarg);
+            break;
+        case 'F': // FEC: data frames per block, parity frames per block, adapt to loss
+            sscanf(optarg, "%d,%d,%d", &fec_request.k, &fec_request.m, &fec_request.adapt);
+            break;
+        case 'z': { // Compression: one codec, or every codec this build has
+            int codec = codec_by_name(optarg);
+            if (strcmp(optarg, "auto") == 0) {
+                codec_request = codec_mask();
+            } else if (codec == -1 || !codec_available(codec)) {
+                printf("Client: Codec '%s' is not available in this build (have: none, lz%s%s, auto)\n", optarg,
+                    codec_available(CODEC_LZ4) ? ", lz4" : "", codec_available(CODEC_ZSTD) ? ", zstd" : "");
+                exit(EXIT_FAILURE);
+            } else {
+                codec_request = codec == CODEC_NONE ? 0 : 1 << codec;
+            }
+            break;
+        }
+        case 'v': // Print every frame event
+            log_verbose = 1;
+            break;
+        case 'T': // Record frame events for dumping
+            trace_path = optarg;
+            break;
+        default:
+            printf("Client: Usage: ./[%s] [-b batch_size] [-O 0|1] [-I classic|uring] [-s payload_size] [-a ack_every] [-d ack_delay_us] [-n streams] [-W window] [-c 0|1] [-F k,m[,adapt]] [-z codec] [-v] [-T trace_file] Hostname \n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1 || batch_size <= 0 || offload < 0 || offload > 1 || uring_io < 0 || payload_request < 0 || payload_request > MAX_PAYLOAD || ack_every <= 0 || ack_delay < 0
+        || streams_request < 1 || streams_request > MAX_STREAMS || window_request < 0 || checksum_request < 0 || checksum_request > 1
+        || (fec_request.k != 0 && (fec_request.k < 2 || fec_request.k > FEC_MAX_DATA || fec_request.m < 1 || fec_request.m > FEC_MAX_PARITY))) {
+        printf("Client: Usage: ./[%s] [-b batch_size] [-O 0|1] [-I classic|uring] [-s payload_size] [-a ack_every] [-d ack_delay_us] [-n streams] [-W window] [-c 0|1] [-F k,m[,adapt]] [-z codec] [-v] [-T trace_file] Hostname \n", argv[0]);
         exit(EXIT_FAILURE); // Exit if hostname not provided
     }
 
     struct sockaddr_in send_addr, from_addr; // Socket address structures for server and client
     struct frame_packet frame; // Structure for receiving packets
-    struct timeval t_out = { 10, 0 }; // 10-second timeout for receiving data
+    struct rto_estimator rto; // Adaptive receive timeout from measured RTT
+    long long cur_timeout = 0; // Receive timeout currently set on socket (us)
+    long long request_sent; // Time request was sent (us), to sample RTT from handshake
+    long long ack_sent_at = 0; // Time last in-order ACK was sent (us), 0 = no sample pending
+    struct batch_io rx; // Frames drained with one recvmmsg
+    struct batch_io tx; // ACKs queued for one sendmmsg
     struct hostent* h; // Host information structure
-    char protocolType_send[50]; // Buffer for user input regarding protocol, file name, and drop percentage
-    char file_name[20]; // Buffer for file name to receive
-    char protocolType[10]; // Protocol type (1 for Stop-and-Wait, 2 for Go-Back-N)
+    char protocolType_send[MAX_FILE_NAME + 64]; // Buffer for user input regarding protocol, file name, and drop percentage
+    struct transfer_request request; // What client asks server for
+    unsigned char request_buf[REQUEST_SIZE(MAX_FILE_NAME)]; // Request as sent
+    struct transfer_reply reply; // Frame count and payload size from server
+    long int payload_size; // Agreed bytes of data per frame
+    char file_name[MAX_FILE_NAME + 1]; // Buffer for file name to receive
+    char protocolType[10]; // Protocol type (1 for Stop-and-Wait, 2 for Go-Back-N, 3 for Selective Repeat)
     char percent[10]; // Drop percentage for packet simulation
     char ack_send[4] = "ACK"; // Acknowledgment message to send to server
     int ack_num; // ACK number received from server
@@ -51,14 +896,20 @@ int main(int argc, char** argv) {
     socklen_t length = sizeof(from_addr); // Use socklen_t for recvfrom
     int s; // Socket descriptor
     FILE* fp_input; // File pointer for input file
-    FILE* fp_output; // File pointer for received file
+    struct disk_writer writer; // Writes received frames on its own thread
+    struct resume_map map; // Frames of output file already on disk
+    char part_name[64]; // Resume map file name
+    long int range_first = 0, range_last = 0; // Frame range to fetch (0 = whole file)
+    long int req_first, req_last; // Frame range asked for in current request
+    int again = 0; // 1 = fetch next missing range of same file without prompting
+    unsigned int request_count = 0; // Requests sent, numbers each one so its reply can be told apart
     long int i = 0; // Frame counter
 
     // Initialize buffers to zero
     memset(&send_addr, 0, sizeof(send_addr));
     memset(&from_addr, 0, sizeof(from_addr));
 
-    h = gethostbyname(argv[1]); //Get hostname from argument
+    h = gethostbyname(argv[optind]); //Get hostname from argument
     if (!h) {
         print_error("gethostbyname failed"); // Handle DNS lookup failure
     }
@@ -73,77 +924,187 @@ int main(int argc, char** argv) {
         print_error("Client: Socket"); 
     }
 
-    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&t_out, sizeof(struct timeval)); // Sets option specified by SO_RCVTIMEO at level SOL_SOCKET to value of t_out 
+    rto_init(&rto);
+    crc32c_init();
+    fec_init();
+    if (payload_request == 0) {
+        payload_request = discover_payload(&send_addr);
+    }
+    printf("Requesting %ld byte frame payloads\n", payload_request);
+
+    // Large receive buffer so a full window of big frames fits in socket queue
+    int sock_buf = SOCKET_BUF_SIZE;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+    batch_init(&rx, batch_size, sizeof(struct frame_packet));
+    if (offload) {
+        batch_enable_gro(s, &rx);
+    }
+    batch_init(&tx, batch_size, sizeof(struct ack_packet) > sizeof(struct nack_packet) ? sizeof(struct ack_packet) : sizeof(struct nack_packet));
+    if (uring_io && !(batch_enable_uring(s, &rx) && batch_enable_uring(s, &tx)) && batch_size > 1) {
+        printf("Client: Kernel has no io_uring, using sendmmsg/recvmmsg\n");
+    }
+    if (trace_path) {
+        trace_init(TRACE_DEFAULT_ENTRIES);
+    }
+    metrics_install_dump_signal(); // kill -USR1 prints metrics and writes trace
+    struct transfer_stats start; // Counters when current transfer began
 
     for (;;) { 
-        // Initializing buffers to 0
-        memset(protocolType_send, 0, sizeof(protocolType_send));
-        memset(protocolType, 0, sizeof(protocolType));
-        memset(file_name, 0, sizeof(file_name));
-
-        // Prompt user for input
-        printf("\n -----");
-        printf("\n Menu");
-        printf("\n -----");
-        printf("\n Enter the protocol number followed by file name and drop percentage:");
-        printf("\n ------------------------------------------------");
-        printf("\n For Stop-and-Wait enter [1]: \n Example: 1 [File Name] [percentage]\n");
-        printf("\n For Go-Back-N enter [2]: \n Example: 2 [File Name] [percentage]\n");
-        printf("\n To exit enter [exit]: \n");
-        printf("\n ------------------------------------------------");
-        printf("\n INPUT: ");
-        scanf(" %[^\n]%*c", protocolType_send); 
-
-        // Check exit command to stop server
-        if (strcmp(protocolType_send, "exit") == 0) {
-            printf("Sending exit command to server...\n");
-            sendto(s, "EXIT", sizeof("EXIT"), 0, (struct sockaddr*)&send_addr, sizeof(send_addr));
-            break; 
-        }
-
-        // Make sure arguments are correct
-        if (sscanf(protocolType_send, "%s %s %s", protocolType, file_name, percent) != 3) {
-            fprintf(stderr, "Failed to parse input correctly\n");
-            continue; 
+        if (!again) {
+            // Initializing buffers to 0
+            memset(protocolType_send, 0, sizeof(protocolType_send));
+            memset(protocolType, 0, sizeof(protocolType));
+            memset(file_name, 0, sizeof(file_name));
+
+            // Prompt user for input
+            printf("\n -----");
+            printf("\n Menu");
+            printf("\n -----");
+            printf("\n Enter the protocol number followed by file name and drop percentage:");
+            printf("\n ------------------------------------------------");
+            printf("\n For Stop-and-Wait enter [1]: \n Example: 1 [File Name] [percentage] [first-last frame]\n");
+            printf("\n For Go-Back-N enter [2]: \n Example: 2 [File Name] [percentage] [first-last frame]\n");
+            printf("\n For Selective Repeat enter [3]: \n Example: 3 [File Name] [percentage] [first-last frame]\n");
+            printf("\n For Multicast enter [4]: \n Example: 4 [File Name] [percentage]\n");
+            printf("\n A directory or comma-separated list of files in place of [File Name] fetches them all as one bundle\n");
+            printf("\n To exit enter [exit]: \n");
+            printf("\n ------------------------------------------------");
+            printf("\n INPUT: ");
+            if (scanf(" %[^\n]%*c", protocolType_send) != 1) {
+                printf("End of input, exiting...\n"); // Input closed (e.g. piped from a script), leave server running
+                break;
+            }
+
+            // Check exit command to stop server
+            if (strcmp(protocolType_send, "exit") == 0) {
+                printf("Sending exit command to server...\n");
+                memset(&request, 0, sizeof(request));
+                request.version = WIRE_VERSION;
+                request.protocol = PROTO_EXIT;
+                sendto(s, request_buf, request_encode(&request, request_buf), 0, (struct sockaddr*)&send_addr, sizeof(send_addr));
+                break; 
+            }
+
+            // Make sure arguments are correct
+            range_first = range_last = 0;
+            if (sscanf(protocolType_send, "%9s %255s %9s %ld-%ld", protocolType, file_name, percent, &range_first, &range_last) < 3) {
+                fprintf(stderr, "Failed to parse input correctly\n");
+                continue; 
+            }
+            if (strcmp(protocolType, "1") != 0 && strcmp(protocolType, "2") != 0 && strcmp(protocolType, "3") != 0
+                && strcmp(protocolType, "4") != 0) {
+                fprintf(stderr, "Invalid protocol %s: enter 1, 2, 3 or 4\n", protocolType); // Server would refuse it
+                continue;
+            }
+        }
+        again = 0;
+
+        // Output file and its resume map; frames already on disk from an interrupted transfer are not fetched again
+        const char* out_name = strcmp(protocolType, "1") == 0 ? "received_file_sw.txt"
+            : strcmp(protocolType, "2") == 0 ? "received_file_gbn.txt"
+            : strcmp(protocolType, "4") == 0 ? "received_file_mc.txt" : "received_file_sr.txt";
+        const char* bundle_dir = strcmp(protocolType, "1") == 0 ? "received_batch_sw" // Where files of a bundle are extracted
+            : strcmp(protocolType, "2") == 0 ? "received_batch_gbn"
+            : strcmp(protocolType, "4") == 0 ? "received_batch_mc" : "received_batch_sr";
+        snprintf(part_name, sizeof(part_name), "%s%s", out_name, RESUME_SUFFIX);
+        long int req_payload = payload_request;
+        req_first = range_first;
+        req_last = range_last;
+        map.fd = -1;
+        map.bits = NULL;
+        if ((strcmp(protocolType, "1") == 0 || strcmp(protocolType, "2") == 0 || strcmp(protocolType, "3") == 0
+                || strcmp(protocolType, "4") == 0)
+            && resume_load(&map, part_name, file_name)) {
+            long int to = range_last > 0 && range_last < map.total_frame ? range_last : map.total_frame;
+            if (!resume_next_gap(&map, range_first > 0 ? range_first : 1, to, &req_first, &req_last)) {
+                printf("Every requested frame of %s is already in %s\n", file_name, out_name);
+                resume_close(&map, part_name);
+                continue;
+            }
+            req_payload = map.payload_size; // Same frame layout as frames already on disk
+            printf("Resuming %s: frames %ld-%ld (%ld of %ld frames on disk)\n", file_name, req_first, req_last,
+                atomic_load(&map.have), map.total_frame);
+        }
+
+        // Handshake reply waits up to the maximum timeout, since it is not retried
+        set_recv_timeout(s, &rx, RTO_MAX_US, &cur_timeout);
+        ack_sent_at = 0;
+        int stale = batch_drain(s, &rx); // Discard frames and replies left over from previous transfer
+        if (stale > 0) {
+            VLOG("Discarded %d datagrams left over from previous transfer\n", stale);
         }
 
         // Make sure client can send properly
-        if (sendto(s, protocolType_send, sizeof(protocolType_send), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
+        memset(&request, 0, sizeof(request));
+        request.version = WIRE_VERSION;
+        request.protocol = atoi(protocolType);
+        request.flags = (checksum_request ? REQ_CHECKSUM : 0) | (fec_request.adapt ? REQ_FEC_ADAPT : 0);
+        request.streams = streams_request;
+        request.payload_size = req_payload;
+        request.window = window_request;
+        request.drop_percent = atof(percent);
+        request.fec_k = fec_request.k;
+        request.fec_m = fec_request.m;
+        request.codecs = codec_request;
+        request.first_frame = req_first;
+        request.last_frame = req_last;
+        request.request_id = ++request_count;
+        snprintf(request.file_name, sizeof(request.file_name), "%s", file_name);
+        if (sendto(s, request_buf, request_encode(&request, request_buf), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
             print_error("Client: Send"); 
         }
+        request_sent = now_us();
+        stats_snapshot(&start);
 
          // Stop-and-Wait Protocol
         if (strcmp(protocolType, "1") == 0 && file_name[0] != '\0') { // Check argument for Stop-and-Wait
-            long int i = 1; // Frame counter starts at 1, since server sends frame# 1 first
+            long int i = 1; // Frame counter starts at first frame server sends
             socklen_t length = sizeof(from_addr);  // Changed to socklen_t
 
             // Receive total number of frames from server
-            if (recvfrom(s, &total_frame, sizeof(total_frame), 0, (struct sockaddr*)&from_addr, &length) == -1) {
+            if (recv_reply(s, &rx, &reply, &from_addr, &length, request.request_id) == -1) {
                 perror("Client: Receive total frame count");
                 exit(EXIT_FAILURE);
             }
+            total_frame = reply.total_frame;
+            payload_size = reply.payload_size;
+            frame_checksum = reply.checksum;
+            note_rtt(&rto, now_us() - request_sent); // Request/reply exchange is first RTT sample
 
             if (total_frame > 0) { // Check if valid total frame count received
-                printf("\nSERVER: Total number of frames to be transmitted: %ld frames\n", total_frame);
-                fp_output = fopen("received_file_sw.txt", "wb"); // Open new file for writing received data
-                if (fp_output == NULL) {
-                    perror("Error opening output file");
-                    exit(EXIT_FAILURE);
+                printf("\nSERVER: Total number of frames to be transmitted: %ld frames of %ld bytes\n", total_frame, payload_size);
+                // Open output file (reused when resuming) for writing received data
+                int fd = open_output(out_name, part_name, file_name, &map, &reply);
+                long int had = atomic_load(&map.have);
+                if (disk_writer_attach(&writer, fd, payload_size, 0, uring_io) == -1) {
+                    print_error("Client: Start disk writer");
+                }
+                writer.map = map.fd != -1 ? &map : NULL;
+                i = reply.first_frame;
+                struct slice_digest digest = { reply.first_frame, reply.last_frame, 0, 0 };
+                struct codec_state codec;
+                if (codec_init(&codec, reply.codec > CODEC_NONE && reply.codec < CODEC_COUNT ? reply.codec : CODEC_NONE, payload_size, 0) == -1) {
+                    print_error("Memory allocation failed for codec");
                 }
 
-                printf("Expecting to receive %ld total frames\n", total_frame); // Debug
+                VLOG("Expecting to receive %ld total frames\n", total_frame);
 
                 int retry_limit = 5;
                 int retry_count = 0;
 
                 // Loop to receive all frames
-                while (i <= total_frame) {
-                    // Clear previous frame
-                    memset(&frame, 0, sizeof(frame));
+                while (i <= reply.last_frame) {
+                    metrics_poll_dump("Client", trace_path);
 
                     // Try receiving frame from server
-                    if (recvfrom(s, &frame, sizeof(frame), 0, (struct sockaddr*)&from_addr, &length) == -1) {
-                        perror("Client: Receive frame failed");
+                    if (!batch_pending(&rx)) {
+                        batch_flush(s, &tx); // Send queued ACKs before waiting for more frames
+                    }
+                    set_recv_timeout(s, &rx, client_timeout(&rto), &cur_timeout);
+                    if (recv_frame(s, &rx, &frame, i, &from_addr, &length, &codec) == -1) {
+                        note_timeout(i);
+                        rto_backoff(&rto); // Wait longer before next resend
+                        ack_sent_at = 0; // No RTT sample across a timeout
                         retry_count++;
 
                         if (retry_count >= retry_limit) {
@@ -154,129 +1115,308 @@ int main(int argc, char** argv) {
                         }
 
                         // Timeout occurred, resend previous ACK
-                        long ack_num = i - 1;  // Resend last ACK if timeout occurs
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Resend last ACK failed");
-                        } else {
-                            printf("Resent last ACK for frame #%ld due to timeout\n", ack_num);
-                        }
+                        VLOG("Resending last ACK for frame #%ld due to timeout\n", i - 1);
+                        send_ack(s, &tx, &send_addr, i - 1, i - 1, NULL);
                         continue; // Retry receiving frame
                     }
 
                     // Frame successfully received, reset retry count
                     retry_count = 0;
 
-                    printf("Received frame #%ld\n", frame.ID);
+                    note_frame(&frame);
+                    note_digest(&frame, &digest);
 
                     // Check if frame ID is what is expected
                     if (frame.ID == i) {
-                        printf("Preparing to send ACK for frame ID: %ld\n", frame.ID); // Debug
+                        // Queue received data for writing to output file
+                        if (!disk_writer_submit(&writer, frame.ID, frame.data, frame.length)) {
+                            metric_add(&metrics.write_queue_full, 1);
+                            continue; // Leave frame unacknowledged, server resends it
+                        }
+                        trace_event(TR_WRITE, 0, frame.ID, frame.length);
+                        VLOG("Writing %ld bytes of data for frame ID: %ld\n", frame.length, frame.ID);
+                        VLOG("Preparing to send ACK for frame ID: %ld\n", frame.ID);
 
-                        // Send ACK to server after receiving correct frame
-                        long ack_num = frame.ID; // Correct ACK for received frame
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Send ACK failed");
-                        } else {
-                            printf("Sent ACK for frame #%ld\n", ack_num);
+                        // Time from our last ACK to this frame is one round trip
+                        if (ack_sent_at) {
+                            note_rtt(&rto, now_us() - ack_sent_at);
                         }
 
-                        // Write received data to output file
-                        fwrite(frame.data, 1, frame.length, fp_output);
-                        printf("Writing %ld bytes of data for frame ID: %ld\n", frame.length, frame.ID); // Debug
+                        // Send ACK to server after receiving correct frame
+                        send_ack(s, &tx, &send_addr, frame.ID, frame.ID, NULL);
+                        ack_sent_at = now_us();
 
                         // Move to next frame
                         i++;
                     } else {
                         // If we received an out-of-order frame, resend last correct ACK
-                        long ack_num = i - 1;  // Last successfully received frame
-                        printf("Out of order frame received, resending ACK for #%ld\n", ack_num);
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Resend ACK for out-of-order frame failed");
+                        if (frame.ID < i) {
+                            metric_add(&metrics.duplicates, 1);
                         }
+                        VLOG("Out of order frame received, resending ACK for #%ld\n", i - 1);
+                        send_ack(s, &tx, &send_addr, i - 1, frame.ID, NULL);
                     }
                 }
 
+                batch_flush(s, &tx); // Final ACK
+
                 // Close output file
-                fclose(fp_output);
+                long written = writer_done(&writer); // Wait for queued frames to reach disk
+                codec_free(&codec, 0);
                 printf("Transmission Completed for Stop-and-Wait!\n");
+                transfer_done(&start, now_us() - request_sent, written);
+                again = finish_output(fd, &map, out_name, part_name, file_name, &digest, 1, had, written, range_first, range_last,
+                    reply.flags & REPLY_BUNDLE ? bundle_dir : NULL); // Fetch frames skipped above
             } else {
-                printf("File is empty or invalid.\n"); // Handle case of empty or invalid file
+                resume_discard(&map);
+                if (reply.status == REPLY_OK) {
+                    printf("File is empty or invalid.\n"); // Handle case of empty or invalid file
+                }
             }
         }
 
-        // Go-Back-N Protocol
-        if (strcmp(protocolType, "2") == 0 && file_name[0] != '\0') {
-            long int base = 1; // Base of expected frames
+        // Go-Back-N and Selective Repeat Protocols
+        if ((strcmp(protocolType, "2") == 0 || strcmp(protocolType, "3") == 0) && file_name[0] != '\0') {
+            int go_back_n = strcmp(protocolType, "2") == 0;
             socklen_t length = sizeof(from_addr); // Set length for recvfrom()
 
             // Receive total number of frames from server
-            if (recvfrom(s, &total_frame, sizeof(total_frame), 0, (struct sockaddr*)&from_addr, &length) == -1) {
+            if (recv_reply(s, &rx, &reply, &from_addr, &length, request.request_id) == -1) {
                 perror("Client: Receive total frame count failed");
                 exit(EXIT_FAILURE);
             }
+            total_frame = reply.total_frame;
+            payload_size = reply.payload_size;
+            frame_checksum = reply.checksum;
+            note_rtt(&rto, now_us() - request_sent); // Request/reply exchange is first RTT sample
 
             if (total_frame > 0) {
-                printf("\nSERVER: Total number of frames to be transmitted: %ld frames\n", total_frame);
-                fp_output = fopen("received_file_gbn.txt", "wb");
-                if (fp_output == NULL) {
-                    perror("Error opening output file");
-                    exit(EXIT_FAILURE);
+                printf("\nSERVER: Total number of frames to be transmitted: %ld frames of %ld bytes\n", total_frame, payload_size);
+
+                int streams = reply.streams >= 1 && reply.streams <= MAX_STREAMS ? reply.streams : 1;
+                struct stream st[MAX_STREAMS]; // Receive state per stream
+                struct disk_writer* writers = calloc(streams, sizeof(struct disk_writer)); // One writer thread per stream
+                struct batch_io* io = calloc(2 * streams, sizeof(struct batch_io)); // Parallel streams' rx and tx batches
+                pthread_t threads[MAX_STREAMS];
+                long written = 0;
+                if (!writers || !io) {
+                    print_error("Memory allocation failed for streams");
                 }
 
-                printf("Expecting to receive %ld total frames\n", total_frame);
+                // All streams write into one file (reused when resuming), each at its own frames' offsets
+                int fd = open_output(out_name, part_name, file_name, &map, &reply);
+                long int had = atomic_load(&map.have);
+                if (streams > 1) {
+                    printf("Receiving in %d parallel streams\n", streams);
+                }
+                for (int k = 0; k < streams; k++) {
+                    memset(&st[k], 0, sizeof(st[k]));
+                    if (disk_writer_attach(&writers[k], fd, payload_size, 0, uring_io) == -1) {
+                        print_error("Client: Start disk writer");
+                    }
+                    writers[k].map = map.fd != -1 ? &map : NULL;
+                    st[k].writer = &writers[k];
+                    st[k].rto = rto;
+                    st[k].go_back_n = go_back_n;
+                    st[k].window = reply.window > 0 ? reply.window : 1;
+                    st[k].ack_every = ack_every;
+                    st[k].ack_delay = ack_delay;
+                    st[k].to = send_addr;
+                    st[k].fec_k = reply.fec_k >= 0 && reply.fec_k <= FEC_MAX_DATA ? reply.fec_k : 0;
+                    st[k].total_frame = total_frame;
+                    st[k].file_size = reply.file_size;
+                    st[k].codec = reply.codec > CODEC_NONE && reply.codec < CODEC_COUNT ? reply.codec : CODEC_NONE;
+                    if (streams == 1) {
+                        st[k].s = s;
+                        st[k].rx = &rx;
+                        st[k].tx = &tx;
+                        st[k].cur_timeout = cur_timeout;
+                        st[k].first = reply.first_frame;
+                        st[k].last = reply.last_frame;
+                        continue;
+                    }
 
-                while (base <= total_frame) {
-                    memset(&frame, 0, sizeof(frame));
+                    // Stream k has its own socket and gets frames [first, last] from server port port[k] (same split as server)
+                    long int count = reply.last_frame - reply.first_frame + 1;
+                    st[k].first = reply.first_frame + count * k / streams;
+                    st[k].last = reply.first_frame + count * (k + 1) / streams - 1;
+                    st[k].to.sin_port = reply.port[k];
+                    st[k].announce = 1;
+                    if ((st[k].s = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+                        print_error("Client: Stream socket");
+                    }
+                    setsockopt(st[k].s, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+                    st[k].rx = &io[2 * k];
+                    st[k].tx = &io[2 * k + 1];
+                    batch_init(st[k].rx, batch_size, sizeof(struct frame_packet));
+                    if (offload) {
+                        batch_enable_gro(st[k].s, st[k].rx);
+                    }
+                    batch_init(st[k].tx, batch_size, sizeof(struct ack_packet));
+                    if (uring_io) {
+                        batch_enable_uring(st[k].s, st[k].rx);
+                        batch_enable_uring(st[k].s, st[k].tx);
+                    }
+                }
+
+                VLOG("Expecting to receive %ld total frames\n", total_frame);
 
-                    // Receive frame from server
-                    if (recvfrom(s, &frame, sizeof(frame), 0, (struct sockaddr*)&from_addr, &length) == -1) {
-                        perror("Client: Receive frame failed");
-                        // Timeout occurred, resend ACK for last successfully received frame
-                        long ack_num = base - 1;  // Send ACK for last correctly received frame
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Resend ACK failed");
-                        } else {
-                            printf("Resent last ACK for frame #%ld due to timeout\n", ack_num);
+                if (streams == 1) {
+                    receive_stream(&st[0]);
+                    rto = st[0].rto; // Keep what was learned for next transfer
+                    cur_timeout = st[0].cur_timeout;
+                } else {
+                    for (int k = 0; k < streams; k++) {
+                        if (pthread_create(&threads[k], NULL, stream_thread, &st[k]) != 0) {
+                            print_error("Client: pthread_create");
                         }
-                        continue; // Retry receiving next frame
                     }
+                    for (int k = 0; k < streams; k++) {
+                        pthread_join(threads[k], NULL);
+                        tx.calls += st[k].tx->calls; // Report streams' syscalls with main socket's
+                        tx.datagrams += st[k].tx->datagrams;
+                        rx.calls += st[k].rx->calls;
+                        rx.datagrams += st[k].rx->datagrams;
+                        rx.offloaded += st[k].rx->offloaded;
+                        batch_free(st[k].rx);
+                        batch_free(st[k].tx);
+                        close(st[k].s);
+                    }
+                }
 
-                    printf("Received frame #%ld\n", frame.ID);
+                // Wait for queued frames to reach disk, then trim file to furthest frame any stream wrote
+                for (int k = 0; k < streams; k++) {
+                    long end = writer_done(&writers[k]);
+                    if (end > written) {
+                        written = end;
+                    }
+                }
+                struct slice_digest digests[MAX_STREAMS];
+                for (int k = 0; k < streams; k++) {
+                    digests[k] = st[k].digest;
+                }
+                free(writers);
+                free(io);
+                printf(go_back_n ? "Transmission Completed for Go-Back-N!\n" : "Transmission Completed for Selective Repeat!\n");
+                transfer_done(&start, now_us() - request_sent, written);
+                again = finish_output(fd, &map, out_name, part_name, file_name, digests, streams, had, written, range_first, range_last,
+                    reply.flags & REPLY_BUNDLE ? bundle_dir : NULL);
+            } else {
+                resume_discard(&map);
+                if (reply.status == REPLY_OK) {
+                    printf("File is empty or invalid.\n");
+                }
+            }
+        }
 
-                    // Check if frame ID is what is expected
-                    if (frame.ID == base) {
-                        // Send ACK for received frame
-                        long ack_num = frame.ID;
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Send ACK failed");
-                        } else {
-                            printf("Sent ACK for frame #%ld\n", ack_num);
-                        }
+        // Multicast: server sends each frame once to every receiver of file, repairs follow NACKs
+        if (strcmp(protocolType, "4") == 0 && file_name[0] != '\0') {
+            socklen_t length = sizeof(from_addr);
+            if (recv_reply(s, &rx, &reply, &from_addr, &length, request.request_id) == -1) {
+                perror("Client: Receive total frame count failed");
+                exit(EXIT_FAILURE);
+            }
+            total_frame = reply.total_frame;
+            payload_size = reply.payload_size;
+            frame_checksum = reply.checksum;
+            note_rtt(&rto, now_us() - request_sent);
+            if (total_frame <= 0) {
+                resume_discard(&map);
+                if (reply.status == REPLY_OK) {
+                    printf("File is empty or invalid.\n");
+                }
+                continue;
+            }
+            printf("\nSERVER: Total number of frames to be transmitted: %ld frames of %ld bytes\n", total_frame, payload_size);
 
-                        // Write received data to output file
-                        fwrite(frame.data, 1, frame.length, fp_output);
-                        printf("Writing %ld bytes of data for frame ID: %ld\n", frame.length, frame.ID);
+            struct stream st;
+            struct disk_writer writer;
+            memset(&st, 0, sizeof(st));
+            int fd = open_output(out_name, part_name, file_name, &map, &reply);
+            long int had = atomic_load(&map.have);
+            if (disk_writer_attach(&writer, fd, payload_size, 0, uring_io) == -1) {
+                print_error("Client: Start disk writer");
+            }
+            writer.map = map.fd != -1 ? &map : NULL;
+            st.writer = &writer;
+            st.map = writer.map;
+            st.rto = rto;
+            st.ack_delay = ack_delay;
+            st.to = send_addr;
+            st.to.sin_port = reply.port[0]; // NACKs go to transfer's own socket
+            st.total_frame = total_frame;
+            st.file_size = reply.file_size;
+            st.codec = reply.codec > CODEC_NONE && reply.codec < CODEC_COUNT ? reply.codec : CODEC_NONE;
+            st.drop = atof(percent) / 100;
+            st.s = st.ns = s;
+            st.rx = &rx;
+            st.tx = &tx;
+            st.cur_timeout = cur_timeout;
 
-                        // Move to next expected frame
-                        base++;
-                    } else {
-                        // If we received an out-of-order frame, resend last correct ACK
-                        long ack_num = base - 1;  // Last successfully received frame
-                        printf("Out of order frame received, resending ACK for #%ld\n", ack_num);
-                        if (sendto(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&send_addr, sizeof(send_addr)) == -1) {
-                            perror("Client: Resend ACK for out-of-order frame failed");
-                        }
-                    }
+            // Frames come to a socket joined to server's group, or to this socket when server sends each receiver a copy
+            struct batch_io group_rx;
+            if (reply.mcast_group != 0) {
+                struct sockaddr_in group_addr;
+                struct ip_mreq mreq;
+                int on = 1;
+                memset(&group_addr, 0, sizeof(group_addr));
+                group_addr.sin_family = AF_INET;
+                group_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                group_addr.sin_port = reply.mcast_port;
+                mreq.imr_multiaddr.s_addr = reply.mcast_group;
+                mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+                if ((st.s = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+                    print_error("Client: Multicast socket");
+                }
+                setsockopt(st.s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)); // Other receivers on this host share port
+                setsockopt(st.s, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+                if (bind(st.s, (struct sockaddr*)&group_addr, sizeof(group_addr)) == -1
+                    || setsockopt(st.s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+                    print_error("Client: Join multicast group");
+                }
+                batch_init(&group_rx, batch_size, sizeof(struct frame_packet));
+                if (offload) {
+                    batch_enable_gro(st.s, &group_rx);
+                }
+                if (uring_io) {
+                    batch_enable_uring(st.s, &group_rx);
                 }
+                st.rx = &group_rx;
+                st.cur_timeout = 0;
+                printf("Receiving from multicast group %s:%d\n", inet_ntoa(mreq.imr_multiaddr), ntohs(reply.mcast_port));
+            }
 
-                fclose(fp_output);
-                printf("Transmission Completed for Go-Back-N!\n");
+            receive_multicast(&st);
+            rto = st.rto;
+            if (st.s != s) {
+                rx.calls += group_rx.calls; // Report group socket's syscalls with main socket's
+                rx.datagrams += group_rx.datagrams;
+                rx.offloaded += group_rx.offloaded;
+                batch_free(&group_rx);
+                close(st.s);
             } else {
-                printf("File is empty or invalid.\n");
+                cur_timeout = st.cur_timeout;
             }
+            long written = writer_done(&writer);
+            printf("Transmission Completed for Multicast!\n");
+            transfer_done(&start, now_us() - request_sent, written);
+            again = finish_output(fd, &map, out_name, part_name, file_name, &st.digest, 1, had, written, range_first, range_last,
+                reply.flags & REPLY_BUNDLE ? bundle_dir : NULL);
         }
     }
 
+    printf("Send syscalls: %lld for %lld datagrams, receive syscalls: %lld for %lld datagrams\n",
+        tx.calls, tx.datagrams, rx.calls, rx.datagrams);
+    if (rx.gro) {
+        printf("Segmentation offload: %lld of %lld datagrams received coalesced by GRO\n", rx.offloaded, rx.datagrams);
+    }
+    printf("Disk writes: %lld syscalls for %lld frames\n", disk_calls, disk_frames);
+    metrics_print(stdout, "Client");
+    if (trace_path) {
+        trace_dump(trace_path);
+    }
+    batch_free(&rx);
+    batch_free(&tx);
     close(s);
     exit(EXIT_SUCCESS);
 
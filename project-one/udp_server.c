@@ -1,6 +1,9 @@
+#define _GNU_SOURCE // sendmmsg/recvmmsg
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -14,42 +17,353 @@
 #include <dirent.h>
 #include <math.h>
 #include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rto.h"
+#include "batch_io.h"
+#include "ack.h"
+#include "impair.h"
+#include "metrics.h"
+#include "crc32c.h"
+#include "fec.h"
+#include "compress.h"
+#include "file_cache.h"
+#include "wire.h"
+#include "pacing.h"
+#include "timer_wheel.h"
+#include "bundle.h"
 
-#define BUF_SIZE 4096 // Max buffer size for data in a frame
+#define BUF_SIZE 4096 // Max buffer size for a client request
+#define DEFAULT_PAYLOAD 1456 // Payload when client asks for none: 1500 MTU - 20 IP - 8 UDP - 16 header
+#define SOCKET_BUF_SIZE (4 * 1024 * 1024) // Requested socket send/receive buffer size
 #define SERVER_PORT 2226 // Server's UDP port
-#define WINDOW_SIZE 3 // Window size for Go-Back-N ARQ
+#define MAX_WINDOW 64 // Default ceiling on Go-Back-N and Selective Repeat congestion window (frames)
+#define INITIAL_CWND 2 // Congestion window at start of transfer
+#define DUP_ACK_THRESHOLD 3 // Duplicate ACKs that trigger a fast retransmit
+#define MAX_SESSIONS 64 // Default cap on concurrent client sessions
+#define RESEND_LIMIT 5 // Maximum number of retries without progress
+#define MAX_EVENTS 16 // Max epoll events handled per wakeup
+#define REORDER_DELAY_US 1000 // Default extra hold for reordered datagrams (us)
+#define STREAM_START_US RTO_MAX_US // How long a stream worker waits for client's first ACK (us)
+#define MAX_GROUPS 8 // Multicast transfers running at once
+#define MCAST_MAX_RECEIVERS 64 // Receivers one multicast transfer serves (one bit each in a repair mask)
+#define MCAST_JOIN_MS 200 // Default wait for more receivers before a multicast transfer's first frame (ms)
+#define MCAST_RATE 100 // Default multicast send rate (MB/s, which is also bytes per us)
+#define MCAST_SUPPRESS_US 2000 // NACKs for a frame repaired this recently crossed the repair and are ignored
+#define MCAST_IDLE_US RTO_MAX_US // Multicast transfer ends after this long without a NACK once all is sent
+#define PACE_BBR -1.0 // Session pacing rate: follow bandwidth estimate
+#define PACE_MIN_CWND 4 // Go-Back-N window floor when pacing follows bandwidth estimate (frames)
+#define TIMER_RTX 0 // Timer kinds: session's retransmission timer
+#define TIMER_FRAME 1 // One Selective Repeat frame's retransmission timer
+#define TIMER_PACE 2 // Paced sender may try again
+// Per-client transfer state, keyed by client address
+struct session {
+    int in_use; // 1 if slot holds an active transfer
+    int index; // Session number (session id in trace)
+    int next; // Next session in same hash bucket (-1 = end of chain)
+    struct sockaddr_in c_addr; // Client address (session key)
+    socklen_t length; // Length of client address
+    int protocol; // 1 = Stop-and-Wait, 2 = Go-Back-N, 3 = Selective Repeat
+    FILE* fp; // File being sent (buffered fallback when file cannot be mapped)
+    struct file_entry* file; // Mapped file shared through file cache, NULL when using fp
+    char* map; // Whole file mapped read-only (file->map), NULL when using fp or a bundle
+    struct bundle* bundle; // Bundle whose files' own mappings frames are read from (file->source), NULL otherwise
+    size_t map_len; // Length of mapping (file size)
+    long long file_size; // File size in bytes
+    long int total_frame; // Last frame this session sends (total frames in file unless it serves one stream)
+    long int first_frame; // First frame this session sends
+    long int payload_size; // Negotiated data bytes per frame
+    int checksum; // 1 = frames carry CRC32C
+    unsigned int digest; // CRC32C of data of frames first_frame..digest_next - 1
+    long int digest_next; // Next frame to add to digest (frames are first sent in order)
+    uint32_t (*digest_shift)[256]; // Tables shifting digest past one full frame, NULL unless checksum
+    atomic_ullong* frame_crc; // File cache's per-frame data CRCs for this payload size, NULL = compute every time
+    struct fec_config fec; // FEC block size and parity per block (fec.k = 0: off), fec.m follows loss when fec.adapt
+    double fec_loss; // Smoothed share of frames lost per block, from client's reports
+    unsigned int fec_shares; // Client's running totals at its last report (frames of finished blocks)
+    unsigned int fec_lost; // Same, frames of them that were lost
+    long int fec_blocks; // Blocks whose parity was sent
+    long int fec_parity_sent; // Parity frames sent
+    char* fec_buf; // Block's data read with fread() when file is not mapped, NULL otherwise
+    struct codec_state codec; // Packs each frame on its own (codec.codec = CODEC_NONE: frames sent raw)
+    long int base; // First unacknowledged frame
+    long int next_seq_num; // Next sequence number to send
+    int window_size; // Frames allowed in flight (1 for Stop-and-Wait)
+    int window_limit; // Agreed ceiling on window_size (ceiling on congestion window)
+    int ring_size; // Entries in per-frame rings (largest window_size can reach)
+    double cwnd; // Go-Back-N and Selective Repeat congestion window (frames), window_size follows it
+    double ssthresh; // Slow start threshold (frames)
+    int max_cwnd; // Largest window reached during transfer
+    int dup_acks; // Consecutive duplicate ACKs for base - 1
+    long int recover; // Fast recovery (Selective Repeat: a loss event) ends once base passes this frame
+    long int high_seq; // Highest frame sent so far (Go-Back-N rewinds below it)
+    int retry_count; // Retries since last progress
+    char* acked; // Per-frame ACK flags (cumulative or SACK), ring indexed by frame % ring_size
+    long long* sent_at; // Per-frame last send time (us), same ring
+    char* resent; // Per-frame retransmitted flag (excluded from RTT samples), same ring
+    struct rto_estimator rto; // Adaptive retransmission timeout from measured RTT
+    struct impair fwd; // Simulated impairment of frames sent to client
+    struct impair rev; // Simulated impairment of ACKs from client
+    int resend_frame; // Frames retransmitted
+    int timeouts; // Retransmission timer expiries
+    long int frames_sent; // Frames sent, including retransmissions and simulated drops
+    long long bytes_sent; // Payload bytes sent
+    long long started; // Time transfer started (us)
+    struct timer_wheel* wheel; // Wheel of session table this session's timers run on
+    struct timer rtx_timer; // Retransmission timer of Stop-and-Wait frame or Go-Back-N window base
+    struct timer* frame_timers; // Selective Repeat: per-frame retransmission timers, same ring as acked (NULL otherwise)
+    long long timeout_at; // Time of last timeout (us): frame timers running out together count as one
+    struct pacer pace; // Spreads frames at pacing rate (pace.rate 0 = unpaced)
+    int pace_bbr; // 1 = pacing rate (and Go-Back-N window) follow bandwidth estimate
+    struct bw_estimator bw; // Bottleneck bandwidth and min RTT from ACK timing, when pace_bbr
+    struct pace_sample* delivery; // Per-frame delivery state when last sent, same ring as acked, NULL unless pace_bbr
+    struct timer pace_timer; // Armed while a sender held back by pacing waits to try again
+};
+
+static int max_window = MAX_WINDOW; // Ceiling on congestion window, and default window of every windowed protocol
+static int max_payload = MAX_PAYLOAD; // Largest payload server agrees to
+static int batch_size = BATCH_MAX; // Datagrams per syscall (1 = one sendto/recvfrom per datagram)
+static int offload = 1; // 1 = send runs of frames to one client as UDP GSO trains when kernel supports it
+static int uring_io = 0; // 1 = batches send and receive through io_uring when kernel has it
+static __thread struct batch_io tx_batch; // Frames queued for one sendmmsg per event loop pass (one per thread)
+static __thread struct batch_io rx_batch; // ACKs and requests drained with one recvmmsg
+static struct impair_model frame_model; // Impairment of frames (loss comes from each request)
+static struct impair_model ack_model; // Impairment of ACKs
+static unsigned long long impair_seed = IMPAIR_DEFAULT_SEED; // Seed for every session's simulator
+static atomic_ullong sessions_started; // Numbers each session's PRNG streams
+static __thread struct delay_line frame_line; // Frames held back by simulated delay
+static __thread struct delay_line ack_line; // ACKs held back by simulated delay
+static atomic_llong worker_io[5]; // Send calls, datagrams sent, receive calls, datagrams received, datagrams sent in GSO trains by finished workers
+static const char* trace_path; // Trace dump file, NULL = tracing off
+static struct file_cache file_cache; // Mapped files shared across requests and stream workers
+static struct sockaddr_in mcast_addr; // Multicast group (sin_addr 0 = fan frames out to each receiver by unicast)
+static long long mcast_rate = MCAST_RATE; // Multicast send rate (bytes per us)
+static long long mcast_join_us = MCAST_JOIN_MS * 1000LL; // Wait for more receivers before first frame (us)
+static double pace_rate; // Sender pacing: fixed rate per transfer (bytes per us), PACE_BBR, or 0 = off
+
+// Table of active sessions with a hash index on client address
+struct session_table {
+    struct session* slots; // Session storage
+    int* buckets; // Hash buckets (index of first session, -1 = empty)
+    int max_sessions; // Cap on concurrent sessions
+    int n_buckets; // Number of hash buckets
+    int active; // Sessions currently in use
+    struct timer_wheel wheel; // Every session's retransmission and pacing timers
+};
+
+// One stream of a parallel transfer, served by its own worker thread and socket
+struct stream_job {
+    int s; // Worker's socket (bound to its own port)
+    struct sockaddr_in c_addr; // Client host (port is learned from client's first ACK)
+    int protocol; // 2 = Go-Back-N, 3 = Selective Repeat
+    char file_name[256]; // File being sent
+    struct file_entry* file; // Its mapping (job holds a reference), NULL = worker opens file with stdio
+    float drop_percent; // Simulated loss
+    long int payload_size; // Agreed bytes of data per frame
+    int checksum; // 1 = frames carry CRC32C
+    struct fec_config fec; // FEC settings (k = 0: off)
+    int codec; // Codec frames are packed with
+    int window; // Agreed window ceiling
+    double pace_rate; // This stream's pacing rate (bytes per us), PACE_BBR or 0 = unpaced
+    long int first_frame; // First frame of this stream's slice
+    long int last_frame; // Last frame of this stream's slice
+};
+
+// One multicast transfer: a worker thread sends one file once to a group (or fans it out to each receiver)
+// and repairs what receivers' NACKs ask for
+struct mcast_group {
+    int active; // 1 while worker runs; this and the next two are guarded by mcast_lock
+    int closing; // 1 once worker decided to end (new receivers get a new group)
+    int joined; // Receivers sent a reply pointing at this group
+    int s; // Worker's socket: NACKs arrive on it, frames leave from it
+    unsigned short port; // Its port (network byte order)
+    char file_name[256]; // File being sent
+    struct file_entry* file; // Its mapping (group holds a reference), NULL = worker opens file with stdio
+    off_t file_size; // File size in bytes
+    long int total_frame; // Frames in file
+    long int payload_size; // Agreed bytes of data per frame
+    int checksum; // 1 = frames carry CRC32C
+    int codec; // Codec frames are packed with
+    long long start_at; // Join window ends: first frame goes out (us)
+};
 
-// Structure for a frame packet 
-struct frame_packet {
-    long int ID; // Frame sequence number
-    long int length; // Length of data in frame
-    char data[BUF_SIZE]; // Data in frame
+// One receiver of a multicast transfer
+struct mcast_receiver {
+    struct sockaddr_in addr; // Where its NACKs come from (and where fanned-out frames go)
+    int done; // 1 once it has every frame
+    long int have; // Frames it last reported having
 };
 
+// Multicast worker's send state
+struct mcast_state {
+    struct session sess; // File, checksums, digest and codec frames are sealed with
+    struct mcast_receiver rx[MCAST_MAX_RECEIVERS]; // Receivers in order of joining
+    int n_rx; // Receivers that joined
+    int n_done; // Of them, receivers that have every frame
+    uint64_t* want; // Per frame (ID - 1): receivers waiting for a repair, one bit each (0 = no repair queued)
+    long long* sent_at; // Per frame (ID - 1): time it was last sent (us)
+    long int next_new; // Next frame of first pass
+    long int repair_low; // No repair is queued below this frame
+    long int queued; // Repairs queued
+    struct pacer pace; // Holds sends to multicast rate
+    long long last_heard; // Time of last NACK (us)
+    long long nacks; // NACKs received
+    long long requested; // Frames they asked for
+    long long merged; // Of them, frames whose repair was already queued
+    long long suppressed; // Of them, frames repaired moments before
+    long long repairs; // Repairs sent
+    long long datagrams; // Frame datagrams sent (fan-out sends one per receiver)
+    long long bytes; // Their data bytes
+};
+
+static struct mcast_group mcast_groups[MAX_GROUPS]; // Multicast transfers
+static pthread_mutex_t mcast_lock = PTHREAD_MUTEX_INITIALIZER; // Guards groups' active, closing and joined
+
 //Function prototypes
 void print_error(char* msg);
-void stop_and_wait(int s, struct sockaddr_in* c_addr, socklen_t length, FILE* fp, int total_frame, int* testdrop, int td);
-void go_back_n(int s, struct sockaddr_in* c_addr, socklen_t length, FILE* fp, int total_frame, float drop_probability);
-int* generate_drops(int total_frame, float drop_percent); // Generates which frames to drop based on drop percentage
+void serve(int s, struct session_table* t, struct stream_job* job); // Event loop for main socket or one stream
+void* stream_worker(void* arg);
+void* mcast_worker(void* arg); // Sends one file to a multicast group and repairs what NACKs ask for
+struct session* session_start(int s, struct session_table* t, struct sockaddr_in* c_addr, socklen_t length, int protocol,
+    struct file_entry* file, FILE* fp, off_t f_size, float drop_percent, long int payload_size, int checksum, int codec, const struct fec_config* fec, int window, double pace, long int first, long int last);
+void table_init(struct session_table* t, int max_sessions);
+struct session* table_find(struct session_table* t, struct sockaddr_in* addr);
+struct session* table_insert(struct session_table* t, struct sockaddr_in* addr, socklen_t length);
+void table_remove(struct session_table* t, struct session* sess);
+void handle_request(int s, struct session_table* t, const struct transfer_request* req, struct sockaddr_in* c_addr, socklen_t length);
+void send_reply(int s, const struct transfer_reply* reply, struct sockaddr_in* c_addr, socklen_t length);
+int mcast_join(const char* name, struct file_entry* file, FILE* fp, off_t f_size, long int total_frame, long int payload_size,
+    int checksum, int codecs, int codec, struct transfer_reply* reply);
+void end_session(int s, struct session_table* t, struct session* sess);
+void dispatch_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack);
+void release_delayed(int s, struct session_table* t); // Sends frames and delivers ACKs whose simulated delay is over
+void fec_feedback(struct session* sess, const struct ack_packet* ack); // Adapts parity per block to loss client reports
+void send_frame(int s, struct session* sess, long int id);
+long long frame_offset(struct session* sess, long int id); // Byte offset of a frame in file
+void stop_and_wait_start(int s, struct session* sess);
+void stop_and_wait_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack);
+void stop_and_wait_timeout(int s, struct session_table* t, struct session* sess);
+void go_back_n_fill(int s, struct session* sess);
+void go_back_n_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack);
+void go_back_n_timeout(int s, struct session_table* t, struct session* sess);
+void selective_repeat_fill(int s, struct session* sess);
+void selective_repeat_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack);
+void selective_repeat_timeout(int s, struct session_table* t, struct session* sess, long int id, int first);
+int next_timeout(struct session_table* t); // Milliseconds until earliest retransmission timer or held datagram
+void expire_timers(int s, struct session_table* t);
 
 int main(int argc, char** argv) {
-    if (argc != 1) { // Ensure correct number of arguments
-        printf("Usage: ./[%s]\n", argv[0]);
+    int max_sessions = MAX_SESSIONS; // Cap on concurrent sessions
+    double ack_loss = 0; // ACK drop percentage
+    long long cache_mb = FILE_CACHE_DEFAULT_MB; // Cap on file cache
+    int opt;
+
+    frame_model.reorder_delay = REORDER_DELAY_US;
+
+    // Parse options
+    while ((opt = getopt(argc, argv, "m:w:b:O:I:s:C:p:g:r:J:S:G:D:R:P:X:A:vT:")) != -1) {
+        switch (opt) {
+        case 'm': // Max concurrent sessions
+            max_sessions = atoi(optarg);
+            break;
+        case 'w': // Go-Back-N window ceiling
+            max_window = atoi(optarg);
+            break;
+        case 'b': // Batch size for sendmmsg/recvmmsg
+            batch_size = atoi(optarg);
+            break;
+        case 'O': // Segmentation offload on or off
+            offload = atoi(optarg);
+            break;
+        case 'I': // I/O engine
+            uring_io = strcmp(optarg, "uring") == 0 ? 1 : strcmp(optarg, "classic") == 0 ? 0 : -1;
+            break;
+        case 's': // Largest payload per frame
+            max_payload = atoi(optarg);
+            break;
+        case 'C': // File cache size
+            cache_mb = atoll(optarg);
+            break;
+        case 'p': // Sender pacing: off, BBR or fixed rate
+            pace_rate = strcmp(optarg, "bbr") == 0 ? PACE_BBR : strcmp(optarg, "off") == 0 ? 0 : atof(optarg);
+            break;
+        case 'g': { // Multicast group
+            char group[64];
+            int port = 0;
+            if (sscanf(optarg, "%63[^:]:%d", group, &port) != 2 || inet_pton(AF_INET, group, &mcast_addr.sin_addr) != 1
+                || !IN_MULTICAST(ntohl(mcast_addr.sin_addr.s_addr)) || port <= 0 || port > 65535) {
+                printf("Server: -g needs a multicast group and port, e.g. 239.1.2.3:5000\n");
+                exit(EXIT_FAILURE);
+            }
+            mcast_addr.sin_family = AF_INET;
+            mcast_addr.sin_port = htons(port);
+            break;
+        }
+        case 'r': // Multicast send rate
+            mcast_rate = atoll(optarg);
+            break;
+        case 'J': // Multicast join window
+            mcast_join_us = atoll(optarg) * 1000;
+            break;
+        case 'S': // Simulator seed
+            impair_seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'G': // Gilbert-Elliott burst loss: good->bad %, bad->good %, loss % in bad state
+            frame_model.ge_loss = 100;
+            sscanf(optarg, "%lf,%lf,%lf", &frame_model.ge_p, &frame_model.ge_r, &frame_model.ge_loss);
+            frame_model.ge_p /= 100;
+            frame_model.ge_r /= 100;
+            frame_model.ge_loss /= 100;
+            break;
+        case 'D': // Added delay and jitter
+            sscanf(optarg, "%lld,%lld", &frame_model.delay, &frame_model.jitter);
+            break;
+        case 'R': // Reordering
+            sscanf(optarg, "%lf,%lld", &frame_model.reorder, &frame_model.reorder_delay);
+            frame_model.reorder /= 100;
+            break;
+        case 'P': // Duplication
+            frame_model.duplicate = atof(optarg) / 100;
+            break;
+        case 'X': // Corruption
+            frame_model.corrupt = atof(optarg) / 100;
+            break;
+        case 'A': // ACK loss
+            ack_loss = atof(optarg);
+            break;
+        case 'v': // Print every frame event
+            log_verbose = 1;
+            break;
+        case 'T': // Record frame events for dumping
+            trace_path = optarg;
+            break;
+        default:
+            printf("Usage: ./[%s] [-m max_sessions] [-w max_window] [-b batch_size] [-O 0|1] [-I classic|uring] [-s max_payload] [-C cache_mb] [-p off|bbr|rate_MBps] [-g group:port] [-r rate_MBps] [-J join_ms] [-S seed] [-G p,r[,h]] [-D delay_us[,jitter_us]] [-R reorder_pct[,extra_us]] [-P dup_pct] [-X corrupt_pct] [-A ack_loss_pct] [-v] [-T trace_file]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc || max_sessions <= 0 || max_window <= 0 || batch_size <= 0 || offload < 0 || offload > 1 || uring_io < 0 || cache_mb < 0 || (pace_rate < 0 && pace_rate != PACE_BBR) || mcast_rate <= 0 || mcast_join_us < 0
+        || max_payload < MIN_PAYLOAD || max_payload > MAX_PAYLOAD
+        || frame_model.ge_p < 0 || frame_model.ge_p > 1 || (frame_model.ge_p > 0 && frame_model.ge_r <= 0)
+        || frame_model.delay < 0 || frame_model.jitter < 0 || frame_model.reorder < 0 || frame_model.reorder_delay < 0
+        || frame_model.duplicate < 0 || frame_model.corrupt < 0 || frame_model.corrupt > 1 || ack_loss < 0 || ack_loss > 100) { // Ensure correct number of arguments
+        printf("Usage: ./[%s] [-m max_sessions] [-w max_window] [-b batch_size] [-O 0|1] [-I classic|uring] [-s max_payload] [-C cache_mb] [-p off|bbr|rate_MBps] [-g group:port] [-r rate_MBps] [-J join_ms] [-S seed] [-G p,r[,h]] [-D delay_us[,jitter_us]] [-R reorder_pct[,extra_us]] [-P dup_pct] [-X corrupt_pct] [-A ack_loss_pct] [-v] [-T trace_file]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    struct stat st; // Structure to get file information (size, etc.)
-    struct sockaddr_in s_addr, c_addr; // Server and client socket addresses
-    socklen_t length; // Length of sockaddr_in structure
-    char msg_recv[BUF_SIZE]; // Buffer to store received message from client
-    char file_name_recv[256]; // Increased buffer size for file name
-    char protocolType_recv[10]; // Buffer to store protocol type requested (1 = Stop-and-Wait, 2 = Go-Back-N)
-    char percent[10]; // Buffer to store drop percentage
+    // ACKs see same delay, reordering and duplication as frames, with their own loss rate (and are never corrupted)
+    ack_model = frame_model;
+    ack_model.loss = ack_loss / 100;
+    ack_model.ge_p = 0;
+    ack_model.corrupt = 0;
+    crc32c_init();
+    fec_init();
+    file_cache_init(&file_cache, cache_mb << 20);
 
-    ssize_t numRead; // Number of bytes read from socket
-    off_t f_size; // File size of requested file
+    struct sockaddr_in s_addr; // Server socket address
+    struct session_table table; // Active client sessions
     int s; // Socket descriptor
-    FILE* fp; // File pointer for file being sent
 
     // Initialize server's address structure
     memset(&s_addr, 0, sizeof(s_addr)); // Clear structure
@@ -57,8 +371,8 @@ int main(int argc, char** argv) {
     s_addr.sin_port = htons(SERVER_PORT); // Set port number (converted to network byte order)
     s_addr.sin_addr.s_addr = INADDR_ANY; // Accept connections from any address
 
-    // Create a socket using UDP (SOCK_DGRAM)
-    if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    // Create a non-blocking socket using UDP (SOCK_DGRAM)
+    if ((s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) == -1) {
         print_error("Server: Socket"); // Print error if socket creation fails
     }
 
@@ -67,281 +381,1867 @@ int main(int argc, char** argv) {
         print_error("Server: Bind"); // Print error if binding fails
     }
 
-    // Main server loop
-    for (;;) {
-        printf("Server: Waiting for client to connect\n");
+    // Large buffers so a full window of big frames fits in socket queues
+    int sock_buf = SOCKET_BUF_SIZE;
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sock_buf, sizeof(sock_buf));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+
+    table_init(&table, max_sessions);
+    if (trace_path) {
+        trace_init(TRACE_DEFAULT_ENTRIES);
+    }
+    metrics_install_dump_signal(); // kill -USR1 prints metrics and writes trace
+    printf("Server: Waiting for clients (max %d sessions, batch size %d, %s I/O, simulator seed %llu)\n", max_sessions, batch_size,
+        uring_io ? "io_uring" : "classic", impair_seed);
+    if (pace_rate == PACE_BBR) {
+        printf("Server: Pacing sends at BBR's bandwidth estimate\n");
+    } else if (pace_rate > 0) {
+        printf("Server: Pacing each transfer at %g MB/s\n", pace_rate);
+    }
+    if (mcast_addr.sin_addr.s_addr) {
+        printf("Server: Multicast transfers go to %s:%d at %lld MB/s\n", inet_ntoa(mcast_addr.sin_addr), ntohs(mcast_addr.sin_port), mcast_rate);
+    }
 
-        // Clear buffers before receiving a message
-        memset(msg_recv, 0, sizeof(msg_recv));
-        memset(protocolType_recv, 0, sizeof(protocolType_recv));
-        memset(file_name_recv, 0, sizeof(file_name_recv));
-        memset(percent, 0, sizeof(percent));
-        length = sizeof(c_addr); // Length of client address
+    serve(s, &table, NULL); // Runs until a client asks server to exit
 
-        // Receive request message from client (protocol type, file name, drop percentage)
-        if ((numRead = recvfrom(s, msg_recv, BUF_SIZE, 0, (struct sockaddr*)&c_addr, &length)) == -1) {
-            print_error("Server: Received"); // Error handling for receiving data
-        }
-        printf("Protocol and File Name Requested: %s\n", msg_recv); // Output received request
+    file_cache_free(&file_cache);
+    free(table.slots);
+    free(table.buckets);
+    close(s); // Close socket when server is terminated
+    return 0;
+}
 
-        // Check for exit command
-        if (strcmp(msg_recv, "EXIT") == 0) {
-            printf("Server: Exiting...\n");
-            break; // Exit loop
+// Function to start serving a stream once its client's first ACK arrives from `c_addr`
+static struct session* stream_start(int s, struct session_table* t, struct stream_job* job, struct sockaddr_in* c_addr, socklen_t length) {
+    struct stat st;
+    FILE* fp = NULL;
+    if (job->file) {
+        st.st_size = job->file->size; // Session takes over job's reference
+    } else if (!(fp = fopen(job->file_name, "rb")) || fstat(fileno(fp), &st) == -1) {
+        perror("Server: Stream could not open file");
+        if (fp) {
+            fclose(fp);
         }
+        return NULL;
+    }
+    printf("Stream on port %d: frames %ld-%ld\n", ntohs(job->c_addr.sin_port), job->first_frame, job->last_frame);
+    struct session* sess = session_start(s, t, c_addr, length, job->protocol, job->file, fp, st.st_size, job->drop_percent,
+        job->payload_size, job->checksum, job->codec, &job->fec, job->window, job->pace_rate, job->first_frame, job->last_frame);
+    job->file = NULL;
+    return sess;
+}
 
-        // Parse received message (protocol type, file name, and drop percentage)
-        sscanf(msg_recv, "%s %s %s", protocolType_recv, file_name_recv, percent);
+// Function to run an event loop on one socket. Main loop (job == NULL) takes requests and ACKs from many
+// clients until one asks it to exit; a stream worker serves its one slice and returns when it is done.
+void serve(int s, struct session_table* t, struct stream_job* job) {
+    struct sockaddr_in c_addr; // Client socket address
+    socklen_t length; // Length of sockaddr_in structure
+    char msg_recv[BUF_SIZE]; // Buffer to store received message from client
+    struct epoll_event ev, events[MAX_EVENTS]; // epoll registration and ready list
+    ssize_t numRead; // Number of bytes read from socket
+    int ep; // epoll descriptor
+    int running = 1; // Cleared when a client asks server to exit or stream is done
+    int started = 0; // Stream worker: 1 once client's first ACK started session
+    long long start_deadline = now_us() + STREAM_START_US; // Stream worker gives up on client after this
 
-        // Check if file exists on server and has read permissions
-        if (access(file_name_recv, F_OK | R_OK) == 0) {
-            stat(file_name_recv, &st); // Get file information (size, etc.)
-            f_size = st.st_size; // File size in bytes
-            fp = fopen(file_name_recv, "rb"); // Open file for reading in binary mode
+    batch_init(&tx_batch, batch_size, sizeof(struct frame_packet));
+    batch_init(&rx_batch, batch_size, BUF_SIZE);
+    if (offload && !batch_enable_gso(s, &tx_batch) && !job && batch_size > 1) {
+        printf("Server: Kernel has no UDP segmentation offload, sending frames one datagram each\n");
+    }
+    if (uring_io && !(batch_enable_uring(s, &tx_batch) && batch_enable_uring(s, &rx_batch)) && !job && batch_size > 1) {
+        printf("Server: Kernel has no io_uring, using sendmmsg/recvmmsg\n");
+    }
 
-            // Calculate total number of frames required to send entire file
-            long int total_frame = (f_size % BUF_SIZE) == 0 ? (f_size / BUF_SIZE) : (f_size / BUF_SIZE) + 1;
-            printf("File size: %ld bytes\n", f_size); // Debug
-            printf("Total number of packets that will be sent -> %ld\n", total_frame);
+    // Register socket (or ring its datagrams arrive on) with epoll
+    if ((ep = epoll_create1(0)) == -1) {
+        print_error("Server: epoll_create1");
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = s;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, batch_poll_fd(s, &rx_batch), &ev) == -1) {
+        print_error("Server: epoll_ctl");
+    }
 
-            // Send `total_frame` to client before starting data transfer
-            if (sendto(s, &total_frame, sizeof(total_frame), 0, (struct sockaddr*)&c_addr, length) == -1) {
-                print_error("Server: Failed to send total frame count");
+    // Main event loop
+    while (running) {
+        if (!job) {
+            if (dump_requested) {
+                file_cache_print(stdout, &file_cache);
             }
+            metrics_poll_dump("Server", trace_path);
+        }
+        int timeout = next_timeout(t);
+        if (job && !started) {
+            long long wait = start_deadline - now_us();
+            timeout = wait > 0 ? (int)((wait + 999) / 1000) : 0;
+        }
+        int n = epoll_wait(ep, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print_error("Server: epoll_wait");
+        }
 
-            // Calculate frames to drop based on drop percentage
-            float drop_percent = atof(percent); // Convert drop percentage to a float
-            int* testdrop = generate_drops(total_frame, drop_percent); // Get array of frames to drop
-            int td = (int)(drop_percent * total_frame / 100); // Calculate total number of drops
-            printf("Total frame drop: %i\n\n", td); // Output total number of dropped frames
-            printf("Received protocol type: '%s'\n", protocolType_recv); // Debug
-
-            // Choose protocol based on client's request
-            if (strcmp(protocolType_recv, "1") == 0) { // Stop-and-Wait protocol if 1
-                printf("Stop and wait\n"); // Debug
-                stop_and_wait(s, &c_addr, length, fp, total_frame, testdrop, td);
-            } else if (strcmp(protocolType_recv, "2") == 0) { // Go-Back-N protocol if 2
-                printf("Go Back [N]\n"); // Debug
-                // Convert drop percentage to a probability (a float between 0 and 1)
-                float drop_probability = drop_percent / 100.0;
-                go_back_n(s, &c_addr, length, fp, total_frame, drop_probability);
-            } else {
-                printf("Invalid Protocol Type\n"); // Invalid protocol type received
+        // Drain every datagram queued on the socket
+        for (int e = 0; e < n && running; e++) {
+            for (;;) {
+                length = sizeof(c_addr); // Length of client address
+                numRead = batch_recv(s, &rx_batch, msg_recv, BUF_SIZE, &c_addr, &length);
+                if (numRead == -1) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        perror("Server: Received");
+                    }
+                    break; // Socket drained
+                }
+
+                // ACKs come from a client with an active session
+                struct session* sess = table_find(t, &c_addr);
+                struct ack_packet ack;
+                if (ack_parse(msg_recv, numRead, &ack)) {
+                    if (!sess) {
+                        // Stream worker: client's first ACK tells us where to send; otherwise a late ACK, not a request
+                        if (job && !started && c_addr.sin_addr.s_addr == job->c_addr.sin_addr.s_addr) {
+                            started = stream_start(s, t, job, &c_addr, length) != NULL;
+                            running = started;
+                        }
+                        continue;
+                    }
+                    // Reverse path simulation: ACK may be lost, duplicated or held back
+                    struct impair_verdict v = impair_decide(&sess->rev);
+                    if (v.copies == 0) {
+                        VLOG("ACK for frame# %ld dropped (simulated loss)\n", ack.cum_ack);
+                    }
+                    for (int c = 0; c < v.copies; c++) {
+                        if (v.delay[c] > 0) {
+                            delay_push(&ack_line, now_us() + v.delay[c], &c_addr, msg_recv, numRead);
+                        } else if (sess->in_use) { // First copy may have finished transfer
+                            dispatch_ack(s, t, sess, &ack);
+                        }
+                    }
+                    continue;
+                }
+                if (job) {
+                    continue; // Stream sockets only carry ACKs
+                }
+
+                struct transfer_request req;
+                int parsed = request_parse(msg_recv, numRead, &req);
+                if (parsed == 0) {
+                    VLOG("Ignoring %zd byte datagram that is not a request\n", numRead);
+                    continue;
+                }
+                if (parsed == -1) {
+                    // A layout we cannot read: say which version we speak, client reports it
+                    struct transfer_reply reply;
+                    memset(&reply, 0, sizeof(reply));
+                    reply.version = WIRE_VERSION;
+                    reply.status = REPLY_VERSION;
+                    printf("Request of wire version %d, this server speaks version %d\n", req.version, WIRE_VERSION);
+                    send_reply(s, &reply, &c_addr, length);
+                    continue;
+                }
+
+                // Check for exit command
+                if (req.protocol == PROTO_EXIT) {
+                    printf("Server: Exiting...\n");
+                    running = 0;
+                    break; // Exit loop
+                }
+
+                // Output received request
+                printf("Protocol and File Name Requested: %d %s %g (payload %ld, %d streams, window %d, frames %ld-%ld, checksum %d, FEC %d,%d,%d, codecs 0x%x)\n",
+                    req.protocol, req.file_name, req.drop_percent, req.payload_size, req.streams, req.window, req.first_frame, req.last_frame,
+                    (req.flags & REQ_CHECKSUM) != 0, req.fec_k, req.fec_m, (req.flags & REQ_FEC_ADAPT) != 0, req.codecs);
+                handle_request(s, t, &req, &c_addr, length);
             }
+        }
 
-            fclose(fp); // Close file after transmission
-            free(testdrop); // Free dynamically allocated memory for dropped frames
-        } else {
-            printf("Invalid Filename or File Not Accessible\n"); // File does not exist or is not readable
+        release_delayed(s, t); // Deliver datagrams whose simulated delay is over
+        expire_timers(s, t); // Retransmit for any session whose ACK timer ran out
+        batch_flush(s, &tx_batch); // Send every frame queued during this pass
+
+        // Stream worker is done once its session ends, or if client never showed up
+        if (job && (started ? t->active == 0 : now_us() >= start_deadline)) {
+            running = 0;
+        }
+    }
+
+    // Release remaining sessions
+    for (int i = 0; i < t->max_sessions; i++) {
+        if (t->slots[i].in_use) {
+            end_session(s, t, &t->slots[i]);
+        }
+    }
+    batch_flush(s, &tx_batch);
+    if (job) {
+        // Stream workers' syscalls are reported with main loop's
+        metric_add(&worker_io[0], tx_batch.calls);
+        metric_add(&worker_io[1], tx_batch.datagrams);
+        metric_add(&worker_io[2], rx_batch.calls);
+        metric_add(&worker_io[3], rx_batch.datagrams);
+        metric_add(&worker_io[4], tx_batch.offloaded);
+    } else {
+        printf("Send syscalls: %lld for %lld datagrams, receive syscalls: %lld for %lld datagrams\n",
+            tx_batch.calls + metric_get(&worker_io[0]), tx_batch.datagrams + metric_get(&worker_io[1]),
+            rx_batch.calls + metric_get(&worker_io[2]), rx_batch.datagrams + metric_get(&worker_io[3]));
+        if (offload) {
+            printf("Segmentation offload: %lld of %lld datagrams sent in GSO trains\n", tx_batch.offloaded + metric_get(&worker_io[4]),
+                tx_batch.datagrams + metric_get(&worker_io[1]));
         }
+        metrics_print(stdout, "Server");
+        file_cache_print(stdout, &file_cache);
+        if (trace_path) {
+            trace_dump(trace_path);
+        }
+    }
+    batch_free(&tx_batch);
+    batch_free(&rx_batch);
+    delay_free(&frame_line);
+    delay_free(&ack_line);
+    close(ep);
+}
 
+// Function to serve one stream of a parallel transfer on its own thread
+void* stream_worker(void* arg) {
+    struct stream_job* job = arg;
+    struct session_table table; // Holds this stream's one session
+    table_init(&table, 1);
+    serve(job->s, &table, job);
+    if (job->file) {
+        file_cache_release(&file_cache, job->file); // Client never showed up
     }
+    free(table.slots);
+    free(table.buckets);
+    close(job->s);
+    free(job);
+    return NULL;
+}
 
-    close(s); // Close socket when server is terminated
+// Function to open a socket on a free port for one stream, returns -1 on failure
+static int stream_socket(unsigned short* port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock_buf = SOCKET_BUF_SIZE;
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (s == -1) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = 0; // Kernel picks port
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) == -1 || getsockname(s, (struct sockaddr*)&addr, &len) == -1) {
+        close(s);
+        return -1;
+    }
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sock_buf, sizeof(sock_buf));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+    *port = addr.sin_port;
+    return s;
+}
+
+// Function to get frames [first, last] of stream i when frames [from, to] are split into n contiguous slices
+static void stream_slice(long int from, long int to, int n, int i, long int* first, long int* last) {
+    long int count = to - from + 1;
+    *first = from + count * i / n;
+    *last = from + count * (i + 1) / n - 1;
+}
+
+// Function to open a requested file: mapped through file cache, or with stdio when it cannot be mapped.
+// Sets st->st_size; returns -1 if file cannot be read.
+static int open_file(const char* name, struct file_entry** file, FILE** fp, struct stat* st) {
+    int hit;
+    *fp = NULL;
+    if ((*file = file_cache_open(&file_cache, name, &hit)) != NULL) {
+        st->st_dev = (*file)->dev;
+        st->st_ino = (*file)->ino;
+        st->st_size = (*file)->size;
+        st->st_mtim = (*file)->mtime;
+        printf("File cache: %s\n", hit ? "hit, no file opened" : "miss, file mapped");
+        return 0;
+    }
+    int err = errno;
+    if (!(*fp = fopen(name, "rb")) || fstat(fileno(*fp), st) == -1) {
+        if (*fp) {
+            fclose(*fp);
+        }
+        return -1;
+    }
+    errno = err;
+    perror("Server: mmap failed, using buffered reads");
     return 0;
 }
 
+// Function to let go of a bundle once its file entry's last user is done
+static void bundle_release(void* b) {
+    bundle_free(b);
+    free(b);
+}
+
+// Function to list every file a request names and build its manifest (see bundle.h), in a file entry that reads
+// frames from the files' own mappings. Sets st->st_size and `tag`; returns -1 (errno set) if a named path cannot be
+// read or the bundle is over its caps.
+static int open_bundle(const char* spec, struct file_entry** file, struct stat* st, unsigned int* tag) {
+    struct bundle* b = malloc(sizeof(*b));
+    if (!b || bundle_collect(b, spec) == -1) {
+        int err = errno;
+        free(b);
+        errno = err;
+        return -1;
+    }
+    if (!(*file = file_entry_source(spec, b->size, b, bundle_release))) {
+        perror("Server: Could not start bundle");
+        bundle_release(b);
+        errno = ENOMEM;
+        return -1;
+    }
+    printf("Bundle: %d files, %lld bytes of data after a %lld byte manifest\n", b->count, b->size - b->manifest_size, b->manifest_size);
+    st->st_size = b->size;
+    *tag = b->tag;
+    return 0;
+}
+
+// Function to let go of a file opened by open_file()
+static void close_file(struct file_entry* file, FILE* fp) {
+    if (file) {
+        file_cache_release(&file_cache, file);
+    } else if (fp) {
+        fclose(fp);
+    }
+}
+
+// Function to get a tag that changes whenever file does (new inode, size or modification time), never 0
+static unsigned int file_tag(const struct stat* st) {
+    long long id[5] = { (long long)st->st_dev, (long long)st->st_ino, (long long)st->st_size, (long long)st->st_mtim.tv_sec,
+        (long long)st->st_mtim.tv_nsec };
+    unsigned int tag = crc32c(0, id, sizeof(id));
+    return tag ? tag : 1;
+}
+
+// Function to send a reply in wire format
+void send_reply(int s, const struct transfer_reply* reply, struct sockaddr_in* c_addr, socklen_t length) {
+    unsigned char buf[REPLY_SIZE(MAX_STREAMS)];
+    if (sendto(s, buf, reply_encode(reply, buf), 0, (struct sockaddr*)c_addr, length) == -1) {
+        perror("Server: Failed to send total frame count");
+    }
+}
+
 // Function to print an error message and exit program
 void print_error(char* msg) {
     perror(msg); // Print error
     exit(EXIT_FAILURE); // Exit program with failure status
 }
 
-// Function to generate which frames to drop based on drop percentage
-int* generate_drops(int total_frame, float drop_percent) {
-    int td = (int)(drop_percent * total_frame / 100); // Calculate number of frames to drop
-    int* testdrop = (int*)malloc(td * sizeof(int)); // Allocate memory for drop array
-    if (!testdrop) { // If memory was not allocated correctly
-        print_error("Memory allocation failed for testdrop");
-    }
-    srand(time(NULL)); // Seed random number generator with current time
-
-    // Populate array with unique random frame numbers to drop
-    for (int i = 0; i < td; i++) {
-        int new_drop;
-        int duplicate;
-        do {
-            duplicate = 0;
-            new_drop = rand() % total_frame; // Make a random frame number based on total frames
-            // Check for duplicates
-            for (int j = 0; j < i; j++) {
-                if (testdrop[j] == new_drop) {
-                    duplicate = 1;
-                    break;
+// Function to hash a client address into a bucket index
+static int addr_hash(struct session_table* t, struct sockaddr_in* addr) {
+    unsigned int h = addr->sin_addr.s_addr * 2654435761u; // Multiplicative hash of IP
+    h ^= (unsigned int)addr->sin_port * 40503u; // Mix in port
+    return (int)(h % (unsigned int)t->n_buckets);
+}
+
+// Function to allocate an empty session table
+void table_init(struct session_table* t, int max_sessions) {
+    t->max_sessions = max_sessions;
+    t->n_buckets = max_sessions * 2 + 1; // Keep chains short
+    t->active = 0;
+    t->slots = calloc(max_sessions, sizeof(struct session));
+    t->buckets = malloc(t->n_buckets * sizeof(int));
+    if (!t->slots || !t->buckets) {
+        print_error("Memory allocation failed for session table");
+    }
+    for (int i = 0; i < t->n_buckets; i++) {
+        t->buckets[i] = -1;
+    }
+    wheel_init(&t->wheel, now_us());
+}
+
+// Function to look up session belonging to a client address
+struct session* table_find(struct session_table* t, struct sockaddr_in* addr) {
+    for (int i = t->buckets[addr_hash(t, addr)]; i != -1; i = t->slots[i].next) {
+        struct session* sess = &t->slots[i];
+        if (sess->c_addr.sin_addr.s_addr == addr->sin_addr.s_addr && sess->c_addr.sin_port == addr->sin_port) {
+            return sess;
+        }
+    }
+    return NULL;
+}
+
+// Function to claim a free slot for a new client, NULL if table is full
+struct session* table_insert(struct session_table* t, struct sockaddr_in* addr, socklen_t length) {
+    if (t->active >= t->max_sessions) {
+        return NULL;
+    }
+    for (int i = 0; i < t->max_sessions; i++) {
+        struct session* sess = &t->slots[i];
+        if (!sess->in_use) {
+            int b = addr_hash(t, addr);
+            memset(sess, 0, sizeof(*sess));
+            sess->in_use = 1;
+            sess->index = i;
+            sess->c_addr = *addr;
+            sess->length = length;
+            sess->next = t->buckets[b]; // Push onto bucket chain
+            t->buckets[b] = i;
+            t->active++;
+            return sess;
+        }
+    }
+    return NULL;
+}
+
+// Function to unlink a session from its bucket and free its slot
+void table_remove(struct session_table* t, struct session* sess) {
+    int idx = (int)(sess - t->slots);
+    int* link = &t->buckets[addr_hash(t, &sess->c_addr)];
+    while (*link != -1) {
+        if (*link == idx) {
+            *link = sess->next;
+            break;
+        }
+        link = &t->slots[*link].next;
+    }
+    sess->in_use = 0;
+    t->active--;
+}
+
+// Function to parse a client request and start a new transfer session
+void handle_request(int s, struct session_table* t, const struct transfer_request* req, struct sockaddr_in* c_addr, socklen_t length) {
+    struct stat st; // File status information
+    const char* file_name_recv = req->file_name; // File requested
+    int protocol = req->protocol; // 1 = Stop-and-Wait, 2 = Go-Back-N, 3 = Selective Repeat, 4 = Multicast
+    float drop_percent = req->drop_percent; // Simulated loss on frames
+    long int payload_size = req->payload_size; // Payload size client asked for (0 = server default)
+    int streams = req->streams; // Parallel streams client asked for
+    long int first = req->first_frame, last = req->last_frame; // Frame range client asked for (0 = from first / to last frame)
+    int checksum = (req->flags & REQ_CHECKSUM) != 0; // 1 = client asked for frame checksums and file digest
+    struct fec_config fec = { req->fec_k, req->fec_m, (req->flags & REQ_FEC_ADAPT) != 0 }; // FEC block size, starting parity and adaptation
+    int codecs = req->codecs; // Codecs client can unpack (bit n = codec n)
+    struct transfer_reply reply; // status says why a request was refused, total_frame 0 = nothing to send
+    struct file_entry* file; // File being sent, mapped through file cache
+    FILE* fp = NULL; // File pointer for file being sent when it cannot be mapped
+    int bundle = bundle_requested(file_name_recv); // 1 = request names a directory or list of files, sent as one bundle
+    unsigned int bundle_tag = 0; // Bundle's tag (a file's comes from its stat)
+
+    memset(&reply, 0, sizeof(reply));
+    reply.version = WIRE_VERSION;
+    reply.request_id = req->request_id;
+    reply.protocol = protocol;
+    reply.streams = 1;
+
+    // Agree on a payload size within server's limits
+    if (payload_size <= 0) {
+        payload_size = DEFAULT_PAYLOAD;
+    }
+    if (payload_size < MIN_PAYLOAD) {
+        payload_size = MIN_PAYLOAD;
+    }
+    if (payload_size > max_payload) {
+        payload_size = max_payload;
+    }
+    reply.payload_size = payload_size;
+
+    // Agree on a window: Stop-and-Wait has one frame in flight; otherwise -w by default, and client may ask for any window up to it
+    int window = protocol == 1 ? 1 : max_window;
+    if (protocol != 1 && req->window > 0) {
+        window = req->window < max_window ? req->window : max_window;
+    }
+    reply.window = window;
+
+    // A new request from a client with an active session replaces it
+    struct session* old = table_find(t, c_addr);
+    if (old) {
+        printf("Client restarted, abandoning previous transfer\n");
+        end_session(s, t, old);
+    }
+
+    if (protocol < 1 || protocol > 4) {
+        printf("Invalid Protocol Type\n"); // Invalid protocol type received
+        reply.status = REPLY_BAD_REQUEST;
+    } else if (t->active >= t->max_sessions) {
+        printf("Server busy (%d sessions), rejecting request\n", t->active);
+        reply.status = REPLY_BUSY;
+    } else if (bundle ? open_bundle(file_name_recv, &file, &st, &bundle_tag) == -1
+                      : open_file(file_name_recv, &file, &fp, &st) == -1) { // Check if file exists on server and has read permissions
+        if (bundle && (errno == E2BIG || errno == EFBIG)) {
+            printf("Bundle refused: more than %d files or %lld bytes\n", BUNDLE_MAX_FILES, BUNDLE_MAX_BYTES);
+            reply.status = REPLY_TOO_BIG;
+        } else {
+            printf("Invalid Filename or File Not Accessible\n"); // File does not exist or is not readable
+            reply.status = REPLY_NO_FILE;
+        }
+    } else {
+        off_t f_size = st.st_size; // File size in bytes
+
+        // Calculate total number of frames required to send entire file
+        long int total_frame = (f_size % payload_size) == 0 ? (f_size / payload_size) : (f_size / payload_size) + 1;
+        printf("File size: %ld bytes\n", f_size); // Debug
+        printf("Total number of packets that will be sent -> %ld (%ld bytes each)\n", total_frame, payload_size);
+
+        // Serve requested range of frames, clamped to file (whole file by default)
+        if (first < 1) {
+            first = 1;
+        }
+        if (last < 1 || last > total_frame) {
+            last = total_frame;
+        }
+        if (first > last) {
+            first = last = 0; // Nothing to send
+        } else if (first != 1 || last != total_frame) {
+            printf("Sending frames %ld-%ld\n", first, last);
+        }
+        reply.first_frame = first;
+        reply.last_frame = last;
+        reply.checksum = checksum;
+        reply.file_tag = bundle ? bundle_tag : file_tag(&st);
+        reply.flags = bundle ? REPLY_BUNDLE : 0;
+
+        // Stop-and-Wait and multicast always use one stream; others get at most one stream per frame
+        if (streams > MAX_STREAMS) {
+            streams = MAX_STREAMS;
+        }
+        if (protocol == 1 || protocol == 4 || streams < 1) {
+            streams = 1;
+        }
+
+        // FEC needs frames in flight past a loss, so Stop-and-Wait never uses it; multicast repairs from NACKs instead
+        if (protocol == 1 || protocol == 4 || fec.k < 2 || fec.k > FEC_MAX_DATA) {
+            fec.k = 0;
+        } else {
+            fec.m = fec.m < 1 ? 1 : fec.m > FEC_MAX_PARITY ? FEC_MAX_PARITY : fec.m;
+            fec.adapt = fec.adapt != 0;
+            printf("FEC: blocks of %d frames, %d parity frames per block%s\n", fec.k, fec.m, fec.adapt ? " to start with" : "");
+        }
+        reply.fec_k = fec.k;
+        reply.file_size = f_size;
+
+        // Best codec both sides have
+        int codec = codec_choose(codecs);
+        if (codecs) {
+            printf("Compression: %s\n", codec == CODEC_NONE ? "none of client's codecs available, sending raw frames" : codec_names[codec]);
+        }
+        reply.codec = codec;
+        if (streams > last - first + 1) {
+            streams = (int)(last - first + 1);
+        }
+
+        // Parallel transfer: one socket per stream first, so a failure can still fall back to one stream
+        int socks[MAX_STREAMS];
+        int opened = 0;
+        while (streams > 1 && opened < streams && (socks[opened] = stream_socket(&reply.port[opened])) != -1) {
+            opened++;
+        }
+        if (streams > 1 && opened < streams) {
+            perror("Server: Stream socket failed, using one stream");
+            while (opened > 0) {
+                close(socks[--opened]);
+            }
+            streams = 1;
+        }
+
+        if (total_frame == 0 || first == 0) {
+            close_file(file, fp); // Nothing to send for an empty file or range
+        } else if (protocol == 4) {
+            // Multicast always sends whole file; receivers' drop percentage is applied on their side
+            if (mcast_join(file_name_recv, file, fp, f_size, total_frame, payload_size, checksum, codecs, codec, &reply) == -1) {
+                printf("Server busy (%d multicast transfers), rejecting request\n", MAX_GROUPS);
+                reply.status = REPLY_BUSY;
+            }
+        } else if (streams > 1) {
+            reply.streams = streams;
+            reply.total_frame = total_frame;
+            printf("Splitting transfer into %d streams\n", streams);
+            for (int i = 0; i < streams; i++) {
+                struct stream_job* job = calloc(1, sizeof(*job));
+                pthread_t thread;
+                if (!job) {
+                    print_error("Memory allocation failed for stream");
                 }
+                job->s = socks[i];
+                job->c_addr = *c_addr;
+                job->c_addr.sin_port = reply.port[i]; // Only used to label log lines until client's port is known
+                job->protocol = protocol;
+                snprintf(job->file_name, sizeof(job->file_name), "%s", file_name_recv);
+                job->drop_percent = drop_percent;
+                job->payload_size = payload_size;
+                job->checksum = checksum;
+                job->fec = fec;
+                job->codec = codec;
+                job->window = window;
+                job->pace_rate = pace_rate > 0 ? pace_rate / streams : pace_rate; // A fixed rate is shared by streams
+                if (file) {
+                    file_cache_ref(&file_cache, file); // Each stream shares mapping
+                    job->file = file;
+                }
+                stream_slice(first, last, streams, i, &job->first_frame, &job->last_frame);
+                if (pthread_create(&thread, NULL, stream_worker, job) != 0) {
+                    print_error("Server: pthread_create");
+                }
+                pthread_detach(thread);
             }
-        } while (duplicate); // Keep generating until unique
-        testdrop[i] = new_drop;
-        printf("Frame to drop: %d\n", testdrop[i]);
+            close_file(file, fp); // Streams hold their own reference, or open file themselves
+            send_reply(s, &reply, c_addr, length);
+            return;
+        } else {
+            // Send `total_frame` and payload size to client before starting data transfer
+            reply.total_frame = total_frame;
+            send_reply(s, &reply, c_addr, length);
+            session_start(s, t, c_addr, length, protocol, file, fp, f_size, drop_percent, payload_size, checksum, codec, &fec, window,
+                protocol == 1 ? 0 : pace_rate, first, last);
+            return;
+        }
     }
 
-    return testdrop; // Return array of dropped frames
+    // Tell client there is nothing to receive, or why it was refused
+    send_reply(s, &reply, c_addr, length);
+}
+
+// Function to give a session frames [first, last] of an open file to send, with checksums and codec
+static void session_open_file(struct session* sess, struct file_entry* file, FILE* fp, off_t f_size, long int payload_size,
+    int checksum, int codec, long int first, long int last) {
+    // Frames are sent straight from file cache's mapping, or read from a bundle's files; stdio is fallback
+    sess->file = file;
+    sess->fp = fp;
+    if (file) {
+        sess->map = file->map;
+        sess->map_len = f_size;
+        sess->bundle = file->source;
+    }
+    sess->file_size = f_size;
+    sess->first_frame = first;
+    sess->total_frame = last;
+    sess->payload_size = payload_size;
+    sess->checksum = checksum;
+    sess->digest_next = first;
+    if (checksum) {
+        sess->digest_shift = malloc(4 * sizeof(*sess->digest_shift));
+        if (!sess->digest_shift) {
+            print_error("Memory allocation failed for digest");
+        }
+        crc32c_zeros(sess->digest_shift, payload_size);
+        if (file) {
+            sess->frame_crc = file_cache_crcs(&file_cache, file, payload_size);
+        }
+    }
+    if (codec_init(&sess->codec, codec, payload_size, 1) == -1) {
+        print_error("Memory allocation failed for codec");
+    }
 }
 
-// Implementation of Stop-and-Wait ARQ protocol
-void stop_and_wait(int s, struct sockaddr_in* c_addr, socklen_t length, FILE* fp, int total_frame, int* testdrop, int td) {
-    struct frame_packet frame;  // Frame structure for sending data
-    int ack_num = 0, drop_frame = 0, resend_frame = 0;  // Variables for tracking acknowledgments, drops, and resends
-    long int i = 1;  // Frame counter starts at 1
-    int resend_limit = 5;  // Maximum number of retries for each frame
-    int retry_count = 0;   // Track how many times frame has been resent
+// Function to print a session's compression ratio and let go of its file, digest tables and codec
+static void session_close_file(int s, struct session* sess) {
+    if (sess->codec.codec != CODEC_NONE) {
+        printf("Compression: %s, %lld of %lld frames packed, %lld bytes sent as %lld (%.1f%%)\n", codec_names[sess->codec.codec],
+            sess->codec.packed, sess->codec.frames, sess->codec.raw_bytes, sess->codec.wire_bytes,
+            sess->codec.raw_bytes ? 100.0 * sess->codec.wire_bytes / sess->codec.raw_bytes : 100.0);
+    }
+    if (sess->map) {
+        batch_flush(s, &tx_batch); // Queued frames may still point into mapping
+    }
+    close_file(sess->file, sess->fp); // Close file after transmission (mapping stays in file cache)
+    free(sess->digest_shift);
+    codec_free(&sess->codec, 1);
+}
 
-    // Loop through all frames to be sent
-    while (i <= total_frame) {
-        memset(&frame, 0, sizeof(frame));  // Clear frame structure
-        frame.ID = i;  // Set frame ID (Sequence Number)
-        frame.length = fread(frame.data, 1, BUF_SIZE, fp);  // Read data from file into frame
+// Function to set up a session that sends frames [first, last] of an open file and send its first frames
+struct session* session_start(int s, struct session_table* t, struct sockaddr_in* c_addr, socklen_t length, int protocol,
+    struct file_entry* file, FILE* fp, off_t f_size, float drop_percent, long int payload_size, int checksum, int codec, const struct fec_config* fec, int window, double pace, long int first, long int last) {
+    struct session* sess = table_insert(t, c_addr, length);
 
-        if (frame.length <= 0) {
-            // End of file or error, no need to send this frame
-            break;
+    sess->protocol = protocol;
+    session_open_file(sess, file, fp, f_size, payload_size, checksum, codec, first, last);
+    sess->fec = *fec;
+    if (fec->k && !sess->map) {
+        sess->fec_buf = malloc((size_t)fec->k * payload_size);
+        if (!sess->fec_buf) {
+            print_error("Memory allocation failed for FEC");
         }
+    }
+    sess->base = first;
+    sess->next_seq_num = first;
+    sess->started = now_us();
+    rto_init(&sess->rto);
+    sess->wheel = &t->wheel;
+    timer_init(&sess->rtx_timer, TIMER_RTX, sess, 0);
+    timer_init(&sess->pace_timer, TIMER_PACE, sess, 0);
 
-        // Check if frame should be dropped (only simulate drop once per frame)
-        int drop = 0;
-        for (int j = 0; j < td; j++) {
-            if (frame.ID == testdrop[j]) {  // If frame ID matches a drop frame
-                drop = 1;
-                break;
+    // Seed simulator: one PRNG stream per direction per session, so runs repeat for a given seed
+    unsigned long long serial = atomic_fetch_add(&sessions_started, 1);
+    struct impair_model model = frame_model;
+    model.loss = drop_percent / 100.0;
+    impair_init(&sess->fwd, &model, impair_seed, 2 * serial);
+    impair_init(&sess->rev, &ack_model, impair_seed, 2 * serial + 1);
+    sess->index = (int)serial;
+
+    if (sess->protocol == 1) { // Stop-and-Wait protocol if 1
+        printf("Stop and wait\n"); // Debug
+        sess->window_size = 1;
+        sess->ring_size = 1;
+    } else { // Go-Back-N protocol if 2, Selective Repeat protocol if 3
+        printf(sess->protocol == 2 ? "Go Back [N]\n" : "Selective Repeat\n"); // Debug
+        sess->cwnd = INITIAL_CWND < window ? INITIAL_CWND : window; // Start in slow start
+        sess->ssthresh = window;
+        sess->window_size = (int)sess->cwnd;
+        sess->max_cwnd = sess->window_size;
+        sess->ring_size = window;
+    }
+    sess->window_limit = sess->ring_size;
+    if (sess->ring_size < fec->k) {
+        sess->ring_size = fec->k; // Window always reaches end of its first frame's block
+    }
+
+    // Per-frame window state
+    sess->acked = calloc(sess->ring_size, sizeof(char));
+    sess->sent_at = calloc(sess->ring_size, sizeof(long long));
+    sess->resent = calloc(sess->ring_size, sizeof(char));
+    if (!sess->acked || !sess->sent_at || !sess->resent) {
+        print_error("Memory allocation failed for session window");
+    }
+    if (sess->protocol == 3) {
+        sess->frame_timers = malloc(sess->ring_size * sizeof(struct timer));
+        if (!sess->frame_timers) {
+            print_error("Memory allocation failed for session window");
+        }
+        for (int i = 0; i < sess->ring_size; i++) {
+            timer_init(&sess->frame_timers[i], TIMER_FRAME, sess, 0);
+        }
+    }
+
+    // Pacing: a fixed rate from the start, or bandwidth estimate once first ACKs give one (unpaced until then)
+    if (pace != 0) {
+        pacer_init(&sess->pace, pace > 0 ? pace : 0, FRAME_HEADER_SIZE + payload_size, sess->started);
+        sess->pace_bbr = pace == PACE_BBR;
+        if (sess->pace_bbr) {
+            bw_init(&sess->bw);
+            sess->delivery = calloc(sess->ring_size, sizeof(*sess->delivery));
+            if (!sess->delivery) {
+                print_error("Memory allocation failed for session window");
             }
         }
+    }
+
+    switch (sess->protocol) {
+    case 1:
+        stop_and_wait_start(s, sess);
+        break;
+    case 2:
+        go_back_n_fill(s, sess);
+        break;
+    default:
+        selective_repeat_fill(s, sess);
+        break;
+    }
+    return sess;
+}
+
+// Function to print transfer summary and release a session
+void end_session(int s, struct session_table* t, struct session* sess) {
+    // Print summary
+    printf("\nTotal frames attempted to be sent: %ld\n", sess->total_frame - sess->first_frame + 1);
+    printf("Total frames dropped: %lld\n", sess->fwd.dropped);
+    printf("Total frames resent: %i\n", sess->resend_frame);
+    long long elapsed = now_us() - sess->started;
+    printf("Session: %ld frames (%lld bytes) sent, %d timeouts, %.3f s, goodput %.2f MB/s\n", sess->frames_sent,
+        sess->bytes_sent, sess->timeouts, elapsed / 1e6,
+        elapsed > 0 ? (double)(frame_offset(sess, sess->base) - frame_offset(sess, sess->first_frame)) / elapsed : 0);
+    metric_add(&metrics.sessions, 1);
+    hist_add(&metrics.transfer, elapsed);
+    printf("Smoothed RTT: %lld us, final RTO: %lld us\n", sess->rto.srtt, rto_current(&sess->rto));
+    if (impair_active(&sess->fwd.m) || impair_active(&sess->rev.m)) {
+        printf("Simulated: %lld frames duplicated, %lld delayed, %lld reordered, %lld corrupted; %lld ACKs dropped, %lld delayed\n",
+            sess->fwd.duplicated, sess->fwd.delayed, sess->fwd.reordered, sess->fwd.corrupted, sess->rev.dropped, sess->rev.delayed);
+    }
+    if (sess->protocol == 2 || sess->protocol == 3) {
+        printf("Congestion window: final %d, max %d, ceiling %d frames\n", sess->window_size, sess->max_cwnd, sess->window_limit);
+    }
+    if (sess->pace.rate > 0 || sess->pace_bbr) {
+        printf("Pacing: %s, final rate %.2f MB/s, sender waited %lld times", sess->pace_bbr ? "BBR" : "fixed", sess->pace.rate,
+            sess->pace.waits);
+        if (sess->pace_bbr) {
+            printf("; bandwidth %.2f MB/s, min RTT %lld us, %ld rounds, ended in %s", bw_estimate(&sess->bw), sess->bw.min_rtt,
+                sess->bw.round, pace_mode_names[sess->bw.mode]);
+        }
+        printf("\n");
+    }
+    if (sess->fec.k) {
+        printf("FEC: %ld parity frames for %ld blocks of %d frames, %d parity frames per block at end, loss estimate %.2f%%\n",
+            sess->fec_parity_sent, sess->fec_blocks, sess->fec.k, sess->fec.m, sess->fec_loss * 100);
+    }
+    session_close_file(s, sess);
+    delay_purge(&frame_line, &sess->c_addr); // Held datagrams must not leak into client's next transfer
+    delay_purge(&ack_line, &sess->c_addr);
+    wheel_cancel(sess->wheel, &sess->rtx_timer);
+    wheel_cancel(sess->wheel, &sess->pace_timer);
+    for (int i = 0; sess->frame_timers && i < sess->ring_size; i++) {
+        wheel_cancel(sess->wheel, &sess->frame_timers[i]);
+    }
+    free(sess->frame_timers);
+    free(sess->acked);
+    free(sess->sent_at);
+    free(sess->resent);
+    free(sess->delivery);
+    free(sess->fec_buf);
+    table_remove(t, sess);
+    printf("Active sessions: %d\n", t->active);
+}
 
-        // Handle frame dropping simulation (don't increment retry count yet)
-        if (drop) {
-            printf("frame.id# %ld dropped (simulated loss)\n", frame.ID);
-            drop_frame++;  // Increment drop count
+// Function to hand an acknowledgment to its session's protocol
+void dispatch_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack) {
+    metric_add(&metrics.acks_received, 1);
+    trace_event(TR_ACK_RX, sess->index, ack->cum_ack, ack->n_blocks);
+    if (sess->fec.k) {
+        fec_feedback(sess, ack);
+    }
+    switch (sess->protocol) {
+    case 1:
+        stop_and_wait_ack(s, t, sess, ack);
+        break;
+    case 2:
+        go_back_n_ack(s, t, sess, ack);
+        break;
+    default:
+        selective_repeat_ack(s, t, sess, ack);
+        break;
+    }
+}
+
+// Function to send frames and deliver ACKs whose simulated delay is over
+void release_delayed(int s, struct session_table* t) {
+    long long now = now_us();
+    struct delayed_datagram e;
+
+    while (delay_pop(&frame_line, now, &e)) {
+        if (batch_send(s, &tx_batch, e.data, e.len, &e.addr) == -1) {
+            perror("Server: Send delayed frame failed");
+        }
+        free(e.data);
+    }
+    while (delay_pop(&ack_line, now, &e)) {
+        struct session* sess = table_find(t, &e.addr);
+        struct ack_packet ack;
+        if (sess && ack_parse(e.data, e.len, &ack)) {
+            dispatch_ack(s, t, sess, &ack);
         }
+        free(e.data);
+    }
+}
 
-        // Resend loop in case acknowledgment fails
-        while (retry_count <= resend_limit) {
-            if (!drop) {
-                // Send frame to client
-                if (sendto(s, &frame, sizeof(frame), 0, (struct sockaddr*)c_addr, length) == -1) {
-                    print_error("Server: Send frame failed");
-                } else {
-                    printf("Frame# %ld sent (retry count: %d)\n", frame.ID, retry_count);
-                    if (retry_count > 0) {
-                        resend_frame++;  // Increment resend count for retries
-                    }
-                }
+// Function to get CRC32C of a frame's data, from file cache once any session has sent that frame
+static unsigned int frame_data_crc(struct session* sess, long int id, const char* data, long int len) {
+    if (!sess->frame_crc) {
+        return crc32c(0, data, len);
+    }
+    atomic_ullong* slot = &sess->frame_crc[id - 1];
+    unsigned long long known = atomic_load_explicit(slot, memory_order_relaxed);
+    if (known & FILE_CRC_KNOWN) {
+        return (unsigned int)known;
+    }
+    unsigned int crc = crc32c(0, data, len);
+    atomic_store_explicit(slot, FILE_CRC_KNOWN | crc, memory_order_relaxed); // Racing writers store same value
+    return crc;
+}
+
+// Function to fill in a frame's flags, digest and checksum once ID and length are set, and write its header;
+// `data` is frame's payload wherever it lives. The first time a frame is sealed its data is added to session's
+// digest. With a codec the payload may be packed into frame->data; returns where payload to send now lives.
+static const char* frame_seal(struct session* sess, struct frame_packet* frame, const char* data) {
+    unsigned int crc = 0;
+    frame->flags = 0;
+    frame->digest = 0;
+    frame->fec = 0;
+    frame->crc = 0;
+    if (sess->checksum) {
+        crc = frame_data_crc(sess, frame->ID, data, frame->length);
+        if (frame->ID == sess->digest_next) {
+            // Append frame to digest: shift digest past a full frame and xor in frame's CRC (short last frame is just read again)
+            sess->digest = frame->length == sess->payload_size ? crc32c_shift(sess->digest_shift, sess->digest) ^ crc
+                : crc32c(sess->digest, data, frame->length);
+            sess->digest_next++;
+        }
+        if (frame->ID == sess->total_frame) {
+            frame->flags |= FRAME_DIGEST;
+            frame->digest = sess->digest;
+        }
+    }
+    if (sess->codec.codec != CODEC_NONE) {
+        // Digest covers file's bytes, checksum covers bytes on wire
+        long int packed = codec_pack(&sess->codec, data, frame->length);
+        if (packed) {
+            memcpy(frame->data, sess->codec.buf, packed);
+            frame->length = packed;
+            frame->flags |= FRAME_PACKED;
+            data = frame->data;
+            crc = sess->checksum ? crc32c(0, data, packed) : 0;
+            metric_add(&metrics.packed, 1);
+        }
+    }
+    frame_encode(frame, crc, sess->checksum);
+    return data;
+}
+
+// Function to read `len` bytes of a session's file at `offset` into `buf` when it is not mapped: from a bundle's
+// files, or with stdio. Returns bytes read.
+static size_t session_read(struct session* sess, char* buf, size_t len, long long offset) {
+    if (sess->bundle) {
+        return bundle_read(sess->bundle, buf, len, offset);
+    }
+    fseek(sess->fp, offset, SEEK_SET);
+    return fread(buf, 1, len, sess->fp);
+}
+
+// Function to copy one frame of a session's file into `frame`, returns bytes on wire
+static size_t load_frame(struct session* sess, long int id, struct frame_packet* frame) {
+    frame->ID = id;
+    if (sess->map) {
+        size_t offset = (size_t)(id - 1) * sess->payload_size;
+        size_t left = sess->map_len - offset;
+        frame->length = left < (size_t)sess->payload_size ? (long int)left : sess->payload_size;
+        memcpy(frame->data, sess->map + offset, frame->length);
+    } else {
+        frame->length = session_read(sess, frame->data, sess->payload_size, (long long)(id - 1) * sess->payload_size);
+    }
+    frame_seal(sess, frame, frame->data);
+    return FRAME_HEADER_SIZE + frame->length;
+}
+
+// Function to send one frame of a session's file right away
+static void send_frame_now(int s, struct session* sess, long int id) {
+    struct frame_packet frame;
+    ssize_t r;
+
+    if (sess->map) {
+        // Zero-copy: header from stack, payload gathered straight from mapping
+        size_t offset = (size_t)(id - 1) * sess->payload_size;
+        size_t left = sess->map_len - offset;
+        frame.ID = id;
+        frame.length = left < (size_t)sess->payload_size ? (long int)left : sess->payload_size;
+        if (frame_seal(sess, &frame, sess->map + offset) == frame.data) {
+            r = batch_send(s, &tx_batch, frame.header, FRAME_HEADER_SIZE + frame.length, &sess->c_addr); // Packed copy
+        } else {
+            r = batch_send_gather(s, &tx_batch, frame.header, FRAME_HEADER_SIZE, sess->map + offset, frame.length, &sess->c_addr);
+        }
+    } else {
+        frame.ID = id;
+        frame.length = session_read(sess, frame.data, sess->payload_size, (long long)(id - 1) * sess->payload_size);
+        frame_seal(sess, &frame, frame.data);
+        r = batch_send(s, &tx_batch, frame.header, FRAME_HEADER_SIZE + frame.length, &sess->c_addr); // Header plus bytes in use
+    }
+
+    if (r == -1) {
+        perror("Server: Send frame failed"); // Socket buffer full counts as a loss, ARQ recovers it
+    } else {
+        VLOG("Frame# %ld sent\n", frame.ID);
+    }
+}
+
+// Function to send one copy of a frame built in memory, with one bit flipped (`corrupt_bit` >= 0) or held back (`delay` > 0)
+static void send_copy(int s, struct session* sess, struct frame_packet* frame, size_t len, long long delay, long long corrupt_bit) {
+    size_t bit = (size_t)(((unsigned long long)corrupt_bit * (len * 8)) >> 32);
+    if (corrupt_bit >= 0) {
+        // Flip one bit anywhere in datagram after checksum was computed, as a bad link would
+        frame->header[bit / 8] ^= 1 << (bit % 8);
+        VLOG("Frame ID# %ld corrupted (simulated bit flip at byte %zu)\n", frame->ID, bit / 8);
+    }
+    if (delay > 0) {
+        delay_push(&frame_line, now_us() + delay, &sess->c_addr, frame->header, len);
+    } else if (batch_send(s, &tx_batch, frame->header, len, &sess->c_addr) == -1) {
+        perror("Server: Send frame failed");
+    }
+    if (corrupt_bit >= 0) {
+        frame->header[bit / 8] ^= 1 << (bit % 8); // Both calls above copied datagram, so restore it for next copy
+    }
+}
+
+// Function to send one frame through simulated network: it may be dropped, duplicated, corrupted or held back
+void send_frame(int s, struct session* sess, long int id) {
+    struct impair_verdict v = impair_decide(&sess->fwd);
+    if (v.copies == 0) {
+        VLOG("Frame ID# %ld dropped (simulated loss)\n", id);
+        trace_event(TR_DROP, sess->index, id, 0);
+        if (sess->checksum && id == sess->digest_next) {
+            struct frame_packet frame;
+            load_frame(sess, id, &frame); // Digest still takes in a frame lost on its first send
+        }
+    }
+    for (int c = 0; c < v.copies; c++) {
+        if (v.delay[c] > 0 || v.corrupt_bit[c] >= 0) {
+            struct frame_packet frame;
+            size_t len = load_frame(sess, id, &frame);
+            send_copy(s, sess, &frame, len, v.delay[c], v.corrupt_bit[c]);
+        } else {
+            send_frame_now(s, sess, id);
+        }
+    }
+}
+
+// Function to send a block's parity frames once its last data frame (`id`) has been sent for the first time.
+// Parity goes through simulated network like any frame, and is never resent.
+static void send_parity(int s, struct session* sess, long int id) {
+    int k = sess->fec.k;
+    if (!k || (id != sess->total_frame && (id - sess->first_frame + 1) % k != 0)) {
+        return;
+    }
+    long int first = id - (id - sess->first_frame) % k; // Block's first frame
+    int n = (int)(id - first + 1);
+    const unsigned char* data[FEC_MAX_DATA];
+    long int len[FEC_MAX_DATA];
+    for (int i = 0; i < n; i++) {
+        long long offset = frame_offset(sess, first + i);
+        len[i] = (long int)(frame_offset(sess, first + i + 1) - offset);
+        if (sess->map) {
+            data[i] = (const unsigned char*)sess->map + offset;
+        } else {
+            char* buf = sess->fec_buf + (size_t)i * sess->payload_size;
+            len[i] = (long int)session_read(sess, buf, len[i], offset);
+            data[i] = (const unsigned char*)buf;
+        }
+    }
+
+    struct frame_packet frame;
+    for (int j = 0; j < sess->fec.m; j++) {
+        frame.ID = first;
+        frame.length = len[0]; // Block's longest frame; shorter ones count as zero padded
+        fec_encode((unsigned char*)frame.data, j, data, len, n, frame.length);
+        frame.flags = FRAME_PARITY;
+        frame.digest = 0;
+        frame.fec = (unsigned int)(sess->fec.m << 8 | j);
+        frame_encode(&frame, sess->checksum ? crc32c(0, frame.data, frame.length) : 0, sess->checksum);
+        size_t bytes = FRAME_HEADER_SIZE + frame.length;
+
+        struct impair_verdict v = impair_decide(&sess->fwd);
+        if (v.copies == 0) {
+            VLOG("Parity frame %d of block at frame# %ld dropped (simulated loss)\n", j, first);
+        }
+        for (int c = 0; c < v.copies; c++) {
+            send_copy(s, sess, &frame, bytes, v.delay[c], v.corrupt_bit[c]);
+        }
+        VLOG("Parity frame %d of %d for frames %ld-%ld sent\n", j, sess->fec.m, first, id);
+        sess->fec_parity_sent++;
+        metric_add(&metrics.parity, 1);
+        trace_event(TR_PARITY, sess->index, first, j);
+    }
+    sess->fec_blocks++;
+}
+
+// Function to update parity per block from loss totals the client reports in its ACKs
+void fec_feedback(struct session* sess, const struct ack_packet* ack) {
+    unsigned int shares = ack->fec_shares - sess->fec_shares;
+    unsigned int lost = ack->fec_lost - sess->fec_lost;
+    if (!sess->fec.adapt || (int)shares <= 0 || lost > shares) {
+        return; // Nothing new, or an older ACK arriving late
+    }
+    // Each finished block weighs in as one sample of the loss rate
+    double keep = 1;
+    for (unsigned int b = 0; b == 0 || b < shares / (unsigned int)(sess->fec.k + sess->fec.m); b++) {
+        keep *= 1 - FEC_LOSS_GAIN;
+    }
+    sess->fec_loss += (1 - keep) * ((double)lost / shares - sess->fec_loss);
+    sess->fec_shares = ack->fec_shares;
+    sess->fec_lost = ack->fec_lost;
+    int m = fec_parity_for(sess->fec.k, sess->fec_loss);
+    if (m != sess->fec.m) {
+        VLOG("FEC: loss estimate %.2f%%, now %d parity frames per block\n", sess->fec_loss * 100, m);
+        sess->fec.m = m;
+    }
+}
+
+// Function to get first frame past send window: window_size frames from base, and with FEC at least to end of base's block
+// so a block's parity can always follow its last frame
+static long int window_end(struct session* sess) {
+    long int end = sess->base + sess->window_size;
+    if (sess->fec.k) {
+        long int block_end = sess->base - (sess->base - sess->first_frame) % sess->fec.k + sess->fec.k;
+        if (block_end > end) {
+            end = block_end;
+        }
+    }
+    return end;
+}
+
+// Function to get a frame's byte offset in file (offset of frame total_frame + 1 is file size)
+long long frame_offset(struct session* sess, long int id) {
+    long long offset = (long long)(id - 1) * sess->payload_size;
+    return offset < sess->file_size ? offset : sess->file_size;
+}
+
+// Function to record a frame's (re)transmission time for RTT sampling, and count it
+static void mark_sent(struct session* sess, long int id, int retransmit) {
+    int slot = id % sess->ring_size;
+    long long bytes = frame_offset(sess, id + 1) - frame_offset(sess, id);
+    sess->frames_sent++;
+    sess->bytes_sent += bytes;
+    metric_add(&metrics.frames_sent, 1);
+    metric_add(&metrics.bytes_sent, bytes);
+    if (retransmit) {
+        metric_add(&metrics.retransmits, 1);
+    }
+    trace_event(retransmit ? TR_RESEND : TR_SEND, sess->index, id, bytes);
+    sess->sent_at[slot] = now_us();
+    sess->resent[slot] = retransmit;
+    pacer_spend(&sess->pace, FRAME_HEADER_SIZE + bytes);
+    if (sess->delivery) {
+        bw_on_send(&sess->bw, &sess->delivery[slot], !retransmit && id == sess->base, sess->sent_at[slot]); // First send of base: nothing in flight
+    }
+    if (!retransmit) {
+        sess->acked[slot] = 0; // Slot now belongs to a new frame
+    }
+    if (sess->frame_timers) {
+        sess->frame_timers[slot].id = id; // Selective Repeat: frame's own timer runs from this send
+        wheel_arm(sess->wheel, &sess->frame_timers[slot], sess->sent_at[slot] + rto_current(&sess->rto));
+    }
+}
+
+// Function to mark a frame received, stopping its Selective Repeat timer
+static void mark_acked(struct session* sess, long int id) {
+    int slot = id % sess->ring_size;
+    sess->acked[slot] = 1;
+    if (sess->frame_timers) {
+        wheel_cancel(sess->wheel, &sess->frame_timers[slot]);
+    }
+}
+
+// Function to take an RTT sample from an acknowledged frame (Karn's rule: skip retransmitted frames)
+static void sample_rtt(struct session* sess, long int id) {
+    int slot = id % sess->ring_size;
+    if (!sess->resent[slot]) {
+        long long rtt = now_us() - sess->sent_at[slot];
+        int first = !sess->rto.has_sample;
+        rto_sample(&sess->rto, rtt);
+        for (long int i = sess->base; first && sess->frame_timers && i < sess->next_seq_num; i++) {
+            // First sample replaces initial RTO: frames sent under it get their timers shortened once
+            struct timer* tm = &sess->frame_timers[i % sess->ring_size];
+            if (timer_armed(tm)) {
+                wheel_arm(sess->wheel, tm, sess->sent_at[i % sess->ring_size] + rto_current(&sess->rto));
             }
+        }
+        hist_add(&metrics.rtt, rtt);
+        trace_event(TR_RTT, sess->index, id, rtt);
+    }
+}
+
+// Function to take an RTT sample from frame that triggered an ACK, if it is newly acknowledged
+static void ack_sample(struct session* sess, const struct ack_packet* ack, long int limit) {
+    if (ack->trigger >= sess->base && ack->trigger <= limit && !sess->acked[ack->trigger % sess->ring_size]) {
+        sample_rtt(sess, ack->trigger);
+    }
+}
 
-            // Reset length before each `recvfrom()` call
-            length = sizeof(*c_addr);
+// Function to mark frames reported in an ACK's SACK ranges (up to `limit`) as received
+static void mark_sacked(struct session* sess, const struct ack_packet* ack, long int limit) {
+    for (int b = 0; b < ack->n_blocks; b++) {
+        long int start = ack->sack[b][0] < sess->base ? sess->base : ack->sack[b][0];
+        long int end = ack->sack[b][1] > limit ? limit : ack->sack[b][1];
+        for (long int i = start; i <= end; i++) {
+            mark_acked(sess, i);
+        }
+    }
+}
 
-            // Wait for acknowledgment from client
-            if (recvfrom(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)c_addr, &length) == -1) {
-                perror("Server: Receive ack failed");  // Handle timeout or receive error
-                retry_count++;  // Increment retry count on timeout or failed ACK
-            } else {
-                printf("Received ACK for frame# %d\n", ack_num);
-
-                // If acknowledgment matches frame ID, move to next frame
-                if (ack_num == frame.ID) {
-                    printf("Frame# %ld acknowledged\n", frame.ID);
-                    retry_count = 0;  // Reset retry count for next frame
-                    i++;  // Move to next frame
-                    break;  // Exit retry loop and proceed to next frame
-                } else {
-                    printf("Incorrect ACK received (ACK = %d). Resending frame# %ld...\n", ack_num, frame.ID);
-                    retry_count++;
+// Function to check whether pacing lets a session send another frame now; if not, schedules when it may try again
+static int pace_ready(struct session* sess) {
+    if (pacer_ready(&sess->pace, now_us())) {
+        return 1;
+    }
+    if (!timer_armed(&sess->pace_timer)) {
+        wheel_arm(sess->wheel, &sess->pace_timer, pacer_wake(&sess->pace));
+    }
+    return 0;
+}
+
+// Function to feed an ACK to bandwidth estimator and apply the pacing rate it gives. Counts bytes of frames up to
+// `limit` the ACK newly reports received (call before marking them; SACK ranges lie past cumulative ACK and never
+// overlap), and samples the most recently sent of them.
+static void pace_ack(struct session* sess, const struct ack_packet* ack, long int limit) {
+    long long bytes = 0;
+    long long now = now_us();
+    int newest = -1; // Slot of most recently sent frame ACK delivers
+    for (int b = -1; b < ack->n_blocks; b++) {
+        long int start = b < 0 ? sess->base : ack->sack[b][0] < sess->base ? sess->base : ack->sack[b][0];
+        long int end = b < 0 ? ack->cum_ack : ack->sack[b][1];
+        for (long int i = start; i <= end && i <= limit; i++) {
+            int slot = i % sess->ring_size;
+            if (!sess->acked[slot]) {
+                bytes += frame_offset(sess, i + 1) - frame_offset(sess, i);
+                if (newest == -1 || sess->sent_at[slot] > sess->sent_at[newest]) {
+                    newest = slot;
                 }
             }
+        }
+    }
+    if (newest == -1) {
+        return;
+    }
+    long long inflight = frame_offset(sess, limit + 1) - frame_offset(sess, sess->base) - bytes;
+    long long rtt = sess->resent[newest] ? -1 : now - sess->sent_at[newest];
+    bw_on_ack(&sess->bw, &sess->delivery[newest], bytes, rtt, inflight, now);
+    double rate = bw_pacing_rate(&sess->bw);
+    if (rate > 0) {
+        pacer_set_rate(&sess->pace, rate, FRAME_HEADER_SIZE + sess->payload_size);
+    }
+}
 
-            // If retry limit is reached, skip to next frame
-            if (retry_count > resend_limit) {
-                printf("Error: Frame# %ld reached maximum resend attempts. Continuing with the next frame.\n", frame.ID);
-                retry_count = 0;  // Reset retry count before moving to next frame
-                i++;  // Move to next frame even if retry limit is reached
-                break;
+// Stop-and-Wait: send current frame
+void stop_and_wait_start(int s, struct session* sess) {
+    send_frame(s, sess, sess->base);
+    mark_sent(sess, sess->base, 0);
+    sess->next_seq_num = sess->base + 1;
+    wheel_arm(sess->wheel, &sess->rtx_timer, now_us() + rto_current(&sess->rto)); // Wait for acknowledgment
+}
+
+// Stop-and-Wait: advance to next frame, finishing session after last one
+static void stop_and_wait_advance(int s, struct session_table* t, struct session* sess) {
+    sess->retry_count = 0; // Reset retry count for next frame
+    sess->base++; // Move to next frame
+    if (sess->base > sess->total_frame) {
+        end_session(s, t, sess);
+    } else {
+        stop_and_wait_start(s, sess);
+    }
+}
+
+// Stop-and-Wait: resend current frame or skip it once retry limit is reached
+static void stop_and_wait_retry(int s, struct session_table* t, struct session* sess) {
+    sess->retry_count++;
+    if (sess->retry_count > RESEND_LIMIT) {
+        printf("Error: Frame# %ld reached maximum resend attempts. Continuing with the next frame.\n", sess->base);
+        stop_and_wait_advance(s, t, sess);
+        return;
+    }
+    send_frame(s, sess, sess->base);
+    mark_sent(sess, sess->base, 1);
+    sess->resend_frame++; // Increment resend count for retries
+    wheel_arm(sess->wheel, &sess->rtx_timer, now_us() + rto_current(&sess->rto));
+}
+
+// Stop-and-Wait: handle an acknowledgment from client
+void stop_and_wait_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack) {
+    VLOG("Received ACK for frame# %ld\n", ack->cum_ack);
+
+    // If acknowledgment matches frame ID, move to next frame
+    if (ack->cum_ack == sess->base) {
+        VLOG("Frame# %ld acknowledged\n", sess->base);
+        ack_sample(sess, ack, sess->base);
+        stop_and_wait_advance(s, t, sess);
+    } else if (ack->cum_ack == sess->base - 1 && ack->trigger > ack->cum_ack) {
+        // Client got a frame past the one it waits for: it is missing current frame
+        VLOG("Out of order ACK received (ACK = %ld, frame %ld). Resending frame# %ld...\n", ack->cum_ack, ack->trigger, sess->base);
+        stop_and_wait_retry(s, t, sess);
+    } else {
+        // Stale or duplicate ACK (a late ACK, or one for a resent copy of a frame already acknowledged): resending
+        // on it would set off another duplicate, so loss is left to retransmission timer
+        VLOG("Stale ACK received (ACK = %ld) while waiting for frame# %ld\n", ack->cum_ack, sess->base);
+    }
+}
+
+// Stop-and-Wait: no acknowledgment arrived in time
+void stop_and_wait_timeout(int s, struct session_table* t, struct session* sess) {
+    VLOG("Server: Receive ack timed out for frame# %ld\n", sess->base);
+    rto_backoff(&sess->rto);
+    stop_and_wait_retry(s, t, sess);
+}
+
+// Go-Back-N: send every frame that fits in current window
+void go_back_n_fill(int s, struct session* sess) {
+    long int end = window_end(sess);
+    while (sess->next_seq_num < end && sess->next_seq_num <= sess->total_frame && pace_ready(sess)) {
+        if (sess->next_seq_num <= sess->high_seq) {
+            // Going back over a frame that was already sent once, unless client reported it received
+            if (sess->acked[sess->next_seq_num % sess->ring_size]) {
+                sess->next_seq_num++;
+                continue;
             }
+            VLOG("Resending frame# %ld\n", sess->next_seq_num);
+            send_frame(s, sess, sess->next_seq_num);
+            mark_sent(sess, sess->next_seq_num, 1);
+            sess->resend_frame++;
+            sess->next_seq_num++;
+            continue;
         }
+
+        send_frame(s, sess, sess->next_seq_num);
+        mark_sent(sess, sess->next_seq_num, 0);
+        send_parity(s, sess, sess->next_seq_num);
+        sess->high_seq = sess->next_seq_num;
+        sess->next_seq_num++;
+    }
+
+    // Run retransmission timer while frames are outstanding
+    if (sess->base < sess->next_seq_num && !timer_armed(&sess->rtx_timer)) {
+        wheel_arm(sess->wheel, &sess->rtx_timer, now_us() + rto_current(&sess->rto));
+    }
+}
+
+// Function to apply a new congestion window, bounded by [1, ceiling]
+static void set_cwnd(struct session* sess, double cwnd) {
+    if (cwnd < 1) {
+        cwnd = 1;
+    }
+    if (cwnd > sess->window_limit) {
+        cwnd = sess->window_limit;
+    }
+    sess->cwnd = cwnd;
+    if ((int)cwnd != sess->window_size) {
+        trace_event(TR_WINDOW, sess->index, sess->base, (int)cwnd);
+    }
+    sess->window_size = (int)cwnd;
+    if (sess->window_size > sess->max_cwnd) {
+        sess->max_cwnd = sess->window_size;
+    }
+}
+
+// Function to open congestion window after base moved past `newly_acked` frames. With BBR pacing window is a couple of
+// bandwidth-delay products. Otherwise slow start grows window by one frame per frame acknowledged, then additive
+// increase of one frame per window.
+static void grow_cwnd(struct session* sess, long int newly_acked) {
+    if (sess->pace_bbr && bw_estimate(&sess->bw) > 0) {
+        double frames = PACE_CWND_GAIN * bw_bdp(&sess->bw) / (FRAME_HEADER_SIZE + sess->payload_size);
+        set_cwnd(sess, frames > PACE_MIN_CWND ? frames : PACE_MIN_CWND);
+    } else if (sess->cwnd < sess->ssthresh) {
+        set_cwnd(sess, sess->cwnd + newly_acked);
+    } else {
+        set_cwnd(sess, sess->cwnd + (double)newly_acked / sess->cwnd);
     }
+}
+
+// Go-Back-N: go back to base and resend as much of the window as cwnd now allows
+static void go_back_n_resend(int s, struct session* sess) {
+    sess->next_seq_num = sess->base;
+    wheel_cancel(sess->wheel, &sess->rtx_timer);
+    go_back_n_fill(s, sess);
+}
+
+// Go-Back-N: slide window on a cumulative acknowledgment and note SACKed frames so going back skips them
+void go_back_n_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack) {
+    long int ack_num = ack->cum_ack;
+    VLOG("Received ACK for frame# %ld (%d SACK ranges)\n", ack_num, ack->n_blocks);
 
-    // Print frame data after loop is complete
-    printf("\nTotal frames attempted to be sent: %ld\n", total_frame);
-    printf("Total frames dropped: %i\n", drop_frame);
-    printf("Total frames resent: %i\n", resend_frame);
-}
-
-// Implementation of Go-Back-N ARQ protocol
-void go_back_n(int s, struct sockaddr_in* c_addr, socklen_t length, FILE* fp, int total_frame, float drop_probability) {
-    struct frame_packet frame; // Frame structure for sending data
-    int ack_num = -1, drop_frame = 0, resend_frame = 0; // Variables for tracking acknowledgments, drops, and resends
-    long int base = 1;  // Base of window (first unacknowledged frame)
-    long int next_seq_num = 1;  // Next sequence number to send
-    int window_size = WINDOW_SIZE;  // Size of Go-Back-N window
-    int resend_limit = 5;  // Retry limit for retransmission
-    int retry_count = 0;  // Retry count for retransmissions
-
-    // Set up timeout for recvfrom (to trigger retransmission after timeout)
-    struct timeval timeout;
-    timeout.tv_sec = 2;  // 2-second timeout
-    timeout.tv_usec = 0;  // No microseconds
-    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
-    while (base <= total_frame) {
-        // Send frames within current window
-        while (next_seq_num < base + window_size && next_seq_num <= total_frame) {
-            memset(&frame, 0, sizeof(frame));
-            fseek(fp, (next_seq_num - 1) * BUF_SIZE, SEEK_SET); // Set file pointer to correct frame data
-            frame.ID = next_seq_num;  // Frame ID starts from next_seq_num
-            frame.length = fread(frame.data, 1, BUF_SIZE, fp);
-
-            // Simulate packet drop based on probability
-            float random_val = ((float)rand() / (float)RAND_MAX);  // Generate a random float between 0 and 1
-            if (random_val < drop_probability) {
-                printf("Frame ID# %ld dropped (simulated loss)\n", frame.ID);
-                drop_frame++;
+    ack_sample(sess, ack, sess->high_seq);
+    if (sess->pace_bbr) {
+        pace_ack(sess, ack, sess->high_seq);
+    }
+    mark_sacked(sess, ack, sess->high_seq);
+
+    // Duplicate ACK: client got a frame past a gap (one set off by a stale retransmitted frame says nothing is lost)
+    if (ack_num == sess->base - 1 && sess->base < sess->next_seq_num) {
+        if (ack->trigger <= ack_num) {
+            return;
+        }
+        sess->dup_acks++;
+        if (sess->dup_acks == DUP_ACK_THRESHOLD && sess->base > sess->recover) {
+            // Fast retransmit: halve window (multiplicative decrease) once per loss event; a window that follows
+            // bandwidth estimate is not a loss signal and stays
+            VLOG("Fast retransmit from frame #%ld\n", sess->base);
+            if (!sess->pace_bbr || bw_estimate(&sess->bw) == 0) {
+                sess->ssthresh = sess->cwnd / 2 < 2 ? 2 : sess->cwnd / 2;
+                set_cwnd(sess, sess->ssthresh);
+            }
+            sess->recover = sess->high_seq;
+            go_back_n_resend(s, sess);
+        }
+        return;
+    }
+
+    // Slide window forward if we received an ACK for base frame (may be past a rewound next_seq_num)
+    if (ack_num >= sess->base && ack_num <= sess->high_seq) {
+        long int newly_acked = ack_num - sess->base + 1;
+        sess->base = ack_num + 1; // Move base to next frame
+        if (sess->next_seq_num < sess->base) {
+            sess->next_seq_num = sess->base;
+        }
+        sess->retry_count = 0; // Reset retry count on successful ACK
+        sess->dup_acks = 0;
+        wheel_cancel(sess->wheel, &sess->rtx_timer); // Restart timer for new base
+
+        grow_cwnd(sess, newly_acked);
+
+        if (sess->base > sess->total_frame) {
+            end_session(s, t, sess);
+            return;
+        }
+        go_back_n_fill(s, sess);
+    }
+}
+
+// Go-Back-N: timer ran out, go back to base under a collapsed window
+void go_back_n_timeout(int s, struct session_table* t, struct session* sess) {
+    VLOG("Timeout occurred, retransmitting frames starting from base frame #%ld\n", sess->base);
+    sess->retry_count++;
+    if (sess->retry_count > RESEND_LIMIT) {
+        printf("Error: Client stopped responding at frame# %ld. Ending session.\n", sess->base);
+        end_session(s, t, sess);
+        return;
+    }
+    rto_backoff(&sess->rto);
+
+    // Timeout means heavy loss: remember half the window and restart slow start
+    sess->ssthresh = sess->cwnd / 2 < 2 ? 2 : sess->cwnd / 2;
+    set_cwnd(sess, 1);
+    sess->dup_acks = 0;
+    sess->recover = sess->high_seq;
+
+    // Retransmit unacknowledged frames starting from base
+    go_back_n_resend(s, sess);
+}
+
+// Selective Repeat: send every frame that fits in current window
+void selective_repeat_fill(int s, struct session* sess) {
+    long int end = window_end(sess);
+    while (sess->next_seq_num < end && sess->next_seq_num <= sess->total_frame && pace_ready(sess)) {
+        send_frame(s, sess, sess->next_seq_num);
+        mark_sent(sess, sess->next_seq_num, 0); // A simulated drop still starts frame's timer
+        send_parity(s, sess, sess->next_seq_num);
+        sess->next_seq_num++;
+    }
+}
+
+// Selective Repeat: a frame was lost. Congestion window halves once per loss event; only lost frames are resent, so
+// it is not collapsed the way Go-Back-N's is. A window that follows bandwidth estimate stays.
+static void selective_repeat_loss(struct session* sess) {
+    if (sess->base > sess->recover && (!sess->pace_bbr || bw_estimate(&sess->bw) == 0)) {
+        sess->ssthresh = sess->cwnd / 2 < 2 ? 2 : sess->cwnd / 2;
+        set_cwnd(sess, sess->ssthresh);
+        sess->recover = sess->next_seq_num - 1;
+    }
+}
+
+// Selective Repeat: fast retransmit. A frame still missing once DUP_ACK_THRESHOLD frames past it were received, and
+// a quarter of an RTT after its ACK was due (so reordering and FEC repair get time to fill the gap), is taken as lost
+// and resent at once instead of when its timer runs out; a resent frame is left to its timer.
+static void selective_repeat_fast_resend(int s, struct session* sess, const struct ack_packet* ack, long int last) {
+    if (!sess->rto.has_sample) {
+        return;
+    }
+    long long lost_before = now_us() - sess->rto.srtt - sess->rto.srtt / 4; // Frames sent earlier are overdue
+    long int top = ack->cum_ack; // Highest frame client reported
+    for (int b = 0; b < ack->n_blocks; b++) {
+        if (ack->sack[b][1] > top) {
+            top = ack->sack[b][1];
+        }
+    }
+    if (top > last) {
+        top = last;
+    }
+    for (long int i = sess->base; i <= top - DUP_ACK_THRESHOLD; i++) {
+        int slot = i % sess->ring_size;
+        if (!sess->acked[slot] && !sess->resent[slot] && sess->sent_at[slot] < lost_before) {
+            VLOG("Fast retransmit of frame# %ld\n", i);
+            selective_repeat_loss(sess);
+            send_frame(s, sess, i);
+            mark_sent(sess, i, 1);
+            sess->resend_frame++;
+        }
+    }
+}
+
+// Selective Repeat: mark cumulatively and selectively acknowledged frames and slide window past acknowledged prefix
+void selective_repeat_ack(int s, struct session_table* t, struct session* sess, const struct ack_packet* ack) {
+    long int last = sess->next_seq_num - 1; // Highest frame in flight
+    VLOG("Received ACK for frame# %ld (%d SACK ranges)\n", ack->cum_ack, ack->n_blocks);
+
+    ack_sample(sess, ack, last);
+    if (sess->pace_bbr) {
+        pace_ack(sess, ack, last);
+    }
+    for (long int i = sess->base; i <= ack->cum_ack && i <= last; i++) {
+        mark_acked(sess, i);
+    }
+    mark_sacked(sess, ack, last);
+    selective_repeat_fast_resend(s, sess, ack, last);
+
+    // Slide base forward over every acknowledged frame, opening congestion window as Go-Back-N does
+    long int old_base = sess->base;
+    while (sess->base < sess->next_seq_num && sess->acked[sess->base % sess->ring_size]) {
+        sess->acked[sess->base % sess->ring_size] = 0;
+        sess->base++;
+        sess->retry_count = 0; // Reset retry count on progress
+    }
+    if (sess->base > old_base) {
+        grow_cwnd(sess, sess->base - old_base);
+    }
+
+    if (sess->base > sess->total_frame) {
+        end_session(s, t, sess);
+        return;
+    }
+    selective_repeat_fill(s, sess);
+}
+
+// Selective Repeat: frame `id`'s own timer ran out, retransmit only it. The first frame of a timeout (`first`)
+// counts the retry and backs off RTO; frames whose timers ran out with it are just resent.
+void selective_repeat_timeout(int s, struct session_table* t, struct session* sess, long int id, int first) {
+    if (first) {
+        sess->retry_count++;
+        if (sess->retry_count > RESEND_LIMIT) {
+            printf("Error: Client stopped responding at frame# %ld. Ending session.\n", sess->base);
+            end_session(s, t, sess);
+            return;
+        }
+        rto_backoff(&sess->rto);
+        selective_repeat_loss(sess);
+    }
+    VLOG("Timeout for frame# %ld, resending\n", id);
+    send_frame(s, sess, id);
+    mark_sent(sess, id, 1); // Rearms frame's timer with backed off RTO
+    sess->resend_frame++;
+}
+
+// Function to compute epoll timeout from timer wheel (retransmission timers and paced sends) and held datagrams
+int next_timeout(struct session_table* t) {
+    long long earliest = wheel_next(&t->wheel);
+    long long held[2] = { delay_next_due(&frame_line), delay_next_due(&ack_line) };
+    for (int i = 0; i < 2; i++) {
+        if (held[i] && (earliest == 0 || held[i] < earliest)) {
+            earliest = held[i];
+        }
+    }
+    if (earliest == 0) {
+        return -1; // No timers armed, block until a datagram arrives
+    }
+    long long wait = earliest - now_us();
+    return wait > 0 ? (int)((wait + 999) / 1000) : 0; // Round up so timer has expired on wakeup
+}
+
+// Function to resume senders held back by pacing and fire retransmission timers that have expired
+void expire_timers(int s, struct session_table* t) {
+    long long now = now_us();
+    struct timer* tm;
+    while ((tm = wheel_expire(&t->wheel, now))) {
+        struct session* sess = tm->owner;
+        if (tm->kind == TIMER_PACE) {
+            if (sess->protocol == 2) {
+                go_back_n_fill(s, sess);
             } else {
-                // Send frame
-                if (sendto(s, &frame, sizeof(frame), 0, (struct sockaddr*)c_addr, length) == -1) {
-                    perror("Server: Send frame failed");
-                } else {
-                    printf("Frame# %ld sent\n", frame.ID);
-                }
+                selective_repeat_fill(s, sess);
+            }
+            continue;
+        }
+        int first = sess->timeout_at != now; // Selective Repeat frames expiring together are one timeout
+        if (tm->kind == TIMER_FRAME && first) {
+            long long due = sess->sent_at[tm->id % sess->ring_size] + rto_current(&sess->rto);
+            if (due > now) {
+                wheel_arm(sess->wheel, tm, due); // RTO was backed off since frame was sent: it has longer to wait
+                continue;
             }
-            next_seq_num++;
-        }
-
-        // Receive ACK from client
-        length = sizeof(*c_addr);
-        if (recvfrom(s, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)c_addr, &length) == -1) {
-            // Timeout occurred (no ACK received within specified time)
-            perror("Server: Receive ACK failed (timeout)");
-            printf("Timeout occurred, retransmitting frames starting from base frame #%ld\n", base);
-            retry_count++;
-            
-            // Retransmit all unacknowledged frames starting from base
-            for (long int i = base; i < next_seq_num && i <= total_frame; i++) {
-                memset(&frame, 0, sizeof(frame));
-                fseek(fp, (i - 1) * BUF_SIZE, SEEK_SET); // Reposition file pointer
-                frame.ID = i;
-                frame.length = fread(frame.data, 1, BUF_SIZE, fp);
-
-                // Resend frame
-                if (sendto(s, &frame, sizeof(frame), 0, (struct sockaddr*)c_addr, length) == -1) {
-                    perror("Server: Resend frame failed");
-                } else {
-                    printf("Resending frame# %ld\n", frame.ID);
-                    resend_frame++;
+        }
+        if (first) {
+            sess->timeout_at = now;
+            sess->timeouts++;
+            metric_add(&metrics.timeouts, 1);
+            trace_event(TR_TIMEOUT, sess->index, sess->base, 0);
+        }
+        switch (sess->protocol) {
+        case 1:
+            stop_and_wait_timeout(s, t, sess);
+            break;
+        case 2:
+            go_back_n_timeout(s, t, sess);
+            break;
+        default:
+            selective_repeat_timeout(s, t, sess, tm->id, first);
+            break;
+        }
+    }
+}
+
+// Function to add a receiver to the multicast transfer of a file that is still taking receivers, or start one.
+// The group takes over `file`/`fp`. Fills in reply's group, port and transfer settings; returns -1 if no group could start.
+int mcast_join(const char* name, struct file_entry* file, FILE* fp, off_t f_size, long int total_frame, long int payload_size,
+    int checksum, int codecs, int codec, struct transfer_reply* reply) {
+    struct mcast_group* g = NULL;
+    pthread_mutex_lock(&mcast_lock);
+    for (int i = 0; i < MAX_GROUPS && !g; i++) {
+        struct mcast_group* c = &mcast_groups[i];
+        if (c->active && !c->closing && strcmp(c->file_name, name) == 0 && c->file_size == f_size
+            && (c->codec == CODEC_NONE || (codecs >> c->codec & 1))) {
+            g = c; // Receiver takes group's payload size and checksum setting from reply
+            close_file(file, fp);
+        }
+    }
+    for (int i = 0; i < MAX_GROUPS && !g; i++) {
+        struct mcast_group* c = &mcast_groups[i];
+        unsigned short port;
+        int sock;
+        if (c->active || (sock = stream_socket(&port)) == -1) {
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->s = sock;
+        c->port = port;
+        snprintf(c->file_name, sizeof(c->file_name), "%s", name);
+        c->file = file;
+        if (!file) {
+            fclose(fp); // Worker opens file itself
+        }
+        c->file_size = f_size;
+        c->total_frame = total_frame;
+        c->payload_size = payload_size;
+        c->checksum = checksum;
+        c->codec = codec;
+        c->start_at = now_us() + mcast_join_us;
+        if (mcast_addr.sin_addr.s_addr) {
+            unsigned char loop = 1, ttl = 1;
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)); // Receivers on this host get frames too
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, mcast_worker, c) != 0) {
+            print_error("Server: pthread_create");
+        }
+        pthread_detach(thread);
+        c->active = 1;
+        g = c;
+        printf("Multicast: new transfer of %s on port %d, first frame in %lld ms\n", name, ntohs(port), mcast_join_us / 1000);
+    }
+    if (!g) {
+        pthread_mutex_unlock(&mcast_lock);
+        close_file(file, fp);
+        return -1;
+    }
+    g->joined++;
+    reply->streams = 1;
+    reply->total_frame = g->total_frame;
+    reply->payload_size = g->payload_size;
+    reply->first_frame = 1;
+    reply->last_frame = g->total_frame;
+    reply->port[0] = g->port;
+    reply->checksum = g->checksum;
+    reply->fec_k = 0;
+    reply->file_size = g->file_size;
+    reply->codec = g->codec;
+    reply->mcast_group = mcast_addr.sin_addr.s_addr;
+    reply->mcast_port = mcast_addr.sin_port;
+    printf("Multicast: receiver %d of %s\n", g->joined, name);
+    pthread_mutex_unlock(&mcast_lock);
+    return 0;
+}
+
+// Function to find a multicast receiver by address, adding it if it is new. NULL if transfer is full.
+static struct mcast_receiver* mcast_receiver(struct mcast_state* m, struct sockaddr_in* addr) {
+    for (int i = 0; i < m->n_rx; i++) {
+        if (m->rx[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && m->rx[i].addr.sin_port == addr->sin_port) {
+            return &m->rx[i];
+        }
+    }
+    if (m->n_rx == MCAST_MAX_RECEIVERS) {
+        return NULL;
+    }
+    struct mcast_receiver* r = &m->rx[m->n_rx++];
+    memset(r, 0, sizeof(*r));
+    r->addr = *addr;
+    printf("Multicast: %s:%d joined (%d receivers)\n", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), m->n_rx);
+    return r;
+}
+
+// Function to queue repairs a NACK asks for. A repair already queued takes in the new receiver, a frame sent
+// moments ago is not sent again (that NACK crossed it), so many receivers missing one frame cost one repair.
+static void mcast_nack(struct mcast_state* m, const struct nack_packet* nack, struct sockaddr_in* from) {
+    struct mcast_receiver* r = mcast_receiver(m, from);
+    long long now = now_us();
+    if (!r) {
+        return;
+    }
+    m->nacks++;
+    m->last_heard = now;
+    metric_add(&metrics.acks_received, 1);
+    trace_event(TR_ACK_RX, m->sess.index, nack->have, nack->n_ranges);
+    r->have = nack->have;
+    if (nack->flags & NACK_DONE) {
+        if (!r->done) {
+            r->done = 1;
+            m->n_done++;
+            printf("Multicast: %s:%d has every frame (%d of %d receivers done)\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port),
+                m->n_done, m->n_rx);
+        }
+        return;
+    }
+    uint64_t bit = 1ULL << (r - m->rx);
+    for (int i = 0; i < nack->n_ranges; i++) {
+        long int lo = nack->range[i][0] < 1 ? 1 : nack->range[i][0];
+        long int hi = nack->range[i][1] < m->next_new ? nack->range[i][1] : m->next_new - 1; // Only frames already sent
+        for (long int id = lo; id <= hi; id++) {
+            m->requested++;
+            if (m->want[id - 1]) {
+                m->want[id - 1] |= bit;
+                m->merged++;
+            } else if (now - m->sent_at[id - 1] < MCAST_SUPPRESS_US) {
+                m->suppressed++;
+            } else {
+                m->want[id - 1] = bit;
+                m->queued++;
+                if (id < m->repair_low) {
+                    m->repair_low = id;
                 }
             }
+        }
+        VLOG("NACK from %s:%d for frames %ld-%ld\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port), lo, hi);
+    }
+}
 
-            retry_count = 0;  // Reset retry count after retransmission
+// Function to send frame `id` to group, or to every receiver in `to` (one bit each) when fanning out. Returns bytes sent.
+static long long mcast_send(struct mcast_group* g, struct mcast_state* m, long int id, uint64_t to, int repair) {
+    struct frame_packet frame;
+    size_t len = load_frame(&m->sess, id, &frame);
+    long long bytes = 0;
+    for (int i = 0; i < (mcast_addr.sin_addr.s_addr ? 1 : m->n_rx); i++) {
+        const struct sockaddr_in* addr = mcast_addr.sin_addr.s_addr ? &mcast_addr : &m->rx[i].addr;
+        if (!mcast_addr.sin_addr.s_addr && (m->rx[i].done || !(to >> i & 1))) {
+            continue;
+        }
+        if (batch_send(g->s, &tx_batch, frame.header, len, addr) == -1) {
+            perror("Server: Send frame failed");
+            continue;
+        }
+        m->datagrams++;
+        m->bytes += frame.length;
+        metric_add(&metrics.frames_sent, 1);
+        metric_add(&metrics.bytes_sent, frame.length);
+        bytes += len;
+    }
+    if (repair) {
+        m->repairs++;
+        metric_add(&metrics.retransmits, 1);
+    }
+    m->sent_at[id - 1] = now_us();
+    trace_event(repair ? TR_RESEND : TR_SEND, m->sess.index, id, frame.length);
+    VLOG("Frame# %ld %s\n", id, repair ? "repaired" : "sent");
+    return bytes;
+}
+
+// Function to send queued repairs, then frames of first pass, as fast as send rate allows
+static void mcast_send_some(struct mcast_group* g, struct mcast_state* m) {
+    long long now = now_us();
+    while (pacer_ready(&m->pace, now)) {
+        if (m->queued) {
+            while (!m->want[m->repair_low - 1]) {
+                m->repair_low++;
+            }
+            long int id = m->repair_low;
+            uint64_t to = m->want[id - 1];
+            m->want[id - 1] = 0;
+            m->queued--;
+            pacer_spend(&m->pace, mcast_send(g, m, id, to, 1));
+        } else if (m->next_new <= m->sess.total_frame) {
+            pacer_spend(&m->pace, mcast_send(g, m, m->next_new++, ~0ULL, 0));
         } else {
-            printf("Received ACK for frame# %d\n", ack_num);
+            break;
+        }
+    }
+}
+
+// Function to run one multicast transfer: wait out join window, send file once, repair from NACKs until every
+// receiver has it (or none is heard from for MCAST_IDLE_US)
+static void mcast_serve(struct mcast_group* g) {
+    struct mcast_state* m = calloc(1, sizeof(*m));
+    struct epoll_event ev, events[MAX_EVENTS];
+    char msg_recv[BUF_SIZE];
+    struct sockaddr_in from;
+    socklen_t length;
+    FILE* fp = NULL;
+    int ep = epoll_create1(0);
+    if (!m || ep == -1) {
+        print_error("Server: Multicast worker");
+    }
+    if (!g->file && !(fp = fopen(g->file_name, "rb"))) {
+        perror("Server: Multicast could not open file");
+    }
+    session_open_file(&m->sess, g->file, fp, g->file_size, g->payload_size, g->checksum, g->codec, 1, g->total_frame);
+    g->file = NULL; // Session owns reference now
+    m->sess.index = (int)atomic_fetch_add(&sessions_started, 1);
+    m->sess.started = now_us();
+    m->want = calloc(g->total_frame, sizeof(*m->want));
+    m->sent_at = calloc(g->total_frame, sizeof(*m->sent_at));
+    if (!m->want || !m->sent_at) {
+        print_error("Memory allocation failed for multicast");
+    }
+    m->next_new = 1;
+    m->repair_low = g->total_frame + 1;
+    pacer_init(&m->pace, mcast_rate, FRAME_HEADER_SIZE + g->payload_size, now_us());
+    m->last_heard = now_us();
+    batch_init(&tx_batch, batch_size, sizeof(struct frame_packet));
+    batch_init(&rx_batch, batch_size, BUF_SIZE); // No GSO: a train sent to group never reaches members on this host
+    if (uring_io) {
+        batch_enable_uring(g->s, &tx_batch);
+        batch_enable_uring(g->s, &rx_batch);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = g->s;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, batch_poll_fd(g->s, &rx_batch), &ev) == -1) {
+        print_error("Server: epoll_ctl");
+    }
 
-            // Slide window forward if we received an ACK for base frame
-            if (ack_num >= base) {
-                base = ack_num + 1;  // Move base to next frame
-                retry_count = 0;  // Reset retry count on successful ACK
+    int running = fp || m->sess.file;
+    while (running) {
+        long long now = now_us();
+        int sending = m->n_rx > 0 && now >= g->start_at;
+        long long wait = !sending ? (m->n_rx > 0 ? g->start_at : g->start_at + STREAM_START_US) - now
+            : m->queued || m->next_new <= m->sess.total_frame ? pacer_wake(&m->pace) - now // Tokens refill while we sleep
+            : m->last_heard + MCAST_IDLE_US - now;
+        int n = epoll_wait(ep, events, MAX_EVENTS, wait > 0 ? (int)((wait + 999) / 1000) : 0);
+        if (n == -1 && errno != EINTR) {
+            print_error("Server: epoll_wait");
+        }
+        for (;;) {
+            struct nack_packet nack;
+            length = sizeof(from);
+            ssize_t got = batch_recv(g->s, &rx_batch, msg_recv, sizeof(msg_recv), &from, &length);
+            if (got == -1) {
+                break;
+            }
+            if (nack_parse(msg_recv, got, &nack)) {
+                mcast_nack(m, &nack, &from);
             }
         }
+        if (m->n_rx > 0 && now_us() >= g->start_at) {
+            mcast_send_some(g, m);
+        }
+        batch_flush(g->s, &tx_batch);
+
+        // Done once every receiver told of group has every frame; give up on silent receivers after a while
+        now = now_us();
+        int sent_all = m->next_new > m->sess.total_frame && !m->queued;
+        pthread_mutex_lock(&mcast_lock);
+        if ((m->n_rx > 0 && m->n_done == m->n_rx && m->n_rx >= g->joined && sent_all)
+            || (m->n_rx > 0 && sent_all && now - m->last_heard >= MCAST_IDLE_US)
+            || (m->n_rx == 0 && now >= g->start_at + STREAM_START_US)) {
+            g->closing = 1;
+            running = 0;
+        }
+        pthread_mutex_unlock(&mcast_lock);
     }
 
-    // Print summary
-    printf("\nTotal frames attempted to be sent: %ld\n", total_frame);
-    printf("Total frames dropped: %i\n", drop_frame);
-    printf("Total frames resent: %i\n", resend_frame);
-}
\ No newline at end of file
+    long long elapsed = now_us() - m->sess.started;
+    printf("\nMulticast: %s to %d receivers (%d have every frame), %ld frames sent once plus %lld repairs, %.3f s\n", g->file_name,
+        m->n_rx, m->n_done, m->next_new - 1, m->repairs, elapsed / 1e6);
+    printf("Multicast: %lld datagrams with %lld data bytes, %.2f copies of file\n", m->datagrams, m->bytes,
+        g->file_size ? (double)m->bytes / g->file_size : 0);
+    printf("Multicast: %lld NACKs asked for %lld frames: %lld merged into a queued repair, %lld suppressed as just repaired\n",
+        m->nacks, m->requested, m->merged, m->suppressed);
+    metric_add(&metrics.sessions, 1);
+    hist_add(&metrics.transfer, elapsed);
+    session_close_file(g->s, &m->sess);
+    metric_add(&worker_io[0], tx_batch.calls);
+    metric_add(&worker_io[1], tx_batch.datagrams);
+    metric_add(&worker_io[2], rx_batch.calls);
+    metric_add(&worker_io[3], rx_batch.datagrams);
+    metric_add(&worker_io[4], tx_batch.offloaded);
+    batch_free(&tx_batch);
+    batch_free(&rx_batch);
+    close(ep);
+    close(g->s);
+    free(m->want);
+    free(m->sent_at);
+    free(m);
+
+    pthread_mutex_lock(&mcast_lock);
+    g->active = 0; // Slot can take a new transfer
+    pthread_mutex_unlock(&mcast_lock);
+}
+
+// Function to run a multicast transfer on its own thread
+void* mcast_worker(void* arg) {
+    mcast_serve(arg);
+    return NULL;
+}
@@ -0,0 +1,327 @@
+// Minimal io_uring wrapper used by batch_io.h and disk_writer.h, built on the raw syscalls so no library is needed.
+// A ring is a submission queue of operations and a completion queue of their results, both shared with the kernel
+// through mapped memory: operations are queued with no syscall, and one io_uring_enter() submits every queued
+// operation and waits for as many completions as asked. Files and buffers can be registered with a ring once, so
+// operations on them skip the kernel's per-call file lookup and page pinning. A multishot receive stays armed
+// and takes a buffer from a ring of provided buffers for each datagram, so receiving costs no syscall at all while
+// completions are waiting.
+// Including file must define _GNU_SOURCE before its first system header.
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define URING_FILES 4 // Registered file table slots per ring
+#define URING_TIMEOUT_DATA (~0ULL) // user_data of a linked timeout's completion
+#define URING_CANCEL_DATA (~1ULL) // user_data of uring_free()'s cancel
+#define URING_CLOSE_WAIT_US 100000 // Longest wait for pending operations to be cancelled on close (us)
+#define URING_BGID 0 // Group ID of a ring's provided buffers (one group per ring)
+
+// One ring and its mappings
+struct uring {
+    int fd; // Ring descriptor, -1 = none
+    unsigned entries; // Submission queue slots
+    unsigned* sq_head; // Shared submission queue indices (kernel advances head, we advance tail)
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array; // Shared slot -> SQE index table
+    struct io_uring_sqe* sqes; // Submission queue entries
+    unsigned queued; // SQEs filled in but not yet published to kernel
+    unsigned* cq_head; // Shared completion queue indices (kernel advances tail, we advance head)
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes; // Completion queue entries
+    void* sq_map; // Mappings to undo on close
+    size_t sq_map_len;
+    void* cq_map; // NULL when kernel maps both queues at once
+    size_t cq_map_len;
+    size_t sqes_len;
+    int files[URING_FILES]; // Descriptor in each registered file slot, -1 = free or table not registered
+    int files_registered; // 1 once file table is registered
+    int buffers_registered; // 1 while a buffer table is registered
+    long long enters; // io_uring_enter() calls made
+};
+
+// Ring of provided buffers a multishot receive picks from; a buffer is the kernel's until its completion is
+// reaped, and the reader's until it hands the buffer back
+struct uring_bufs {
+    struct io_uring_buf_ring* ring; // Shared ring of buffers available to kernel
+    unsigned entries; // Buffers (power of two)
+    unsigned short tail; // Buffers handed to kernel so far (wraps)
+    char* data; // entries * size bytes
+    size_t size; // Bytes per buffer
+};
+
+// Function to set up a ring of at least `entries` submission slots, returns 0 or -1 (errno set, e.g. ENOSYS, EPERM)
+static inline int uring_init(struct uring* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = -1;
+    for (int i = 0; i < URING_FILES; i++) {
+        r->files[i] = -1;
+    }
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Map submission queue, completion queue (same mapping on kernels that offer it) and SQE array
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_map_len > r->sq_map_len) {
+        r->sq_map_len = r->cq_map_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    char* cq = r->sq_map;
+    if (!single) {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            munmap(r->sq_map, r->sq_map_len);
+            close(fd);
+            return -1;
+        }
+        cq = r->cq_map;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_map) {
+            munmap(r->cq_map, r->cq_map_len);
+        }
+        munmap(r->sq_map, r->sq_map_len);
+        close(fd);
+        return -1;
+    }
+
+    char* sq = r->sq_map;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    r->fd = fd;
+    return 0;
+}
+
+// Function to get a cleared SQE to fill in, NULL when submission queue is full
+static inline struct io_uring_sqe* uring_sqe(struct uring* r) {
+    unsigned tail = *r->sq_tail + r->queued;
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries) {
+        return NULL;
+    }
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->queued++;
+    return sqe;
+}
+
+// Function to fill in an SQE for `op` on `fd` (a registered file slot when `fixed`)
+static inline void uring_prep(struct io_uring_sqe* sqe, int op, int fd, int fixed, const void* addr, unsigned len, off_t offset,
+    unsigned long long data) {
+    sqe->opcode = (unsigned char)op;
+    sqe->fd = fd;
+    sqe->flags = fixed ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (unsigned long long)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = (unsigned long long)offset;
+    sqe->user_data = data;
+}
+
+// Function to submit every queued SQE and wait until at least `wait` completions are ready, returns SQEs submitted or -1
+static inline int uring_submit(struct uring* r, unsigned wait) {
+    unsigned n = r->queued;
+    __atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE); // Publish SQEs to kernel
+    r->queued = 0;
+    for (;;) {
+        r->enters++;
+        int got = (int)syscall(__NR_io_uring_enter, r->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, _NSIG / 8);
+        if (got >= 0 || errno != EINTR) {
+            return got;
+        }
+        n = 0; // Interrupted wait: SQEs were already consumed, keep waiting
+    }
+}
+
+// Function to submit queued SQEs and wait up to `timeout_us` (0 = forever) for a completion, returns 0 or -1
+// (ETIME when time ran out). Needs IORING_ENTER_EXT_ARG (Linux 5.11).
+static inline int uring_wait(struct uring* r, long long timeout_us) {
+    unsigned n = r->queued;
+    struct __kernel_timespec ts = { timeout_us / 1000000, timeout_us % 1000000 * 1000 };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = timeout_us > 0 ? (unsigned long long)(uintptr_t)&ts : 0;
+    __atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+    r->queued = 0;
+    r->enters++;
+    long got = syscall(__NR_io_uring_enter, r->fd, n, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return got < 0 ? -1 : 0;
+}
+
+// Function to get next completion without a syscall, NULL if none is ready
+static inline struct io_uring_cqe* uring_cqe(struct uring* r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cq_mask];
+}
+
+// Function to hand a completion's slot back to kernel
+static inline void uring_cqe_seen(struct uring* r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Function to close a ring. Kernel tears a closed ring down in background, and until then a socket held by a
+// pending receive or the file table stays bound (a new server on the port fails with EADDRINUSE), so pending
+// operations are cancelled and files unregistered here first.
+static inline void uring_free(struct uring* r) {
+    if (r->fd == -1) {
+        return;
+    }
+    struct io_uring_sqe* sqe = uring_sqe(r);
+    if (sqe) {
+        uring_prep(sqe, IORING_OP_ASYNC_CANCEL, -1, 0, NULL, 0, 0, URING_CANCEL_DATA);
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY; // Linux 5.19; older kernels refuse it
+        for (int done = 0; !done && uring_wait(r, URING_CLOSE_WAIT_US) == 0;) {
+            struct io_uring_cqe* cqe;
+            while ((cqe = uring_cqe(r))) {
+                done |= cqe->user_data == URING_CANCEL_DATA;
+                uring_cqe_seen(r);
+            }
+        }
+    }
+    if (r->files_registered) {
+        syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_FILES, NULL, 0);
+    }
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_map) {
+        munmap(r->cq_map, r->cq_map_len);
+    }
+    munmap(r->sq_map, r->sq_map_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+// Function to register `fd` in ring's file table, returns its slot (for IOSQE_FIXED_FILE) or -1 to use fd as it is
+static inline int uring_register_file(struct uring* r, int fd) {
+    if (!r->files_registered) {
+        // Table is registered once, empty; slots are then filled in with updates
+        if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, r->files, URING_FILES) == -1) {
+            return -1;
+        }
+        r->files_registered = 1;
+    }
+    for (int i = 0; i < URING_FILES; i++) {
+        if (r->files[i] == -1) {
+            struct io_uring_files_update u;
+            memset(&u, 0, sizeof(u));
+            u.offset = i;
+            u.fds = (unsigned long long)(uintptr_t)&fd;
+            if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES_UPDATE, &u, 1) != 1) {
+                return -1;
+            }
+            r->files[i] = fd;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Function to free a file slot taken by uring_register_file()
+static inline void uring_unregister_file(struct uring* r, int slot) {
+    if (slot < 0 || r->files[slot] == -1) {
+        return;
+    }
+    int none = -1;
+    struct io_uring_files_update u;
+    memset(&u, 0, sizeof(u));
+    u.offset = slot;
+    u.fds = (unsigned long long)(uintptr_t)&none;
+    syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES_UPDATE, &u, 1);
+    r->files[slot] = -1;
+}
+
+// Function to register `n` buffers for IORING_OP_READ_FIXED/WRITE_FIXED (pinned once instead of per operation),
+// returns 0 or -1 (e.g. over locked memory limit on older kernels)
+static inline int uring_register_buffers(struct uring* r, const struct iovec* iov, unsigned n) {
+    if (r->buffers_registered || syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n) == -1) {
+        return -1;
+    }
+    r->buffers_registered = 1;
+    return 0;
+}
+
+// Function to hand buffer `bid` back to kernel (visible once uring_bufs_publish() is called)
+static inline void uring_bufs_put(struct uring_bufs* b, unsigned short bid) {
+    struct io_uring_buf* buf = &b->ring->bufs[b->tail & (b->entries - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)(b->data + (size_t)bid * b->size);
+    buf->len = (unsigned)b->size;
+    buf->bid = bid;
+    b->tail++;
+}
+
+// Function to publish buffers handed back since last call
+static inline void uring_bufs_publish(struct uring_bufs* b) {
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+// Function to register `entries` (power of two) provided buffers of `size` bytes with ring, all handed to kernel.
+// Returns 0, or -1 when kernel has no buffer rings (Linux 5.19).
+static inline int uring_bufs_init(struct uring* r, struct uring_bufs* b, unsigned entries, size_t size) {
+    struct io_uring_buf_reg reg;
+    memset(b, 0, sizeof(*b));
+    b->entries = entries;
+    b->size = size;
+    if (posix_memalign((void**)&b->ring, 4096, entries * sizeof(struct io_uring_buf)) != 0) {
+        b->ring = NULL;
+        return -1;
+    }
+    memset(b->ring, 0, entries * sizeof(struct io_uring_buf));
+    b->data = malloc(entries * size);
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)b->ring;
+    reg.ring_entries = entries;
+    reg.bgid = URING_BGID;
+    if (!b->data || syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        free(b->data);
+        free(b->ring);
+        memset(b, 0, sizeof(*b));
+        return -1;
+    }
+    for (unsigned i = 0; i < entries; i++) {
+        uring_bufs_put(b, (unsigned short)i);
+    }
+    uring_bufs_publish(b);
+    return 0;
+}
+
+// Function to free buffers once their ring is closed
+static inline void uring_bufs_free(struct uring_bufs* b) {
+    free(b->data);
+    free(b->ring);
+    memset(b, 0, sizeof(*b));
+}
+
+#endif
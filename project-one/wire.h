@@ -0,0 +1,297 @@
+// Wire formats shared by the server and client: the request, the reply and the frame header.
+// Every field has a fixed width and is sent big-endian, so builds for different CPUs or with a different
+// size of `long` read each other's datagrams. Programs keep host structs and only encode and decode at the
+// socket. A request and its reply carry WIRE_VERSION; a server sent a request of another version answers
+// with REPLY_VERSION instead of guessing at its layout. A reply echoes its request's request_id, so a client
+// never takes a late reply to an earlier request for the answer to its current one.
+// A frame header is 16 bytes. Its sequence number is the low 32 bits of the frame number; the receiver
+// widens it again next to the frame it expects (wire_seq_expand), which is exact while the two are less
+// than 2^31 frames apart, so a file may have any number of frames.
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "crc32c.h"
+
+#define WIRE_VERSION 3 // Version of request, reply and frame layouts
+#define REQUEST_MAGIC 0x52455131 // "REQ1", tells a request apart from ACKs and NACKs
+#define REPLY_MAGIC 0x52504c31 // "RPL1", tells a reply apart from late frames
+#define MIN_PAYLOAD 512 // Smallest frame payload a transfer may use
+#define MAX_PAYLOAD 65024 // Largest frame payload (fits a loopback/jumbo UDP datagram)
+#define MAX_STREAMS 16 // Most parallel streams one transfer may use
+#define MAX_FILE_NAME 255 // Longest file name a request carries
+
+#define PROTO_EXIT 0 // Request protocol: stop server
+#define REQ_CHECKSUM 1 // Request flag: checksum every frame and send each stream's digest
+#define REQ_FEC_ADAPT 2 // Request flag: server may change parity per block with measured loss
+
+#define REPLY_OK 0 // Reply status: transfer agreed (total_frame 0 = file or range is empty)
+#define REPLY_NO_FILE 1 // Reply status: file does not exist or cannot be read
+#define REPLY_BUSY 2 // Reply status: server is at its session or multicast cap
+#define REPLY_BAD_REQUEST 3 // Reply status: request names an unknown protocol
+#define REPLY_VERSION 4 // Reply status: request has another WIRE_VERSION (reply's version is server's)
+#define REPLY_TOO_BIG 5 // Reply status: request names more files or bytes than one bundle may hold
+
+#define REPLY_BUNDLE 1 // Reply flag: request named a directory or list of files, transfer is one bundle of them (bundle.h)
+
+#define FRAME_CRC 1 // Frame flag: `crc` holds CRC32C of data and header
+#define FRAME_DIGEST 2 // Frame flag: `digest` holds CRC32C of data of every frame of stream (set on its last frame)
+#define FRAME_PARITY 4 // Frame flag: FEC parity frame, ID is its block's first frame and `fec` says which parity row
+#define FRAME_PACKED 8 // Frame flag: data is packed with transfer's codec, `length` is packed size
+
+#define FRAME_HEADER_SIZE 16 // Bytes before data in a frame on the wire
+#define FRAME_CRC_SPAN 12 // Header bytes covered by frame checksum (all but checksum itself)
+#define WIRE_PREFIX_SIZE 8 // Leading bytes every version of a request or reply keeps: magic, version, status or protocol
+#define REQUEST_SIZE(name_len) (48 + (size_t)(name_len)) // Bytes on wire for a request naming a file of name_len bytes
+#define REPLY_SIZE(streams) (66 + 2 * (size_t)(streams)) // Bytes on wire for a reply listing `streams` ports
+
+// A frame: host copy of its header fields, then the header as sent and its data, so header and data go out
+// (and come in) as one contiguous datagram
+struct frame_packet {
+    long int ID; // Frame number (parity frame: first frame of its block)
+    long int length; // Bytes of data in frame
+    unsigned int flags; // FRAME_CRC, FRAME_DIGEST, FRAME_PARITY, FRAME_PACKED
+    unsigned int digest; // CRC32C of data of stream's frames up to this one (0 unless FRAME_DIGEST)
+    unsigned int fec; // Parity frame: parity frames in its block (bits 8-15) and its row (bits 0-7), 0 for data frames
+    unsigned int crc; // CRC32C of data, then of header's first FRAME_CRC_SPAN bytes (0 unless FRAME_CRC)
+    unsigned char header[FRAME_HEADER_SIZE]; // Fields above as sent: seq, length, flags, fec, digest, crc
+    char data[MAX_PAYLOAD]; // Data (only `length` bytes are sent)
+};
+
+// What a client asks for
+struct transfer_request {
+    int version; // Sender's WIRE_VERSION
+    int protocol; // 1 = Stop-and-Wait, 2 = Go-Back-N, 3 = Selective Repeat, 4 = Multicast, PROTO_EXIT
+    int flags; // REQ_CHECKSUM, REQ_FEC_ADAPT
+    int streams; // Parallel streams wanted
+    long int payload_size; // Bytes of data per frame wanted (0 = server default)
+    int window; // Frames client can take past a gap (0 = server default)
+    double drop_percent; // Simulated loss on frames sent to client
+    int fec_k; // FEC data frames per block (0 = off)
+    int fec_m; // FEC parity frames per block to start with
+    int codecs; // Codecs client can unpack (bit n = codec n)
+    long int first_frame; // First frame wanted (0 = from first frame)
+    long int last_frame; // Last frame wanted (0 = to last frame)
+    unsigned int request_id; // Client's number for this request, echoed in reply so a stale reply is not taken for it
+    char file_name[MAX_FILE_NAME + 1]; // File wanted
+};
+
+// Server's answer: what both sides will use for the transfer
+struct transfer_reply {
+    int version; // Sender's WIRE_VERSION
+    int status; // REPLY_OK, or why request was refused
+    int protocol; // Protocol transfer uses
+    int streams; // Parallel streams (1 = frames come from server's main port)
+    int checksum; // 1 = frames carry CRC32C, and last frame of each stream its digest
+    int fec_k; // FEC data frames per block, 0 = no parity frames
+    int codec; // Codec frames may be packed with (CODEC_NONE = all frames raw)
+    int flags; // REPLY_BUNDLE
+    long int payload_size; // Agreed bytes of data per frame
+    int window; // Agreed window: frames in flight at most (ceiling on congestion window), and frames client accepts past a gap
+    unsigned int file_tag; // Identifies this version of file (size, inode and modification time), never 0
+    long int total_frame; // Total frames in file, 0 = nothing to send
+    long int first_frame; // First frame that will be sent
+    long int last_frame; // Last frame that will be sent
+    long long file_size; // File size in bytes (gives length of a rebuilt last frame)
+    unsigned int mcast_group; // Multicast: group frames are sent to, 0 = to receiver's own socket (network byte order)
+    unsigned short mcast_port; // Multicast: group's port (network byte order)
+    unsigned int request_id; // request_id of request this answers (0 in a reply to another version)
+    unsigned short port[MAX_STREAMS]; // Server port of each stream (network byte order)
+};
+
+// Functions to write and read big-endian integers
+static inline void wire_put16(unsigned char* p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static inline void wire_put32(unsigned char* p, uint32_t v) {
+    wire_put16(p, (uint16_t)(v >> 16));
+    wire_put16(p + 2, (uint16_t)v);
+}
+
+static inline void wire_put64(unsigned char* p, uint64_t v) {
+    wire_put32(p, (uint32_t)(v >> 32));
+    wire_put32(p + 4, (uint32_t)v);
+}
+
+static inline uint16_t wire_get16(const unsigned char* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t wire_get32(const unsigned char* p) {
+    return (uint32_t)wire_get16(p) << 16 | wire_get16(p + 2);
+}
+
+static inline uint64_t wire_get64(const unsigned char* p) {
+    return (uint64_t)wire_get32(p) << 32 | wire_get32(p + 4);
+}
+
+// Function to widen a 32-bit sequence number to the frame number nearest `ref` (the frame receiver expects next)
+static inline long int wire_seq_expand(uint32_t seq, long int ref) {
+    return ref + (int32_t)(seq - (uint32_t)ref);
+}
+
+// Function to write a frame's header from its fields. With `checksum` set, frame->crc is finished from `data_crc`
+// (CRC32C of the data as sent) and the header, and FRAME_CRC is set.
+static inline void frame_encode(struct frame_packet* f, unsigned int data_crc, int checksum) {
+    unsigned char* h = f->header;
+    if (checksum) {
+        f->flags |= FRAME_CRC;
+    }
+    wire_put32(h, (uint32_t)f->ID);
+    wire_put16(h + 4, (uint16_t)f->length);
+    h[6] = (unsigned char)f->flags;
+    h[7] = (unsigned char)((f->fec >> 8 & 0xf) << 4 | (f->fec & 0xf)); // Parity rows and row, both below 16
+    wire_put32(h + 8, f->digest);
+    f->crc = checksum ? crc32c(data_crc, h, FRAME_CRC_SPAN) : 0;
+    wire_put32(h + FRAME_CRC_SPAN, f->crc);
+}
+
+// Function to read a received frame's header (`n` bytes arrived at f->header) into its fields, widening its
+// sequence number next to `ref`. Returns 0 if datagram is not a whole frame.
+static inline int frame_decode(struct frame_packet* f, ssize_t n, long int ref) {
+    const unsigned char* h = f->header;
+    if (n < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+    f->ID = wire_seq_expand(wire_get32(h), ref);
+    f->length = wire_get16(h + 4);
+    f->flags = h[6];
+    f->fec = (unsigned int)(h[7] >> 4) << 8 | (h[7] & 0xf);
+    f->digest = wire_get32(h + 8);
+    f->crc = wire_get32(h + FRAME_CRC_SPAN);
+    return f->length == n - FRAME_HEADER_SIZE;
+}
+
+// Function to check a decoded frame's checksum against its data and header
+static inline int frame_crc_ok(const struct frame_packet* f) {
+    return (f->flags & FRAME_CRC) && f->crc == crc32c(crc32c(0, f->data, f->length), f->header, FRAME_CRC_SPAN);
+}
+
+// Function to write a request into `buf` (at least REQUEST_SIZE(MAX_FILE_NAME) bytes), returns bytes to send
+static inline size_t request_encode(const struct transfer_request* r, unsigned char* buf) {
+    size_t name_len = strnlen(r->file_name, MAX_FILE_NAME);
+    wire_put32(buf, REQUEST_MAGIC);
+    buf[4] = (unsigned char)r->version;
+    buf[5] = (unsigned char)r->protocol;
+    buf[6] = (unsigned char)r->flags;
+    buf[7] = (unsigned char)r->streams;
+    wire_put32(buf + 8, (uint32_t)r->payload_size);
+    wire_put32(buf + 12, (uint32_t)r->window);
+    wire_put32(buf + 16, (uint32_t)(r->drop_percent * 10000 + 0.5)); // Parts per million
+    buf[20] = (unsigned char)r->fec_k;
+    buf[21] = (unsigned char)r->fec_m;
+    wire_put16(buf + 22, (uint16_t)r->codecs);
+    wire_put64(buf + 24, (uint64_t)r->first_frame);
+    wire_put64(buf + 32, (uint64_t)r->last_frame);
+    wire_put16(buf + 40, (uint16_t)name_len);
+    wire_put16(buf + 42, 0);
+    wire_put32(buf + 44, r->request_id);
+    memcpy(buf + 48, r->file_name, name_len);
+    return REQUEST_SIZE(name_len);
+}
+
+// Function to read a request. Returns 1 for a request of this version, -1 for one of another version (only
+// r->version is filled in), 0 if datagram is not a request.
+static inline int request_parse(const void* data, ssize_t len, struct transfer_request* r) {
+    const unsigned char* buf = data;
+    memset(r, 0, sizeof(*r));
+    if (len < WIRE_PREFIX_SIZE || wire_get32(buf) != REQUEST_MAGIC) {
+        return 0;
+    }
+    r->version = buf[4];
+    if (r->version != WIRE_VERSION) {
+        return -1;
+    }
+    if (len < (ssize_t)REQUEST_SIZE(0)) {
+        return 0;
+    }
+    size_t name_len = wire_get16(buf + 40);
+    if (name_len > MAX_FILE_NAME || len != (ssize_t)REQUEST_SIZE(name_len) || memchr(buf + 48, '\0', name_len)) {
+        return 0;
+    }
+    r->protocol = buf[5];
+    r->flags = buf[6];
+    r->streams = buf[7];
+    r->payload_size = wire_get32(buf + 8);
+    r->window = (int)(wire_get32(buf + 12) & 0x7fffffff);
+    r->drop_percent = wire_get32(buf + 16) / 10000.0;
+    r->fec_k = buf[20];
+    r->fec_m = buf[21];
+    r->codecs = wire_get16(buf + 22);
+    r->first_frame = (long int)wire_get64(buf + 24);
+    r->last_frame = (long int)wire_get64(buf + 32);
+    r->request_id = wire_get32(buf + 44);
+    memcpy(r->file_name, buf + 48, name_len);
+    return 1;
+}
+
+// Function to write a reply into `buf` (at least REPLY_SIZE(MAX_STREAMS) bytes), returns bytes to send
+static inline size_t reply_encode(const struct transfer_reply* r, unsigned char* buf) {
+    int streams = r->streams >= 0 && r->streams <= MAX_STREAMS ? r->streams : 0;
+    wire_put32(buf, REPLY_MAGIC);
+    buf[4] = (unsigned char)r->version;
+    buf[5] = (unsigned char)r->status;
+    buf[6] = (unsigned char)r->protocol;
+    buf[7] = (unsigned char)streams;
+    buf[8] = (unsigned char)(r->checksum != 0);
+    buf[9] = (unsigned char)r->fec_k;
+    buf[10] = (unsigned char)r->codec;
+    buf[11] = (unsigned char)r->flags;
+    wire_put32(buf + 12, (uint32_t)r->payload_size);
+    wire_put32(buf + 16, (uint32_t)r->window);
+    wire_put32(buf + 20, r->file_tag);
+    wire_put64(buf + 24, (uint64_t)r->total_frame);
+    wire_put64(buf + 32, (uint64_t)r->first_frame);
+    wire_put64(buf + 40, (uint64_t)r->last_frame);
+    wire_put64(buf + 48, (uint64_t)r->file_size);
+    memcpy(buf + 56, &r->mcast_group, 4); // Addresses and ports are kept in network byte order already
+    memcpy(buf + 60, &r->mcast_port, 2);
+    wire_put32(buf + 62, r->request_id);
+    memcpy(buf + 66, r->port, 2 * (size_t)streams);
+    return REPLY_SIZE(streams);
+}
+
+// Function to read a reply, returns 0 if datagram is not a well-formed reply. A reply of another version only has
+// its version and status filled in.
+static inline int reply_parse(const void* data, ssize_t len, struct transfer_reply* r) {
+    const unsigned char* buf = data;
+    memset(r, 0, sizeof(*r));
+    if (len < WIRE_PREFIX_SIZE || wire_get32(buf) != REPLY_MAGIC) {
+        return 0;
+    }
+    r->version = buf[4];
+    r->status = buf[5];
+    if (r->version != WIRE_VERSION) {
+        r->status = REPLY_VERSION;
+        return 1;
+    }
+    r->streams = buf[7];
+    r->payload_size = wire_get32(buf + 12);
+    if (r->streams > MAX_STREAMS || len != (ssize_t)REPLY_SIZE(r->streams) || r->payload_size < MIN_PAYLOAD
+        || r->payload_size > MAX_PAYLOAD) {
+        return 0; // Payload size sizes client's buffers, so one out of range is never trusted
+    }
+    r->protocol = buf[6];
+    r->checksum = buf[8];
+    r->fec_k = buf[9];
+    r->codec = buf[10];
+    r->flags = buf[11];
+    r->window = (int)(wire_get32(buf + 16) & 0x7fffffff);
+    r->file_tag = wire_get32(buf + 20);
+    r->total_frame = (long int)wire_get64(buf + 24);
+    r->first_frame = (long int)wire_get64(buf + 32);
+    r->last_frame = (long int)wire_get64(buf + 40);
+    r->file_size = (long long)wire_get64(buf + 48);
+    memcpy(&r->mcast_group, buf + 56, 4);
+    memcpy(&r->mcast_port, buf + 60, 2);
+    r->request_id = wire_get32(buf + 62);
+    memcpy(r->port, buf + 66, 2 * (size_t)r->streams);
+    return 1;
+}
+
+#endif